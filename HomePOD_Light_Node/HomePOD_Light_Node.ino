@@ -8,11 +8,19 @@
  */
 
 #include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <rom/crc.h>
+#include <sys/time.h>
 #include <ArduinoJson.h>
 #include <BH1750.h>
 #include <HTTPClient.h>
+#include <WebServer.h>
+#include <WebSocketsClient.h>
 #include <WiFi.h>
+#include <WiFiClientSecure.h>
 #include <Wire.h>
+#include <esp_timer.h>
 
 // ============================================
 // CONFIGURATION
@@ -20,15 +28,67 @@
 #define WIFI_SSID "Netgear 2006"    // Copied from Env Node
 #define WIFI_PASSWORD "woaiPDMS59"  // Copied from Env Node
 #define RASPBERRY_PI_IP "10.0.0.47" // Copied from Env Node
+#define REPLICA_PI_IP ""            // Standby Pi running "homepod_server_v3.py replica"; "" = none
 #define RASPBERRY_PI_PORT 5000
+// Encrypted uplink: 1 = TLS 1.2 with a pre-shared key over one kept-alive
+// connection (handshake once per connection, not per report), 0 = plain HTTP
+#define UPLINK_TLS 0
+#define UPLINK_TLS_PORT 5443
+#define UPLINK_PSK "" // Hex of this node's secret in uplink_psk.txt on the Pi
+#define UPLINK_PORT (UPLINK_TLS ? UPLINK_TLS_PORT : RASPBERRY_PI_PORT)
+#define FAILOVER_AFTER 3          // Unreachable reports in a row before switching Pi
+#define FAILBACK_CHECK_MS 60000   // While on the replica, how often to try the primary
+#define FAILBACK_CONNECT_MS 500   // TCP connect timeout for that check
+#define FIRMWARE_BUILD __DATE__ " " __TIME__ // Groups boot profiles per build
 #define DEVICE_NAME "HomePOD_Light_Node"
 
 // PIN DEFINITIONS
 #define I2C_SDA_PIN 21
 #define I2C_SCL_PIN 22
-#define BH1750_ADDRESS 0x23
+#define BH1750_ADDRESS 0x23   // ADDR pin low
+#define BH1750_ADDRESS_2 0x5C // ADDR pin high (second sensor, e.g. window)
+#define I2C_BUS_CLOCK 400000  // Fast mode; BH1750 supports it
+#define I2C_MAX_DEVICES 16
+#define MAX_LIGHT_SENSORS 2
 
 #define SENSOR_READ_INTERVAL 10000 // Match server reporting interval (10s)
+#define SEND_MAX_ATTEMPTS 3        // POST attempts per report (same seq)
+#define SEND_RETRY_BACKOFF_MS 250  // Doubles after each failed attempt
+
+// Flash history (1-minute rollups, ~72 h)
+#define HISTORY_CHANNEL_NAMES "light"
+#define HISTORY_CHANNELS 4
+#define HISTORY_RECORD_SIZE 64
+#define HISTORY_SECTOR_SIZE 4096
+#define HISTORY_SECTORS 68 // 68 * 64 records = 72.5 h
+#define HISTORY_RECORDS_PER_SECTOR (HISTORY_SECTOR_SIZE / HISTORY_RECORD_SIZE)
+#define HISTORY_SLOTS (HISTORY_SECTORS * HISTORY_RECORDS_PER_SECTOR)
+#define HISTORY_HTTP_PORT 80
+#define CLOCK_VALID_AFTER 1600000000 // Unix time; earlier means NTP not synced
+
+// Flight recorder (RTC memory, survives soft resets and panics)
+#define FLIGHT_RECORDS 128      // 8 bytes each
+#define FLIGHT_SLOW_TASK_MS 50  // loop() steps at least this long are logged
+#define FLIGHT_MAGIC 0x31465048 // "HPF1"
+
+// Memory telemetry (sent in "status" with every report)
+#define MAX_TRACKED_TASKS 24
+#define STACK_WARN_BYTES 512    // Any task with less stack headroom than this
+#define STACK_WARN_SKIP "IDLE"  // Except these (name prefix): tiny by design
+#define HEAP_WARN_BYTES 16384   // Minimum-ever free heap below this
+
+// Control channel (WebSocket to the Pi: commands down, reports up). It is
+// plaintext, so it stays off while the encrypted uplink is on.
+#define CONTROL_CHANNEL (!UPLINK_TLS)
+#define CONTROL_WS_PORT 5002
+#define CONTROL_RECONNECT_MS 2000
+#define CONTROL_HEARTBEAT_MS 15000 // Ping interval; 3 missed pongs drop the link
+#define CONTROL_BUFFER 8           // Unacked reports kept for resend
+#define CONTROL_DOC_SIZE 1024
+#define CLOCK_SYNC_MS 10000       // Clock offset probe interval
+#define CLOCK_MAX_RTT_US 20000     // Slower probes are discarded
+#define CLOCK_WINDOW 6             // Probes kept; the fastest sets the offset
+#define MIN_REPORT_INTERVAL 1000   // Floor for the set_interval command
 
 // DATA STRUCTURES
 enum LightCondition {
@@ -48,6 +108,7 @@ struct LightReading {
 // LIGHT SENSOR CLASS
 class LightSensor {
 private:
+  uint8_t _address;
   BH1750 *_sensor;
   bool _initialized;
   float _lastLux;
@@ -66,13 +127,18 @@ private:
   }
 
 public:
-  LightSensor() : _sensor(nullptr), _initialized(false), _lastLux(0.0f) {}
+  explicit LightSensor(uint8_t address = BH1750_ADDRESS)
+      : _address(address), _sensor(nullptr), _initialized(false),
+        _lastLux(0.0f) {}
+
+  uint8_t getAddress() const { return _address; }
 
   bool begin() {
-    _sensor = new BH1750(BH1750_ADDRESS);
+    _sensor = new BH1750(_address);
     if (_sensor == nullptr)
       return false;
-    _initialized = _sensor->begin(BH1750::CONTINUOUS_HIGH_RES_MODE);
+    // begin() defaults its address to 0x23, overriding the constructor's
+    _initialized = _sensor->begin(BH1750::CONTINUOUS_HIGH_RES_MODE, _address);
     if (_initialized) {
       delay(180);
       float lux = _sensor->readLightLevel();
@@ -102,9 +168,722 @@ public:
   }
 };
 
+// I2C BUS
+// Every address is probed at boot and known chips get a driver, so adding
+// a second BH1750 (ADDR high) needs no firmware change. The inventory goes
+// to the server in the first report after boot.
+struct I2CDevice {
+  uint8_t address;
+  const char *name;    // "unknown" if not in KNOWN_I2C_DEVICES
+  const char *channel; // Reported channel, nullptr if no driver is bound
+};
+
+static const struct {
+  uint8_t address;
+  const char *name;
+  const char *channel;
+} KNOWN_I2C_DEVICES[] = {
+    {BH1750_ADDRESS, "BH1750", "light"},
+    {BH1750_ADDRESS_2, "BH1750", "light_2"},
+};
+
+I2CDevice i2cDevices[I2C_MAX_DEVICES];
+size_t i2cDeviceCount = 0;
+LightSensor *lightSensors[MAX_LIGHT_SENSORS];
+const char *lightChannels[MAX_LIGHT_SENSORS];
+size_t lightCount = 0;
+
+void scanI2C() {
+  Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
+  Wire.setClock(I2C_BUS_CLOCK);
+
+  // 0x00-0x07 and 0x78-0x7F are reserved
+  for (uint8_t addr = 0x08; addr <= 0x77 && i2cDeviceCount < I2C_MAX_DEVICES;
+       addr++) {
+    Wire.beginTransmission(addr);
+    if (Wire.endTransmission() != 0)
+      continue;
+
+    I2CDevice &dev = i2cDevices[i2cDeviceCount++];
+    dev.address = addr;
+    dev.name = "unknown";
+    dev.channel = nullptr;
+
+    for (const auto &known : KNOWN_I2C_DEVICES) {
+      if (known.address != addr)
+        continue;
+      dev.name = known.name;
+      if (lightCount < MAX_LIGHT_SENSORS) {
+        LightSensor *sensor = new LightSensor(addr);
+        if (sensor->begin()) {
+          lightSensors[lightCount] = sensor;
+          lightChannels[lightCount] = known.channel;
+          lightCount++;
+          dev.channel = known.channel;
+        } else {
+          delete sensor;
+        }
+      }
+      break;
+    }
+    Serial.printf("I2C 0x%02X: %s %s\n", addr, dev.name,
+                  dev.channel ? dev.channel : "(no driver)");
+  }
+}
+
+// FLASH HISTORY
+// 1-minute rollups (min/max/mean per channel) kept in a ring over the SPIFFS
+// data partition, so "what happened overnight" survives a Pi outage and
+// node reboots. Records are appended slot by slot and a sector is erased
+// only when the head enters it, so every sector wears evenly.
+// Served as raw records on GET /history?from=<unix>&to=<unix>.
+struct RollupRecord {
+  uint32_t minute; // Unix time of the minute start
+  uint16_t count;  // Samples rolled up
+  uint8_t channels;
+  uint8_t version;
+  float minV[HISTORY_CHANNELS];
+  float maxV[HISTORY_CHANNELS];
+  float meanV[HISTORY_CHANNELS];
+  uint32_t reserved;
+  uint32_t crc; // crc32_le of the bytes before it; erased flash never matches
+};
+static_assert(sizeof(RollupRecord) == HISTORY_RECORD_SIZE,
+              "RollupRecord must fill one slot");
+
+class FlashHistory {
+private:
+  const esp_partition_t *_part;
+  uint32_t _head; // Next slot to write
+  uint32_t _minute;
+  uint16_t _samples;
+  uint8_t _channels;
+  float _min[HISTORY_CHANNELS];
+  float _max[HISTORY_CHANNELS];
+  float _sum[HISTORY_CHANNELS];
+
+  bool readSlot(uint32_t slot, RollupRecord &r) {
+    if (esp_partition_read(_part, slot * HISTORY_RECORD_SIZE, &r, sizeof(r)) !=
+        ESP_OK)
+      return false;
+    return r.crc == crc32_le(0, (const uint8_t *)&r, offsetof(RollupRecord, crc));
+  }
+
+  void flush() {
+    RollupRecord r;
+    memset(&r, 0, sizeof(r));
+    r.minute = _minute;
+    r.count = _samples;
+    r.channels = _channels;
+    r.version = 1;
+    for (int c = 0; c < _channels; c++) {
+      r.minV[c] = _min[c];
+      r.maxV[c] = _max[c];
+      r.meanV[c] = _sum[c] / _samples;
+    }
+    r.crc = crc32_le(0, (const uint8_t *)&r, offsetof(RollupRecord, crc));
+
+    if (_head % HISTORY_RECORDS_PER_SECTOR == 0)
+      esp_partition_erase_range(_part, _head * HISTORY_RECORD_SIZE,
+                                HISTORY_SECTOR_SIZE);
+    esp_partition_write(_part, _head * HISTORY_RECORD_SIZE, &r, sizeof(r));
+    _head = (_head + 1) % HISTORY_SLOTS;
+    _samples = 0;
+  }
+
+public:
+  FlashHistory() : _part(nullptr), _head(0), _minute(0), _samples(0), _channels(0) {}
+
+  bool begin() {
+    _part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                     ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+    if (_part == nullptr ||
+        _part->size < HISTORY_SLOTS * HISTORY_RECORD_SIZE) {
+      _part = nullptr;
+      return false;
+    }
+    // Resume after the newest valid record
+    RollupRecord r;
+    uint32_t newest = 0;
+    for (uint32_t slot = 0; slot < HISTORY_SLOTS; slot++) {
+      if (readSlot(slot, r) && r.minute >= newest) {
+        newest = r.minute;
+        _head = (slot + 1) % HISTORY_SLOTS;
+      }
+    }
+    return true;
+  }
+
+  void add(const float *values, uint8_t channels) {
+    time_t now = time(nullptr);
+    if (_part == nullptr || now < CLOCK_VALID_AFTER)
+      return; // No partition, or no wall clock yet
+    uint32_t minute = now - now % 60;
+    if (_samples && minute != _minute)
+      flush();
+    if (_samples == 0) {
+      _minute = minute;
+      _channels = min(channels, (uint8_t)HISTORY_CHANNELS);
+      for (int c = 0; c < _channels; c++) {
+        _min[c] = _max[c] = values[c];
+        _sum[c] = 0.0f;
+      }
+    }
+    for (int c = 0; c < _channels; c++) {
+      _min[c] = min(_min[c], values[c]);
+      _max[c] = max(_max[c], values[c]);
+      _sum[c] += values[c];
+    }
+    _samples++;
+  }
+
+  void handleQuery(WebServer &server) {
+    if (_part == nullptr) {
+      server.send(503, "text/plain", "no history partition");
+      return;
+    }
+    uint32_t from = server.hasArg("from") ? server.arg("from").toInt() : 0;
+    uint32_t to = server.hasArg("to") ? server.arg("to").toInt() : UINT32_MAX;
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.sendHeader("X-Channels", HISTORY_CHANNEL_NAMES);
+    server.send(200, "application/octet-stream", "");
+
+    // Oldest first: walk the ring starting at the head
+    uint8_t buf[HISTORY_RECORD_SIZE * 16];
+    size_t used = 0;
+    RollupRecord r;
+    for (uint32_t i = 0; i < HISTORY_SLOTS; i++) {
+      uint32_t slot = (_head + i) % HISTORY_SLOTS;
+      if (!readSlot(slot, r) || r.minute < from || r.minute > to)
+        continue;
+      memcpy(buf + used, &r, sizeof(r));
+      used += sizeof(r);
+      if (used == sizeof(buf)) {
+        server.sendContent((const char *)buf, used);
+        used = 0;
+      }
+    }
+    if (used)
+      server.sendContent((const char *)buf, used);
+    server.sendContent("");
+  }
+};
+
+// BOOT PROFILER
+// One microsecond timestamp per boot stage, filled in once and shipped as
+// "boot" until a report carrying the first-report mark has landed.
+// esp_timer starts with the app, so "app_start" (setup() entered) is the
+// time from the ROM/bootloader hand-off through C++ static init.
+enum BootPhase {
+  BOOT_APP_START,
+  BOOT_SERIAL,
+  BOOT_I2C,
+  BOOT_FLASH,
+  BOOT_WIFI_ASSOC,
+  BOOT_DHCP,
+  BOOT_SETUP_DONE,
+  BOOT_FIRST_REPORT,
+  BOOT_PHASES
+};
+
+const char *const BOOT_PHASE_NAMES[BOOT_PHASES] = {
+    "app_start", "serial", "i2c",        "flash",
+    "wifi_assoc", "dhcp",  "setup_done", "first_report"};
+
+class BootProfiler {
+private:
+  uint32_t _us[BOOT_PHASES] = {}; // 0 = stage not reached yet
+  bool _shipped = false;
+
+public:
+  void mark(BootPhase phase) {
+    if (_us[phase] == 0)
+      _us[phase] = (uint32_t)esp_timer_get_time();
+  }
+
+  bool pending() const { return !_shipped; }
+
+  void addTo(JsonObject boot) {
+    boot["firmware"] = FIRMWARE_BUILD;
+    JsonObject us = boot.createNestedObject("us");
+    for (int i = 0; i < BOOT_PHASES; i++) {
+      if (_us[i])
+        us[BOOT_PHASE_NAMES[i]] = _us[i];
+    }
+  }
+
+  // A report landed: the first one sets the mark, the next one carries it
+  void landed() {
+    if (_us[BOOT_FIRST_REPORT])
+      _shipped = true;
+    else
+      mark(BOOT_FIRST_REPORT);
+  }
+};
+
+// FLIGHT RECORDER
+// The last FLIGHT_RECORDS events live in RTC slow memory, which keeps its
+// contents through panics, watchdog and software resets (not power loss).
+// An event is 8 bytes written under a spinlock. loop() only stores which
+// step it is in; steps slower than FLIGHT_SLOW_TASK_MS are logged on exit.
+// At boot the previous ring is copied to RAM and POSTed once, raw, to
+// /api/flight/<device> with the reset reason and the step loop() was in.
+enum FlightEvent : uint8_t {
+  FLIGHT_BOOT = 1,     // b = reset reason (esp_reset_reason_t)
+  FLIGHT_TASK,         // a = task, b = duration in ms
+  FLIGHT_WIFI,         // a = FlightWifi, b = disconnect reason
+  FLIGHT_SENSOR_ERROR, // a = FlightSensor
+  FLIGHT_HEAP,         // a = largest free block in KB, b = free heap in KB
+  FLIGHT_STACK,        // a = task, b = stack high-water mark in bytes
+  FLIGHT_POST          // a = attempts, b = HTTP status (int16, <0 = client)
+};
+
+enum FlightTask : uint8_t {
+  TASK_NONE,
+  TASK_SAMPLE,
+  TASK_WATERFALL,
+  TASK_REPORT,
+  TASK_HISTORY,
+  TASK_CONTROL
+};
+
+enum FlightWifi : uint8_t { WIFI_CONNECTED = 1, WIFI_GOT_IP, WIFI_DISCONNECTED };
+
+enum FlightSensor : uint8_t { FLIGHT_SENSOR_DHT = 1, FLIGHT_SENSOR_LIGHT };
+
+struct FlightRecord {
+  uint32_t ms; // millis() at the event
+  uint8_t type;
+  uint8_t a;
+  uint16_t b;
+};
+
+struct FlightLog {
+  uint32_t magic;
+  uint32_t bootId;
+  uint16_t head; // Next slot to write
+  uint16_t count;
+  uint8_t task; // Step loop() is in right now
+  uint32_t taskSince;
+  FlightRecord records[FLIGHT_RECORDS];
+};
+
+RTC_NOINIT_ATTR FlightLog rtcFlight;
+
+class FlightRecorder {
+private:
+  FlightRecord _prev[FLIGHT_RECORDS]; // Previous boot's events, oldest first
+  uint16_t _prevCount = 0;
+  uint32_t _prevBootId = 0;
+  uint8_t _prevTask = TASK_NONE;
+  uint32_t _prevTaskSince = 0;
+  uint8_t _resetReason = ESP_RST_UNKNOWN;
+  bool _uploaded = false;
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+  static uint16_t kb(uint32_t bytes) {
+    return bytes / 1024 > 0xFFFF ? 0xFFFF : bytes / 1024;
+  }
+
+public:
+  void begin(uint32_t bootId) {
+    _resetReason = esp_reset_reason();
+    FlightLog &log = rtcFlight;
+    // RTC memory is random after power-on; the magic and bounds catch that
+    if (_resetReason != ESP_RST_POWERON && log.magic == FLIGHT_MAGIC &&
+        log.count <= FLIGHT_RECORDS && log.head < FLIGHT_RECORDS) {
+      uint16_t first = (log.head + FLIGHT_RECORDS - log.count) % FLIGHT_RECORDS;
+      for (uint16_t i = 0; i < log.count; i++)
+        _prev[i] = log.records[(first + i) % FLIGHT_RECORDS];
+      _prevCount = log.count;
+      _prevBootId = log.bootId;
+      _prevTask = log.task;
+      _prevTaskSince = log.taskSince;
+    }
+    log.magic = FLIGHT_MAGIC;
+    log.bootId = bootId;
+    log.head = 0;
+    log.count = 0;
+    log.task = TASK_NONE;
+    log.taskSince = 0;
+    record(FLIGHT_BOOT, 0, _resetReason);
+  }
+
+  void record(uint8_t type, uint8_t a, uint16_t b) {
+    uint32_t now = millis();
+    portENTER_CRITICAL(&_mux);
+    FlightRecord &r = rtcFlight.records[rtcFlight.head];
+    r.ms = now;
+    r.type = type;
+    r.a = a;
+    r.b = b;
+    rtcFlight.head = (rtcFlight.head + 1) % FLIGHT_RECORDS;
+    if (rtcFlight.count < FLIGHT_RECORDS)
+      rtcFlight.count++;
+    portEXIT_CRITICAL(&_mux);
+  }
+
+  void enter(FlightTask task) {
+    rtcFlight.taskSince = millis();
+    rtcFlight.task = task;
+  }
+
+  void exit() {
+    uint32_t took = millis() - rtcFlight.taskSince;
+    uint8_t task = rtcFlight.task;
+    rtcFlight.task = TASK_NONE;
+    if (took >= FLIGHT_SLOW_TASK_MS)
+      record(FLIGHT_TASK, task, took > 0xFFFF ? 0xFFFF : took);
+  }
+
+  void watermarks() {
+    uint16_t largest = kb(ESP.getMaxAllocHeap());
+    record(FLIGHT_HEAP, largest > 0xFF ? 0xFF : largest, kb(ESP.getFreeHeap()));
+    record(FLIGHT_STACK, rtcFlight.task, uxTaskGetStackHighWaterMark(nullptr));
+  }
+
+  // Retried on every report until the server has it
+  // Goes over the report uplink (client and port), so with UPLINK_TLS the
+  // dump is encrypted like the reports
+  void upload(uint32_t bootId, const char *host, WiFiClient &client) {
+    if (_uploaded || WiFi.status() != WL_CONNECTED)
+      return;
+    HTTPClient http;
+    http.setReuse(true); // Leave the kept-alive uplink connection open
+    String path = String("/api/flight/") + DEVICE_NAME +
+                  "?boot_id=" + String(bootId) +
+                  "&prev_boot_id=" + String(_prevBootId) +
+                  "&reset_reason=" + String(_resetReason) +
+                  "&task=" + String(_prevTask) +
+                  "&task_since=" + String(_prevTaskSince);
+    http.begin(client, host, UPLINK_PORT, path, UPLINK_TLS);
+    http.addHeader("Content-Type", "application/octet-stream");
+    int code = http.POST((uint8_t *)_prev, _prevCount * sizeof(FlightRecord));
+    http.end();
+    _uploaded = code >= 200 && code < 300;
+    if (_uploaded && _prevCount)
+      Serial.printf("Uploaded %d flight recorder events\n", _prevCount);
+  }
+};
+
+// MEMORY TELEMETRY
+// Sampled once per report into "status": free heap, minimum-ever free heap,
+// largest allocatable block and every FreeRTOS task's stack high-water mark
+// (bytes never used, from uxTaskGetSystemState). Crossing a threshold is
+// logged on the serial console the first time it happens.
+TaskStatus_t taskStatus[MAX_TRACKED_TASKS]; // Static: too big for loop()'s stack
+bool memoryWarned = false;
+
+void addMemoryStatus(JsonObject status) {
+  uint32_t heapMin = ESP.getMinFreeHeap();
+  status["heap_free"] = ESP.getFreeHeap();
+  status["heap_min"] = heapMin;
+  status["heap_largest"] = ESP.getMaxAllocHeap();
+
+  JsonObject stacks = status.createNestedObject("stacks");
+  uint32_t stackMin = UINT32_MAX;
+  const char *stackMinTask = "loopTask";
+#if configUSE_TRACE_FACILITY
+  // Returns 0 if there are more tasks than slots
+  UBaseType_t n = uxTaskGetSystemState(taskStatus, MAX_TRACKED_TASKS, nullptr);
+  for (UBaseType_t i = 0; i < n; i++) {
+    // Names point into the task control blocks; no copy needed
+    stacks[taskStatus[i].pcTaskName] = taskStatus[i].usStackHighWaterMark;
+    if (strncmp(taskStatus[i].pcTaskName, STACK_WARN_SKIP,
+                sizeof(STACK_WARN_SKIP) - 1) == 0)
+      continue;
+    if (taskStatus[i].usStackHighWaterMark < stackMin) {
+      stackMin = taskStatus[i].usStackHighWaterMark;
+      stackMinTask = taskStatus[i].pcTaskName;
+    }
+  }
+  if (n == 0)
+#endif
+  {
+    stackMin = uxTaskGetStackHighWaterMark(nullptr);
+    stacks["loopTask"] = stackMin;
+  }
+  status["stack_min"] = stackMin;
+
+  bool low = stackMin < STACK_WARN_BYTES || heapMin < HEAP_WARN_BYTES;
+  if (low && !memoryWarned)
+    Serial.printf("Memory warning: %s has %u B stack left, min free heap %u B\n",
+                  stackMinTask, (unsigned)stackMin, (unsigned)heapMin);
+  memoryWarned = low;
+}
+
+// CONTROL CHANNEL
+// One WebSocket to the Pi carries reports up and commands down. A report
+// is kept until the server acks its seq and is resent after a reconnect,
+// tagged with its age so the server stamps it with when it was taken; the
+// server's dedup drops copies that had already landed. Each command carries
+// an id that goes back in its result. While the link is down, reports go
+// over HTTP POST and queued commands ride in the replies.
+void handleReply(int code, JsonVariant reply);
+const char *runCommand(const char *command, JsonVariant args, JsonObject result);
+
+class ControlLink {
+private:
+  WebSocketsClient _ws;
+  String _reports[CONTROL_BUFFER]; // Unacked, oldest first
+  uint32_t _seqs[CONTROL_BUFFER];
+  unsigned long _takenAt[CONTROL_BUFFER];
+  uint32_t _sentUs[CONTROL_BUFFER];
+  uint8_t _count = 0;
+  uint32_t _bootId = 0;
+  int64_t _clockOffsetUs = 0; // Server clock minus esp_timer clock
+  uint32_t _clockRttUs = 0;   // Round trip of the probe that set it
+  bool _clockSynced = false;
+  int64_t _probeOffsetUs[CLOCK_WINDOW];
+  uint32_t _probeRttUs[CLOCK_WINDOW];
+  uint8_t _probeCount = 0;
+  uint8_t _probeNext = 0;
+  unsigned long _lastClockProbe = 0;
+
+  void drop(uint8_t index) {
+    for (uint8_t i = index; i + 1 < _count; i++) {
+      _reports[i] = _reports[i + 1];
+      _seqs[i] = _seqs[i + 1];
+      _takenAt[i] = _takenAt[i + 1];
+      _sentUs[i] = _sentUs[i + 1];
+    }
+    _count--;
+    _reports[_count] = String();
+  }
+
+  void transmit(uint8_t index) {
+    String frame = String("{\"type\":\"report\",\"age_ms\":") +
+                   String(millis() - _takenAt[index]) + ",\"data\":" +
+                   _reports[index] + "}";
+    _sentUs[index] = micros();
+    _ws.sendTXT(frame);
+  }
+
+  void acked(uint32_t seq) {
+    for (uint8_t i = 0; i < _count; i++) {
+      if (_seqs[i] == seq) {
+        lastAckUs = micros() - _sentUs[i];
+        drop(i);
+        return;
+      }
+    }
+  }
+
+  void probeClock() {
+    StaticJsonDocument<64> probe;
+    probe["type"] = "clock";
+    probe["t0"] = esp_timer_get_time();
+    String out;
+    serializeJson(probe, out);
+    _ws.sendTXT(out);
+    _lastClockProbe = millis();
+  }
+
+  // Server time is taken halfway through the round trip. Queueing only
+  // ever adds delay, so of the last CLOCK_WINDOW probes the one with the
+  // lowest round trip has the least asymmetry and sets the offset.
+  void clockAnswer(int64_t t0, int64_t serverUs) {
+    int64_t t3 = esp_timer_get_time();
+    if (t0 <= 0 || t3 - t0 > CLOCK_MAX_RTT_US)
+      return;
+    _probeRttUs[_probeNext] = t3 - t0;
+    _probeOffsetUs[_probeNext] = serverUs + (t3 - t0) / 2 - t3;
+    _probeNext = (_probeNext + 1) % CLOCK_WINDOW;
+    if (_probeCount < CLOCK_WINDOW)
+      _probeCount++;
+    uint8_t best = 0;
+    for (uint8_t i = 1; i < _probeCount; i++)
+      if (_probeRttUs[i] < _probeRttUs[best])
+        best = i;
+    _clockRttUs = _probeRttUs[best];
+    _clockOffsetUs = _probeOffsetUs[best];
+    _clockSynced = true;
+  }
+
+  void onEvent(WStype_t type, uint8_t *payload, size_t length) {
+    if (type == WStype_CONNECTED) {
+      StaticJsonDocument<128> hello;
+      hello["type"] = "hello";
+      hello["device_name"] = DEVICE_NAME;
+      hello["boot_id"] = _bootId;
+      String out;
+      serializeJson(hello, out);
+      _ws.sendTXT(out);
+      for (uint8_t i = 0; i < _count; i++)
+        transmit(i);
+      probeClock();
+      Serial.printf("Control link up (%d report(s) resent)\n", (int)_count);
+    } else if (type == WStype_TEXT) {
+      DynamicJsonDocument doc(CONTROL_DOC_SIZE);
+      if (deserializeJson(doc, (const char *)payload, length))
+        return;
+      const char *kind = doc["type"] | "";
+      if (strcmp(kind, "ack") == 0) {
+        acked(doc["seq"] | 0UL);
+        handleReply(doc["code"] | 0, doc["reply"]);
+      } else if (strcmp(kind, "command") == 0) {
+        execute(doc.as<JsonVariant>());
+      } else if (strcmp(kind, "clock") == 0) {
+        clockAnswer(doc["t0"] | (int64_t)0, doc["server_us"] | (int64_t)0);
+      }
+    }
+  }
+
+public:
+  uint32_t lastAckUs = 0; // Send-to-ack time of the last acked report
+
+  void begin(uint32_t bootId, const char *host) {
+    _bootId = bootId;
+    _ws.onEvent([this](WStype_t type, uint8_t *payload, size_t length) {
+      onEvent(type, payload, length);
+    });
+    _ws.setReconnectInterval(CONTROL_RECONNECT_MS);
+    _ws.enableHeartbeat(CONTROL_HEARTBEAT_MS, 3000, 3);
+    _ws.begin(host, CONTROL_WS_PORT, "/ws");
+  }
+
+  // Reconnects to another server; unacked reports are resent there
+  void retarget(const char *host) {
+    _ws.disconnect();
+    _ws.begin(host, CONTROL_WS_PORT, "/ws");
+  }
+
+  void loop() {
+    _ws.loop();
+    if (_ws.isConnected() && millis() - _lastClockProbe >= CLOCK_SYNC_MS)
+      probeClock();
+  }
+
+  bool clockSynced() { return _clockSynced; }
+  int64_t clockOffsetUs() { return _clockOffsetUs; }
+  uint32_t clockRttUs() { return _clockRttUs; }
+
+  // Sends one message without buffering; false if the link is down
+  bool send(JsonVariant message) {
+    if (!_ws.isConnected())
+      return false;
+    String out;
+    serializeJson(message, out);
+    return _ws.sendTXT(out);
+  }
+
+  // Sends a report and keeps it until acked; false if the link is down
+  bool sendReport(const String &report, uint32_t seq) {
+    if (!_ws.isConnected())
+      return false;
+    if (_count == CONTROL_BUFFER)
+      drop(0); // Give up on the oldest unacked report
+    _reports[_count] = report;
+    _seqs[_count] = seq;
+    _takenAt[_count] = millis();
+    _count++;
+    transmit(_count - 1);
+    return true;
+  }
+
+  // Runs one server command and answers it by id (when the link is up)
+  void execute(JsonVariant command) {
+    StaticJsonDocument<256> answer;
+    answer["type"] = "result";
+    answer["id"] = command["id"] | 0UL;
+    const char *error = runCommand(command["command"] | "", command["args"],
+                                   answer.createNestedObject("result"));
+    answer["ok"] = error == nullptr;
+    if (error)
+      answer["error"] = error;
+    if (_ws.isConnected()) {
+      String out;
+      serializeJson(answer, out);
+      _ws.sendTXT(out);
+    }
+  }
+};
+
+// SERVER FAILOVER
+// With a REPLICA_PI_IP set, FAILOVER_AFTER reports in a row that get no
+// HTTP status at all (connect failed or timed out) move every uplink to the
+// other Pi: reports, control link, flight uploads. While on the
+// replica, a TCP connect to the primary every FAILBACK_CHECK_MS (from the
+// report step) moves the node back as soon as the primary answers.
+class ServerFailover {
+private:
+  bool _onReplica = false;
+  uint8_t _failures = 0;
+  uint32_t _lastCheck = 0;
+
+  bool toggle() {
+    _onReplica = !_onReplica;
+    _failures = 0;
+    _lastCheck = millis();
+    switches++;
+    Serial.printf("Switched to the %s (%s)\n", _onReplica ? "replica" : "primary",
+                  host());
+    return true;
+  }
+
+public:
+  uint16_t switches = 0; // Since boot, reported in status
+
+  const char *host() { return _onReplica ? REPLICA_PI_IP : RASPBERRY_PI_IP; }
+  bool onReplica() { return _onReplica; }
+
+  // Feed each HTTP report's outcome; true when the node switched Pi
+  bool reported(bool reached) {
+    if (reached || REPLICA_PI_IP[0] == '\0') {
+      _failures = 0;
+      return false;
+    }
+    return ++_failures >= FAILOVER_AFTER && toggle();
+  }
+
+  // True when the primary answered again and the node moved back to it
+  bool checkPrimary() {
+    if (!_onReplica || millis() - _lastCheck < FAILBACK_CHECK_MS)
+      return false;
+    _lastCheck = millis();
+    WiFiClient probe;
+    bool up = probe.connect(RASPBERRY_PI_IP, UPLINK_PORT, FAILBACK_CONNECT_MS);
+    probe.stop();
+    return up && toggle();
+  }
+};
+
 // GLOBAL OBJECTS
-LightSensor lightSensor;
+BootProfiler bootProfiler;
+FlightRecorder flightRecorder;
+ControlLink controlLink;
+ServerFailover failover;
+#if UPLINK_TLS
+WiFiClientSecure uplinkClient;
+#else
+WiFiClient uplinkClient;
+#endif
+uint32_t uplinkUs = 0;       // Last report's POST time, handshake included
+uint32_t uplinkBytes = 0;    // Last report's JSON size
+uint32_t uplinkConnects = 0; // New uplink connections (TLS handshakes) since boot
+FlashHistory flashHistory;
+WebServer historyServer(HISTORY_HTTP_PORT);
 unsigned long lastSend = 0;
+uint32_t bootId = 0;    // Random per boot, lets the server reset its dedup window
+uint32_t reportSeq = 0; // Idempotency key for retransmits
+unsigned long reportInterval = SENSOR_READ_INTERVAL; // Changed by the set_interval command
+unsigned long sendInterval = SENSOR_READ_INTERVAL; // Stretched while the server asks us to slow down
+unsigned long restartAt = 0; // millis() of a commanded restart; 0 = none
+bool inventorySent = false; // I2C inventory rides along until one report lands
+
+void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+  if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED) {
+    bootProfiler.mark(BOOT_WIFI_ASSOC);
+    flightRecorder.record(FLIGHT_WIFI, WIFI_CONNECTED, 0);
+  } else if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    bootProfiler.mark(BOOT_DHCP);
+    flightRecorder.record(FLIGHT_WIFI, WIFI_GOT_IP, 0);
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+    flightRecorder.record(FLIGHT_WIFI, WIFI_DISCONNECTED,
+                          info.wifi_sta_disconnected.reason);
+  }
+}
 
 void connectWiFi() {
   Serial.print("Connecting to WiFi");
@@ -116,33 +895,152 @@ void connectWiFi() {
   Serial.println("\nWiFi Connected!");
 }
 
-void sendData(float lux) {
+// Applies the server's reply to a report, whichever way it travelled
+void handleReply(int code, JsonVariant reply) {
+  if (code == 429) {
+    // Server is over its ingest budget: wait as long as it asks
+    unsigned long retryAfterMs = reply["retry_after_ms"] | reportInterval;
+    sendInterval = max(retryAfterMs, reportInterval);
+    Serial.printf("Server busy, next send in %lu ms\n", sendInterval);
+  } else if (code > 0) {
+    sendInterval = reportInterval;
+  }
+  if (code < 200 || code >= 300)
+    return;
+
+  inventorySent = true;
+  bootProfiler.landed();
+
+  // No NTP on this network: take the Pi's clock for rollup timestamps
+  uint32_t serverTime = reply["time"] | 0UL;
+  if (time(nullptr) < CLOCK_VALID_AFTER && serverTime > CLOCK_VALID_AFTER) {
+    struct timeval tv = {(time_t)serverTime, 0};
+    settimeofday(&tv, nullptr);
+  }
+
+  // Commands queued while the control link was down
+  for (JsonVariant command : reply["commands"].as<JsonArray>())
+    controlLink.execute(command);
+}
+
+// Server commands; returns nullptr on success or a short error
+const char *runCommand(const char *command, JsonVariant args, JsonObject result) {
+  if (strcmp(command, "set_interval") == 0) {
+    unsigned long ms = args["ms"] | 0UL;
+    if (ms < MIN_REPORT_INTERVAL)
+      return "interval too short";
+    reportInterval = ms;
+    sendInterval = ms;
+    result["interval_ms"] = ms;
+  } else if (strcmp(command, "report_now") == 0) {
+    lastSend = millis() - sendInterval;
+  } else if (strcmp(command, "restart") == 0) {
+    restartAt = (millis() + 500) | 1; // Let the result go out first
+  } else {
+    return "unknown command";
+  }
+  result["uptime_ms"] = millis();
+  return nullptr;
+}
+
+// Drops connections to the old Pi; the next report and the control link's
+// reconnect go to failover.host()
+void serverChanged() {
+  uplinkClient.stop();
+  if (CONTROL_CHANNEL)
+    controlLink.retarget(failover.host());
+}
+
+void sendData(const LightReading *readings) {
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi Disconnected. Reconnecting...");
     connectWiFi();
   }
-
-  HTTPClient http;
-  // URL for the Python Flask Server
-  String url = "http://" + String(RASPBERRY_PI_IP) + ":5000/sensor-data";
-
-  http.begin(url);
-  http.addHeader("Content-Type", "application/json");
+  if (failover.checkPrimary())
+    serverChanged();
 
   // Create JSON payload
-  StaticJsonDocument<256> doc;
+  StaticJsonDocument<1536> doc;
   doc["device_name"] = DEVICE_NAME;
+  doc["boot_id"] = bootId;
+  uint32_t seq = reportSeq++;
+  doc["seq"] = seq;
 
   JsonObject s = doc.createNestedObject("sensors");
-  s["light"] = lux;
+  for (size_t i = 0; i < lightCount; i++) {
+    if (readings[i].isValid)
+      s[lightChannels[i]] = readings[i].lux;
+  }
+
+  if (!inventorySent) {
+    JsonArray inv = doc.createNestedArray("inventory");
+    for (size_t i = 0; i < i2cDeviceCount; i++) {
+      JsonObject d = inv.createNestedObject();
+      char addr[5];
+      snprintf(addr, sizeof(addr), "0x%02X", i2cDevices[i].address);
+      d["address"] = addr; // Copied: addr is a stack buffer
+      d["device"] = i2cDevices[i].name;
+      if (i2cDevices[i].channel)
+        d["channel"] = i2cDevices[i].channel;
+    }
+  }
+
+  JsonObject status = doc.createNestedObject("status");
+  status["wifi_rssi"] = WiFi.RSSI();
+  status["uptime_ms"] = millis();
+  status["uplink_tls"] = UPLINK_TLS;
+  status["uplink_us"] = uplinkUs;
+  status["uplink_bytes"] = uplinkBytes;
+  status["uplink_connects"] = uplinkConnects;
+  status["on_replica"] = failover.onReplica();
+  status["failovers"] = failover.switches;
+  addMemoryStatus(status);
+
+  if (bootProfiler.pending())
+    bootProfiler.addTo(doc.createNestedObject("boot"));
 
   // Add placeholder values for other fields if needed, or leave them out
   // (Server code uses .get() so it handles missing keys gracefully)
 
   String jsonString;
   serializeJson(doc, jsonString);
+  uplinkBytes = jsonString.length();
+
+  // Link up: the ack and its reply come back through controlLink.loop()
+  if (CONTROL_CHANNEL && controlLink.sendReport(jsonString, seq)) {
+    uplinkUs = controlLink.lastAckUs;
+    return;
+  }
+
+  // Static so the connection outlives the call; end() keeps it open
+  static HTTPClient http;
+  http.setReuse(true);
+  http.begin(uplinkClient, failover.host(), UPLINK_PORT, "/sensor-data",
+             UPLINK_TLS);
+  http.addHeader("Content-Type", "application/json");
+
+  // Retry with the same seq; the server acks duplicates without storing them
+  int responseCode = -1;
+  int attempts = 0;
+  if (!uplinkClient.connected())
+    uplinkConnects++;
+  uint32_t started = micros();
+  for (int attempt = 0; attempt < SEND_MAX_ATTEMPTS; attempt++) {
+    if (attempt > 0)
+      delay(SEND_RETRY_BACKOFF_MS << (attempt - 1));
+    responseCode = http.POST(jsonString);
+    attempts++;
+    if ((responseCode >= 200 && responseCode < 300) || responseCode == 429)
+      break;
+  }
+  uplinkUs = micros() - started;
+  flightRecorder.record(FLIGHT_POST, attempts, (uint16_t)(int16_t)responseCode);
+
+  DynamicJsonDocument reply(CONTROL_DOC_SIZE);
+  if (responseCode > 0)
+    deserializeJson(reply, http.getString());
+  handleReply(responseCode, reply.as<JsonVariant>());
 
-  int responseCode = http.POST(jsonString);
   if (responseCode > 0)
     Serial.printf("Sent Data (Code %d)\n", responseCode);
   else
@@ -150,37 +1048,86 @@ void sendData(float lux) {
                   http.errorToString(responseCode).c_str());
 
   http.end();
+  if (failover.reported(responseCode > 0))
+    serverChanged();
 }
 
 void setup() {
+  bootProfiler.mark(BOOT_APP_START);
   Serial.begin(115200);
   delay(1000);
+  bootProfiler.mark(BOOT_SERIAL);
+  bootId = esp_random();
+  flightRecorder.begin(bootId);
+#if UPLINK_TLS
+  uplinkClient.setPreSharedKey(DEVICE_NAME, UPLINK_PSK);
+#endif
+  WiFi.onEvent(onWiFiEvent);
 
-  // Initialize I2C for Light Sensor
-  Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
+  // Scan I2C and bind a driver to every light sensor found
+  scanI2C();
+  bootProfiler.mark(BOOT_I2C);
 
-  if (lightSensor.begin())
-    Serial.println("HomePOD Light Node Initialized [OK]");
+  if (lightCount > 0)
+    Serial.printf("HomePOD Light Node Initialized [OK] (%d light sensor(s))\n",
+                  (int)lightCount);
   else
     Serial.println("Light sensor initialization [FAIL]");
 
+  if (!flashHistory.begin())
+    Serial.println("No SPIFFS partition: flash history disabled");
+  bootProfiler.mark(BOOT_FLASH);
+
   // Initialize WiFi
   connectWiFi();
+  configTime(0, 0, "pool.ntp.org");
+  historyServer.on("/history", []() { flashHistory.handleQuery(historyServer); });
+  historyServer.begin();
+  if (CONTROL_CHANNEL)
+    controlLink.begin(bootId, failover.host());
+  bootProfiler.mark(BOOT_SETUP_DONE);
 }
 
 void loop() {
   unsigned long currentMillis = millis();
+  flightRecorder.enter(TASK_HISTORY);
+  historyServer.handleClient();
+  flightRecorder.exit();
+  if (CONTROL_CHANNEL) {
+    flightRecorder.enter(TASK_CONTROL);
+    controlLink.loop();
+    flightRecorder.exit();
+  }
+  if (restartAt && (long)(currentMillis - restartAt) >= 0)
+    ESP.restart();
 
-  if (currentMillis - lastSend >= SENSOR_READ_INTERVAL) {
+  if (currentMillis - lastSend >= sendInterval) {
     lastSend = currentMillis;
+    flightRecorder.enter(TASK_REPORT);
+    flightRecorder.watermarks();
+    flightRecorder.upload(bootId, failover.host(), uplinkClient);
 
-    LightReading light = lightSensor.read();
+    // All sensors back-to-back in one bus pass; continuous mode means
+    // each conversion is already done
+    LightReading readings[MAX_LIGHT_SENSORS];
+    bool anyValid = false;
+    for (size_t i = 0; i < lightCount; i++) {
+      readings[i] = lightSensors[i]->read();
+      if (readings[i].isValid) {
+        Serial.printf("Light Level (%s): %.1f lux\n", lightChannels[i],
+                      readings[i].lux);
+        anyValid = true;
+      }
+    }
 
-    if (light.isValid) {
-      Serial.printf("Light Level: %.1f lux\n", light.lux);
-      sendData(light.lux);
+    if (anyValid) {
+      if (readings[0].isValid)
+        flashHistory.add(&readings[0].lux, 1);
+      sendData(readings);
     } else {
       Serial.println("Failed to read Light sensor!");
+      flightRecorder.record(FLIGHT_SENSOR_ERROR, FLIGHT_SENSOR_LIGHT, 0);
     }
+    flightRecorder.exit();
   }
 }
\ No newline at end of file
@@ -5,10 +5,22 @@
  * ============================================
  */
 #include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <driver/adc.h>
+#include <driver/i2s.h>
+#include <rom/crc.h>
+#include <sys/time.h>
 #include <ArduinoJson.h>
 #include <DHT.h>
 #include <HTTPClient.h>
+#include <WebServer.h>
+#include <WebSocketsClient.h>
 #include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <WiFiUdp.h>
+#include "sound_model.h"
 
 // ============================================
 // CONFIGURATION - UPDATE THIS!
@@ -16,23 +28,92 @@
 #define WIFI_SSID "Netgear 2006"    // Change to your WiFi name
 #define WIFI_PASSWORD "woaiPDMS59"  // Change to your WiFi password
 #define RASPBERRY_PI_IP "10.0.0.47" // Change to your Raspberry Pi IP address
+#define REPLICA_PI_IP ""            // Standby Pi running "homepod_server_v3.py replica"; "" = none
 #define RASPBERRY_PI_PORT 5000
+// Encrypted uplink: 1 = TLS 1.2 with a pre-shared key over one kept-alive
+// connection (handshake once per connection, not per report), 0 = plain HTTP
+#define UPLINK_TLS 0
+#define UPLINK_TLS_PORT 5443
+#define UPLINK_PSK "" // Hex of this node's secret in uplink_psk.txt on the Pi
+#define UPLINK_PORT (UPLINK_TLS ? UPLINK_TLS_PORT : RASPBERRY_PI_PORT)
+#define FAILOVER_AFTER 3          // Unreachable reports in a row before switching Pi
+#define FAILBACK_CHECK_MS 60000   // While on the replica, how often to try the primary
+#define FAILBACK_CONNECT_MS 500   // TCP connect timeout for that check
+#define FIRMWARE_BUILD __DATE__ " " __TIME__ // Groups boot profiles per build
 #define DEVICE_NAME "HomePOD_Env_Node_2" // Living Room node
 
 // PINS & SETTINGS
 #define MIC_PIN 35
+#define MIC_ADC_CHANNEL ADC1_CHANNEL_7 // MIC_PIN's ADC1 channel, sampled by I2S0
 #define DHT_PIN 4
 #define DHT_TYPE DHT22
 
-#define AUDIO_SAMPLES 64
+#define AUDIO_SAMPLES 64 // Newest samples in each audio peak window
 #define AUDIO_NOISE_FLOOR 10
 #define WIFI_SEND_INTERVAL 10000 // Send data every 10 seconds
+#define SEND_MAX_ATTEMPTS 3       // POST attempts per report (same seq)
+#define SEND_RETRY_BACKOFF_MS 250 // Doubles after each failed attempt
+
+// Flash history (1-minute rollups, ~72 h)
+#define HISTORY_CHANNEL_NAMES "temperature,humidity,audio_peak"
+#define HISTORY_CHANNELS 4
+#define HISTORY_RECORD_SIZE 64
+#define HISTORY_SECTOR_SIZE 4096
+#define HISTORY_SECTORS 68 // 68 * 64 records = 72.5 h
+#define HISTORY_RECORDS_PER_SECTOR (HISTORY_SECTOR_SIZE / HISTORY_RECORD_SIZE)
+#define HISTORY_SLOTS (HISTORY_SECTORS * HISTORY_RECORDS_PER_SECTOR)
+#define HISTORY_HTTP_PORT 80
+#define CLOCK_VALID_AFTER 1600000000 // Unix time; earlier means NTP not synced
+
+// Live sound waterfall (streamed only while the server grants a lease)
+#define WATERFALL_UDP_PORT 5001
+#define WATERFALL_BANDS 16
+#define WATERFALL_BLOCK 128        // Samples per frame
+#define MIC_DMA_SAMPLES 64         // Samples per I2S DMA buffer (8 ms)
+#define WATERFALL_SAMPLE_RATE 8000 // Hz
+#define WATERFALL_FRAME_MS 100     // 10 frames per second
+#define WATERFALL_DB_FLOOR 20.0f   // Band level mapped to 0
+#define WATERFALL_DB_RANGE 80.0f   // dB span mapped to 0..255
+#define SOUND_FRAMES 10            // Band frames per scene classification (1 s)
+
+// Noise onsets for cross-room localization (sent over the control channel)
+#define ENVELOPE_SAMPLE_RATE 1000 // Hz, decimated from the mic capture
+#define ENVELOPE_BIN_MS 10        // Samples (ms) per envelope bin
+#define ONSET_BINS 32             // Envelope sent per onset (320 ms)
+#define ONSET_RATIO 4             // Jump over background (~12 dB)
+#define ONSET_MIN_LEVEL 60        // ADC counts from DC
+#define ONSET_HOLDOFF_MS 1000     // At most one onset per second
+
+// Flight recorder (RTC memory, survives soft resets and panics)
+#define FLIGHT_RECORDS 128       // 8 bytes each
+#define FLIGHT_SLOW_TASK_MS 50   // loop() steps at least this long are logged
+#define FLIGHT_MAGIC 0x31465048  // "HPF1"
+
+// Memory telemetry (sent in "status" with every report)
+#define MAX_TRACKED_TASKS 24
+#define STACK_WARN_BYTES 512     // Any task with less stack headroom than this
+#define STACK_WARN_SKIP "IDLE"   // Except these (name prefix): tiny by design
+#define HEAP_WARN_BYTES 16384    // Minimum-ever free heap below this
+
+// Control channel (WebSocket to the Pi: commands down, reports up). It is
+// plaintext, so it stays off while the encrypted uplink is on.
+#define CONTROL_CHANNEL (!UPLINK_TLS)
+#define CONTROL_WS_PORT 5002
+#define CONTROL_RECONNECT_MS 2000
+#define CONTROL_HEARTBEAT_MS 15000 // Ping interval; 3 missed pongs drop the link
+#define CONTROL_BUFFER 8           // Unacked reports kept for resend
+#define CONTROL_DOC_SIZE 1024
+#define CLOCK_SYNC_MS 10000       // Clock offset probe interval
+#define CLOCK_MAX_RTT_US 20000     // Slower probes are discarded
+#define CLOCK_WINDOW 6             // Probes kept; the fastest sets the offset
+#define MIN_REPORT_INTERVAL 1000   // Floor for the set_interval command
 
 // ============================================
 // SENSOR CLASSES
 // ============================================
 class DHTSensor {
 private:
+  uint8_t _pin;
   DHT *_dht;
   float _lastTemp;
   float _lastHumidity;
@@ -49,12 +130,12 @@ private:
   }
 
 public:
-  DHTSensor()
-      : _dht(nullptr), _lastTemp(0.0f), _lastHumidity(0.0f),
+  explicit DHTSensor(uint8_t pin = DHT_PIN)
+      : _pin(pin), _dht(nullptr), _lastTemp(0.0f), _lastHumidity(0.0f),
         _initialized(false) {}
 
   void begin() {
-    _dht = new DHT(DHT_PIN, DHT_TYPE);
+    _dht = new DHT(_pin, DHT_TYPE);
     _dht->begin();
     delay(2000); // Warmup
     _initialized = true;
@@ -82,17 +163,13 @@ private:
 public:
   MicrophoneSensor() : _peakLevel(0) {}
 
-  void begin() {
-    analogReadResolution(12);
-    analogSetAttenuation(ADC_11db);
-  }
-
-  void sample() {
+  // Peak-to-peak over the newest AUDIO_SAMPLES captured samples
+  void sample(const int16_t *samples) {
     int minVal = 4095;
     int maxVal = 0;
 
     for (int i = 0; i < AUDIO_SAMPLES; i++) {
-      int val = analogRead(MIC_PIN);
+      int val = samples[i];
       if (val < minVal)
         minVal = val;
       if (val > maxVal)
@@ -117,13 +194,999 @@ public:
   }
 };
 
+// Goertzel filters at log-spaced centre frequencies, one byte per band
+class BandAnalyzer {
+private:
+  float _coeff[WATERFALL_BANDS];
+  uint32_t _lastUs = 0;
+
+public:
+  void begin() {
+    const float lo = 100.0f;
+    const float hi = WATERFALL_SAMPLE_RATE * 0.45f;
+    for (int b = 0; b < WATERFALL_BANDS; b++) {
+      float f = lo * powf(hi / lo, (float)b / (WATERFALL_BANDS - 1));
+      _coeff[b] = 2.0f * cosf(2.0f * PI * f / WATERFALL_SAMPLE_RATE);
+    }
+  }
+
+  // block holds the newest WATERFALL_BLOCK captured samples
+  void analyze(const int16_t *block, uint8_t *bands) {
+    uint32_t started = micros();
+    int32_t sum = 0;
+    for (int i = 0; i < WATERFALL_BLOCK; i++)
+      sum += block[i];
+    int16_t mean = sum / WATERFALL_BLOCK;
+
+    for (int b = 0; b < WATERFALL_BANDS; b++) {
+      float s1 = 0.0f, s2 = 0.0f;
+      for (int i = 0; i < WATERFALL_BLOCK; i++) {
+        float s0 = (block[i] - mean) + _coeff[b] * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+      }
+      float power = s1 * s1 + s2 * s2 - _coeff[b] * s1 * s2;
+      float q = (10.0f * log10f(power + 1.0f) - WATERFALL_DB_FLOOR) * 255.0f /
+                WATERFALL_DB_RANGE;
+      bands[b] = q <= 0.0f ? 0 : (q >= 255.0f ? 255 : (uint8_t)q);
+    }
+    _lastUs = micros() - started;
+  }
+
+  uint32_t lastUs() { return _lastUs; }
+};
+
+// ============================================
+// SOUND CLASSIFIER
+// ============================================
+// Once per second (SOUND_FRAMES band frames) the frames are summarised into
+// per-band means and mean frame-to-frame change, and the int8 network in
+// sound_model.h names the scene. Integer only: int8 weights and
+// activations, int32 accumulators, fixed-point requantisation between
+// layers; weights stay in flash and the working set is under 1 KB. Reports
+// carry each class's share of the seconds since the last report as
+// sound_<class>. Retrain with `python3 homepod_server_v3.py train-sound`.
+class SoundClassifier {
+private:
+  uint8_t _frames[SOUND_FRAMES][WATERFALL_BANDS];
+  uint8_t _frameCount = 0;
+  uint16_t _counts[SOUND_CLASSES] = {0};
+  uint16_t _seconds = 0;
+  uint32_t _lastUs = 0;
+
+  // Two accumulators, 4 MACs per iteration; n is a multiple of 4
+  static int32_t dot(const int8_t *w, const int8_t *x, int n) {
+    int32_t acc0 = 0, acc1 = 0;
+    for (int i = 0; i < n; i += 4) {
+      acc0 += w[i] * x[i] + w[i + 2] * x[i + 2];
+      acc1 += w[i + 1] * x[i + 1] + w[i + 3] * x[i + 3];
+    }
+    return acc0 + acc1;
+  }
+
+  // Fully connected + ReLU, requantised to int8 [0, 127] by mult / 2^shift
+  static void dense(const int8_t *x, int inputs, const int8_t *w,
+                    const int32_t *bias, int outputs, int32_t mult, int shift,
+                    int8_t *out) {
+    for (int o = 0; o < outputs; o++, w += inputs) {
+      int32_t acc = bias[o] + dot(w, x, inputs);
+      int32_t q = (int32_t)(((int64_t)acc * mult + (1LL << (shift - 1))) >> shift);
+      out[o] = q < 0 ? 0 : (q > 127 ? 127 : q);
+    }
+  }
+
+  // Per-band mean, then 2x mean absolute change; uint8 shifted to int8
+  void features(int8_t *x) {
+    for (int b = 0; b < WATERFALL_BANDS; b++) {
+      int sum = _frames[0][b];
+      int change = 0;
+      for (int f = 1; f < SOUND_FRAMES; f++) {
+        sum += _frames[f][b];
+        change += abs(_frames[f][b] - _frames[f - 1][b]);
+      }
+      change = change * 2 / (SOUND_FRAMES - 1);
+      x[b] = sum / SOUND_FRAMES - 128;
+      x[WATERFALL_BANDS + b] = (change > 255 ? 255 : change) - 128;
+    }
+  }
+
+public:
+  // Buffers one frame; true once a full second is ready for classify()
+  bool addFrame(const uint8_t *bands) {
+    memcpy(_frames[_frameCount], bands, WATERFALL_BANDS);
+    return ++_frameCount == SOUND_FRAMES;
+  }
+
+  void classify() {
+    static_assert(SOUND_FEATURES == 2 * WATERFALL_BANDS, "model/band mismatch");
+    static_assert(SOUND_FEATURES % 4 == 0 && SOUND_HIDDEN1 % 4 == 0 &&
+                      SOUND_HIDDEN2 % 4 == 0, "layer widths must be multiples of 4");
+    uint32_t started = micros();
+    int8_t x[SOUND_FEATURES];
+    int8_t h1[SOUND_HIDDEN1];
+    int8_t h2[SOUND_HIDDEN2];
+    features(x);
+    _frameCount = 0;
+    dense(x, SOUND_FEATURES, SOUND_W1, SOUND_B1, SOUND_HIDDEN1, SOUND_M1,
+          SOUND_S1, h1);
+    dense(h1, SOUND_HIDDEN1, SOUND_W2, SOUND_B2, SOUND_HIDDEN2, SOUND_M2,
+          SOUND_S2, h2);
+
+    int best = 0;
+    int32_t bestLogit = INT32_MIN;
+    const int8_t *w = SOUND_W3;
+    for (int c = 0; c < SOUND_CLASSES; c++, w += SOUND_HIDDEN2) {
+      int32_t logit = SOUND_B3[c] + dot(w, h2, SOUND_HIDDEN2);
+      if (logit > bestLogit) {
+        bestLogit = logit;
+        best = c;
+      }
+    }
+    _counts[best]++;
+    _seconds++;
+    _lastUs = micros() - started;
+  }
+
+  uint32_t lastUs() { return _lastUs; }
+
+  // Adds sound_<class> shares for the seconds since the last call
+  void addTo(JsonObject sensors) {
+    if (_seconds == 0)
+      return;
+    for (int c = 0; c < SOUND_CLASSES; c++) {
+      char key[24];
+      snprintf(key, sizeof(key), "sound_%s", SOUND_CLASS_NAMES[c]);
+      sensors[key] = (float)_counts[c] / _seconds; // key is copied
+      _counts[c] = 0;
+    }
+    _seconds = 0;
+  }
+};
+
+// ============================================
+// NOISE ONSETS
+// ============================================
+// The capture task hands over every DMA buffer; each 1 ms of it becomes one
+// envelope sample (the largest swing from DC), giving a 10 ms peak envelope
+// and a slow background level of quiet bins. A sample ONSET_RATIO times over
+// the background latches the onset time (1 ms resolution) and starts
+// collecting ONSET_BINS envelope bins; loop() then sends them over the
+// control link, timed on the server's clock, for cross-room localization.
+class OnsetDetector {
+private:
+  int32_t _dc = 2048 << 6;     // DC estimate (Q6)
+  int32_t _background = 0;     // Quiet-bin peak level (Q4)
+  uint16_t _binPeak = 0;
+  uint8_t _binSamples = 0;
+  uint16_t _envelope[ONSET_BINS];
+  uint8_t _bins = 0;
+  bool _capturing = false;
+  volatile bool _ready = false;
+  int64_t _onsetUs = 0;
+  int64_t _lastOnsetUs = 0;
+  uint16_t _onsetBackground = 0;
+
+  void sample(uint16_t level, int64_t atUs) {
+    if (level > _binPeak)
+      _binPeak = level;
+
+    int32_t background = _background >> 4;
+    if (!_capturing && !_ready && level > ONSET_MIN_LEVEL &&
+        level > background * ONSET_RATIO &&
+        atUs - _lastOnsetUs >= ONSET_HOLDOFF_MS * 1000LL) {
+      _capturing = true;
+      _onsetUs = atUs;
+      _onsetBackground = background;
+      _bins = 0;
+      _binSamples = 0;
+      _binPeak = level;
+    }
+
+    if (++_binSamples < ENVELOPE_BIN_MS)
+      return;
+    _binSamples = 0;
+    if (_capturing) {
+      _envelope[_bins++] = _binPeak;
+      if (_bins == ONSET_BINS) {
+        _capturing = false;
+        _lastOnsetUs = _onsetUs;
+        _ready = true; // loop() owns the envelope until take()
+      }
+    } else {
+      _background += (((int32_t)_binPeak << 4) - _background) >> 6;
+    }
+    _binPeak = 0;
+  }
+
+public:
+  // Capture task only. firstUs is the esp_timer time of samples[0].
+  void add(const int16_t *samples, int n, int64_t firstUs) {
+    const int group = WATERFALL_SAMPLE_RATE / ENVELOPE_SAMPLE_RATE;
+    for (int i = 0; i + group <= n; i += group) {
+      int32_t sum = 0;
+      uint16_t level = 0;
+      for (int k = 0; k < group; k++) {
+        int32_t x = samples[i + k] << 6;
+        sum += x;
+        uint16_t swing = abs(x - _dc) >> 6;
+        if (swing > level)
+          level = swing;
+      }
+      _dc += (sum / group - _dc) >> 8;
+      sample(level, firstUs + i * 1000000LL / WATERFALL_SAMPLE_RATE);
+    }
+  }
+
+  bool ready() { return _ready; }
+
+  // Fills the onset message and frees the detector for the next event
+  void take(JsonObject msg, int64_t clockOffsetUs) {
+    uint16_t peak = 0;
+    JsonArray envelope = msg.createNestedArray("envelope");
+    for (int i = 0; i < ONSET_BINS; i++) {
+      envelope.add(_envelope[i]);
+      if (_envelope[i] > peak)
+        peak = _envelope[i];
+    }
+    msg["onset_us"] = _onsetUs + clockOffsetUs;
+    msg["level"] = peak;
+    msg["background"] = _onsetBackground;
+    _ready = false;
+  }
+};
+
+// ============================================
+// MIC CAPTURE
+// ============================================
+// I2S0 clocks ADC1 on MIC_PIN at WATERFALL_SAMPLE_RATE into DMA buffers and
+// the "mic" task is the only reader of the ADC: it feeds each buffer to the
+// onset detector and keeps the newest WATERFALL_BLOCK samples for loop()
+// (band energies and the audio peak). No analogRead() on MIC_PIN anywhere,
+// so the 1 kHz envelope and the band blocks come from one sample stream and
+// loop() never busy-waits for audio.
+class MicCapture {
+private:
+  TaskHandle_t _task = nullptr;
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+  int16_t _ring[WATERFALL_BLOCK];
+  uint16_t _head = 0; // Next slot to write; oldest sample
+  OnsetDetector *_onsets = nullptr;
+
+  static void run(void *arg) { static_cast<MicCapture *>(arg)->capture(); }
+
+  void capture() {
+    uint16_t dma[MIC_DMA_SAMPLES];
+    int16_t samples[MIC_DMA_SAMPLES];
+    for (;;) {
+      size_t got = 0;
+      i2s_read(I2S_NUM_0, dma, sizeof(dma), &got, portMAX_DELAY);
+      int64_t endUs = esp_timer_get_time();
+      int n = (got / sizeof(uint16_t)) & ~1;
+      // 16-bit mono ADC samples land in swapped pairs; the top 4 bits
+      // carry the channel number
+      for (int i = 0; i < n; i++)
+        samples[i] = dma[i ^ 1] & 0x0FFF;
+      _onsets->add(samples, n, endUs - n * 1000000LL / WATERFALL_SAMPLE_RATE);
+
+      portENTER_CRITICAL(&_mux);
+      for (int i = 0; i < n; i++) {
+        _ring[_head] = samples[i];
+        _head = (_head + 1) % WATERFALL_BLOCK;
+      }
+      portEXIT_CRITICAL(&_mux);
+    }
+  }
+
+public:
+  void begin(OnsetDetector &onsets) {
+    _onsets = &onsets;
+    for (int i = 0; i < WATERFALL_BLOCK; i++)
+      _ring[i] = 2048;
+    i2s_config_t config = {};
+    config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
+    config.sample_rate = WATERFALL_SAMPLE_RATE;
+    config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+    config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+    config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+    config.dma_buf_count = 4;
+    config.dma_buf_len = MIC_DMA_SAMPLES;
+    i2s_driver_install(I2S_NUM_0, &config, 0, nullptr);
+    i2s_set_adc_mode(ADC_UNIT_1, MIC_ADC_CHANNEL);
+    adc1_config_channel_atten(MIC_ADC_CHANNEL, ADC_ATTEN_DB_11);
+    i2s_adc_enable(I2S_NUM_0);
+    xTaskCreatePinnedToCore(&MicCapture::run, "mic", 3072, this, 5, &_task, 0);
+  }
+
+  // Copies the newest n (<= WATERFALL_BLOCK) samples, oldest first
+  void latest(int16_t *out, int n) {
+    portENTER_CRITICAL(&_mux);
+    uint16_t from = (_head + WATERFALL_BLOCK - n) % WATERFALL_BLOCK;
+    for (int i = 0; i < n; i++)
+      out[i] = _ring[(from + i) % WATERFALL_BLOCK];
+    portEXIT_CRITICAL(&_mux);
+  }
+};
+
+// ============================================
+// FLASH HISTORY
+// ============================================
+// 1-minute rollups (min/max/mean per channel) kept in a ring over the SPIFFS
+// data partition, so "what happened overnight" survives a Pi outage and
+// node reboots. Records are appended slot by slot and a sector is erased
+// only when the head enters it, so every sector wears evenly.
+// Served as raw records on GET /history?from=<unix>&to=<unix>.
+struct RollupRecord {
+  uint32_t minute; // Unix time of the minute start
+  uint16_t count;  // Samples rolled up
+  uint8_t channels;
+  uint8_t version;
+  float minV[HISTORY_CHANNELS];
+  float maxV[HISTORY_CHANNELS];
+  float meanV[HISTORY_CHANNELS];
+  uint32_t reserved;
+  uint32_t crc; // crc32_le of the bytes before it; erased flash never matches
+};
+static_assert(sizeof(RollupRecord) == HISTORY_RECORD_SIZE,
+              "RollupRecord must fill one slot");
+
+class FlashHistory {
+private:
+  const esp_partition_t *_part;
+  uint32_t _head; // Next slot to write
+  uint32_t _minute;
+  uint16_t _samples;
+  uint8_t _channels;
+  float _min[HISTORY_CHANNELS];
+  float _max[HISTORY_CHANNELS];
+  float _sum[HISTORY_CHANNELS];
+
+  bool readSlot(uint32_t slot, RollupRecord &r) {
+    if (esp_partition_read(_part, slot * HISTORY_RECORD_SIZE, &r, sizeof(r)) !=
+        ESP_OK)
+      return false;
+    return r.crc == crc32_le(0, (const uint8_t *)&r, offsetof(RollupRecord, crc));
+  }
+
+  void flush() {
+    RollupRecord r;
+    memset(&r, 0, sizeof(r));
+    r.minute = _minute;
+    r.count = _samples;
+    r.channels = _channels;
+    r.version = 1;
+    for (int c = 0; c < _channels; c++) {
+      r.minV[c] = _min[c];
+      r.maxV[c] = _max[c];
+      r.meanV[c] = _sum[c] / _samples;
+    }
+    r.crc = crc32_le(0, (const uint8_t *)&r, offsetof(RollupRecord, crc));
+
+    if (_head % HISTORY_RECORDS_PER_SECTOR == 0)
+      esp_partition_erase_range(_part, _head * HISTORY_RECORD_SIZE,
+                                HISTORY_SECTOR_SIZE);
+    esp_partition_write(_part, _head * HISTORY_RECORD_SIZE, &r, sizeof(r));
+    _head = (_head + 1) % HISTORY_SLOTS;
+    _samples = 0;
+  }
+
+public:
+  FlashHistory() : _part(nullptr), _head(0), _minute(0), _samples(0), _channels(0) {}
+
+  bool begin() {
+    _part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                     ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+    if (_part == nullptr ||
+        _part->size < HISTORY_SLOTS * HISTORY_RECORD_SIZE) {
+      _part = nullptr;
+      return false;
+    }
+    // Resume after the newest valid record
+    RollupRecord r;
+    uint32_t newest = 0;
+    for (uint32_t slot = 0; slot < HISTORY_SLOTS; slot++) {
+      if (readSlot(slot, r) && r.minute >= newest) {
+        newest = r.minute;
+        _head = (slot + 1) % HISTORY_SLOTS;
+      }
+    }
+    return true;
+  }
+
+  void add(const float *values, uint8_t channels) {
+    time_t now = time(nullptr);
+    if (_part == nullptr || now < CLOCK_VALID_AFTER)
+      return; // No partition, or no wall clock yet
+    uint32_t minute = now - now % 60;
+    if (_samples && minute != _minute)
+      flush();
+    if (_samples == 0) {
+      _minute = minute;
+      _channels = min(channels, (uint8_t)HISTORY_CHANNELS);
+      for (int c = 0; c < _channels; c++) {
+        _min[c] = _max[c] = values[c];
+        _sum[c] = 0.0f;
+      }
+    }
+    for (int c = 0; c < _channels; c++) {
+      _min[c] = min(_min[c], values[c]);
+      _max[c] = max(_max[c], values[c]);
+      _sum[c] += values[c];
+    }
+    _samples++;
+  }
+
+  void handleQuery(WebServer &server) {
+    if (_part == nullptr) {
+      server.send(503, "text/plain", "no history partition");
+      return;
+    }
+    uint32_t from = server.hasArg("from") ? server.arg("from").toInt() : 0;
+    uint32_t to = server.hasArg("to") ? server.arg("to").toInt() : UINT32_MAX;
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.sendHeader("X-Channels", HISTORY_CHANNEL_NAMES);
+    server.send(200, "application/octet-stream", "");
+
+    // Oldest first: walk the ring starting at the head
+    uint8_t buf[HISTORY_RECORD_SIZE * 16];
+    size_t used = 0;
+    RollupRecord r;
+    for (uint32_t i = 0; i < HISTORY_SLOTS; i++) {
+      uint32_t slot = (_head + i) % HISTORY_SLOTS;
+      if (!readSlot(slot, r) || r.minute < from || r.minute > to)
+        continue;
+      memcpy(buf + used, &r, sizeof(r));
+      used += sizeof(r);
+      if (used == sizeof(buf)) {
+        server.sendContent((const char *)buf, used);
+        used = 0;
+      }
+    }
+    if (used)
+      server.sendContent((const char *)buf, used);
+    server.sendContent("");
+  }
+};
+
+// ============================================
+// BOOT PROFILER
+// ============================================
+// One microsecond timestamp per boot stage, filled in once and shipped as
+// "boot" until a report carrying the first-report mark has landed.
+// esp_timer starts with the app, so "app_start" (setup() entered) is the
+// time from the ROM/bootloader hand-off through C++ static init.
+enum BootPhase {
+  BOOT_APP_START,
+  BOOT_SERIAL,
+  BOOT_DHT,
+  BOOT_MIC,
+  BOOT_BANDS,
+  BOOT_FLASH,
+  BOOT_WIFI_ASSOC,
+  BOOT_DHCP,
+  BOOT_SETUP_DONE,
+  BOOT_FIRST_REPORT,
+  BOOT_PHASES
+};
+
+const char *const BOOT_PHASE_NAMES[BOOT_PHASES] = {
+    "app_start", "serial",     "dht",  "mic",        "bands",
+    "flash",     "wifi_assoc", "dhcp", "setup_done", "first_report"};
+
+class BootProfiler {
+private:
+  uint32_t _us[BOOT_PHASES] = {}; // 0 = stage not reached yet
+  bool _shipped = false;
+
+public:
+  void mark(BootPhase phase) {
+    if (_us[phase] == 0)
+      _us[phase] = (uint32_t)esp_timer_get_time();
+  }
+
+  bool pending() const { return !_shipped; }
+
+  void addTo(JsonObject boot) {
+    boot["firmware"] = FIRMWARE_BUILD;
+    JsonObject us = boot.createNestedObject("us");
+    for (int i = 0; i < BOOT_PHASES; i++) {
+      if (_us[i])
+        us[BOOT_PHASE_NAMES[i]] = _us[i];
+    }
+  }
+
+  // A report landed: the first one sets the mark, the next one carries it
+  void landed() {
+    if (_us[BOOT_FIRST_REPORT])
+      _shipped = true;
+    else
+      mark(BOOT_FIRST_REPORT);
+  }
+};
+
+// ============================================
+// FLIGHT RECORDER
+// ============================================
+// The last FLIGHT_RECORDS events live in RTC slow memory, which keeps its
+// contents through panics, watchdog and software resets (not power loss).
+// An event is 8 bytes written under a spinlock. loop() only stores which
+// step it is in; steps slower than FLIGHT_SLOW_TASK_MS are logged on exit.
+// At boot the previous ring is copied to RAM and POSTed once, raw, to
+// /api/flight/<device> with the reset reason and the step loop() was in.
+enum FlightEvent : uint8_t {
+  FLIGHT_BOOT = 1,     // b = reset reason (esp_reset_reason_t)
+  FLIGHT_TASK,         // a = task, b = duration in ms
+  FLIGHT_WIFI,         // a = FlightWifi, b = disconnect reason
+  FLIGHT_SENSOR_ERROR, // a = FlightSensor
+  FLIGHT_HEAP,         // a = largest free block in KB, b = free heap in KB
+  FLIGHT_STACK,        // a = task, b = stack high-water mark in bytes
+  FLIGHT_POST          // a = attempts, b = HTTP status (int16, <0 = client)
+};
+
+enum FlightTask : uint8_t {
+  TASK_NONE,
+  TASK_SAMPLE,
+  TASK_WATERFALL,
+  TASK_REPORT,
+  TASK_HISTORY,
+  TASK_CONTROL,
+  TASK_SOUND
+};
+
+enum FlightWifi : uint8_t { WIFI_CONNECTED = 1, WIFI_GOT_IP, WIFI_DISCONNECTED };
+
+enum FlightSensor : uint8_t { FLIGHT_SENSOR_DHT = 1, FLIGHT_SENSOR_LIGHT };
+
+struct FlightRecord {
+  uint32_t ms; // millis() at the event
+  uint8_t type;
+  uint8_t a;
+  uint16_t b;
+};
+
+struct FlightLog {
+  uint32_t magic;
+  uint32_t bootId;
+  uint16_t head; // Next slot to write
+  uint16_t count;
+  uint8_t task; // Step loop() is in right now
+  uint32_t taskSince;
+  FlightRecord records[FLIGHT_RECORDS];
+};
+
+RTC_NOINIT_ATTR FlightLog rtcFlight;
+
+class FlightRecorder {
+private:
+  FlightRecord _prev[FLIGHT_RECORDS]; // Previous boot's events, oldest first
+  uint16_t _prevCount = 0;
+  uint32_t _prevBootId = 0;
+  uint8_t _prevTask = TASK_NONE;
+  uint32_t _prevTaskSince = 0;
+  uint8_t _resetReason = ESP_RST_UNKNOWN;
+  bool _uploaded = false;
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+  static uint16_t kb(uint32_t bytes) {
+    return bytes / 1024 > 0xFFFF ? 0xFFFF : bytes / 1024;
+  }
+
+public:
+  void begin(uint32_t bootId) {
+    _resetReason = esp_reset_reason();
+    FlightLog &log = rtcFlight;
+    // RTC memory is random after power-on; the magic and bounds catch that
+    if (_resetReason != ESP_RST_POWERON && log.magic == FLIGHT_MAGIC &&
+        log.count <= FLIGHT_RECORDS && log.head < FLIGHT_RECORDS) {
+      uint16_t first = (log.head + FLIGHT_RECORDS - log.count) % FLIGHT_RECORDS;
+      for (uint16_t i = 0; i < log.count; i++)
+        _prev[i] = log.records[(first + i) % FLIGHT_RECORDS];
+      _prevCount = log.count;
+      _prevBootId = log.bootId;
+      _prevTask = log.task;
+      _prevTaskSince = log.taskSince;
+    }
+    log.magic = FLIGHT_MAGIC;
+    log.bootId = bootId;
+    log.head = 0;
+    log.count = 0;
+    log.task = TASK_NONE;
+    log.taskSince = 0;
+    record(FLIGHT_BOOT, 0, _resetReason);
+  }
+
+  void record(uint8_t type, uint8_t a, uint16_t b) {
+    uint32_t now = millis();
+    portENTER_CRITICAL(&_mux);
+    FlightRecord &r = rtcFlight.records[rtcFlight.head];
+    r.ms = now;
+    r.type = type;
+    r.a = a;
+    r.b = b;
+    rtcFlight.head = (rtcFlight.head + 1) % FLIGHT_RECORDS;
+    if (rtcFlight.count < FLIGHT_RECORDS)
+      rtcFlight.count++;
+    portEXIT_CRITICAL(&_mux);
+  }
+
+  void enter(FlightTask task) {
+    rtcFlight.taskSince = millis();
+    rtcFlight.task = task;
+  }
+
+  void exit() {
+    uint32_t took = millis() - rtcFlight.taskSince;
+    uint8_t task = rtcFlight.task;
+    rtcFlight.task = TASK_NONE;
+    if (took >= FLIGHT_SLOW_TASK_MS)
+      record(FLIGHT_TASK, task, took > 0xFFFF ? 0xFFFF : took);
+  }
+
+  void watermarks() {
+    uint16_t largest = kb(ESP.getMaxAllocHeap());
+    record(FLIGHT_HEAP, largest > 0xFF ? 0xFF : largest, kb(ESP.getFreeHeap()));
+    record(FLIGHT_STACK, rtcFlight.task, uxTaskGetStackHighWaterMark(nullptr));
+  }
+
+  // Retried on every report until the server has it
+  // Goes over the report uplink (client and port), so with UPLINK_TLS the
+  // dump is encrypted like the reports
+  void upload(uint32_t bootId, const char *host, WiFiClient &client) {
+    if (_uploaded || WiFi.status() != WL_CONNECTED)
+      return;
+    HTTPClient http;
+    http.setReuse(true); // Leave the kept-alive uplink connection open
+    String path = String("/api/flight/") + DEVICE_NAME +
+                  "?boot_id=" + String(bootId) +
+                  "&prev_boot_id=" + String(_prevBootId) +
+                  "&reset_reason=" + String(_resetReason) +
+                  "&task=" + String(_prevTask) +
+                  "&task_since=" + String(_prevTaskSince);
+    http.begin(client, host, UPLINK_PORT, path, UPLINK_TLS);
+    http.addHeader("Content-Type", "application/octet-stream");
+    int code = http.POST((uint8_t *)_prev, _prevCount * sizeof(FlightRecord));
+    http.end();
+    _uploaded = code >= 200 && code < 300;
+    if (_uploaded && _prevCount)
+      Serial.printf("Uploaded %d flight recorder events\n", _prevCount);
+  }
+};
+
+// ============================================
+// MEMORY TELEMETRY
+// ============================================
+// Sampled once per report into "status": free heap, minimum-ever free heap,
+// largest allocatable block and every FreeRTOS task's stack high-water mark
+// (bytes never used, from uxTaskGetSystemState). Crossing a threshold is
+// logged on the serial console the first time it happens.
+TaskStatus_t taskStatus[MAX_TRACKED_TASKS]; // Static: too big for loop()'s stack
+bool memoryWarned = false;
+
+void addMemoryStatus(JsonObject status) {
+  uint32_t heapMin = ESP.getMinFreeHeap();
+  status["heap_free"] = ESP.getFreeHeap();
+  status["heap_min"] = heapMin;
+  status["heap_largest"] = ESP.getMaxAllocHeap();
+
+  JsonObject stacks = status.createNestedObject("stacks");
+  uint32_t stackMin = UINT32_MAX;
+  const char *stackMinTask = "loopTask";
+#if configUSE_TRACE_FACILITY
+  // Returns 0 if there are more tasks than slots
+  UBaseType_t n = uxTaskGetSystemState(taskStatus, MAX_TRACKED_TASKS, nullptr);
+  for (UBaseType_t i = 0; i < n; i++) {
+    // Names point into the task control blocks; no copy needed
+    stacks[taskStatus[i].pcTaskName] = taskStatus[i].usStackHighWaterMark;
+    if (strncmp(taskStatus[i].pcTaskName, STACK_WARN_SKIP,
+                sizeof(STACK_WARN_SKIP) - 1) == 0)
+      continue;
+    if (taskStatus[i].usStackHighWaterMark < stackMin) {
+      stackMin = taskStatus[i].usStackHighWaterMark;
+      stackMinTask = taskStatus[i].pcTaskName;
+    }
+  }
+  if (n == 0)
+#endif
+  {
+    stackMin = uxTaskGetStackHighWaterMark(nullptr);
+    stacks["loopTask"] = stackMin;
+  }
+  status["stack_min"] = stackMin;
+
+  bool low = stackMin < STACK_WARN_BYTES || heapMin < HEAP_WARN_BYTES;
+  if (low && !memoryWarned)
+    Serial.printf("Memory warning: %s has %u B stack left, min free heap %u B\n",
+                  stackMinTask, (unsigned)stackMin, (unsigned)heapMin);
+  memoryWarned = low;
+}
+
+// ============================================
+// CONTROL CHANNEL
+// ============================================
+// One WebSocket to the Pi carries reports up and commands down. A report
+// is kept until the server acks its seq and is resent after a reconnect,
+// tagged with its age so the server stamps it with when it was taken; the
+// server's dedup drops copies that had already landed. Each command carries
+// an id that goes back in its result. While the link is down, reports go
+// over HTTP POST and queued commands ride in the replies.
+void handleReply(int code, JsonVariant reply);
+const char *runCommand(const char *command, JsonVariant args, JsonObject result);
+
+class ControlLink {
+private:
+  WebSocketsClient _ws;
+  String _reports[CONTROL_BUFFER]; // Unacked, oldest first
+  uint32_t _seqs[CONTROL_BUFFER];
+  unsigned long _takenAt[CONTROL_BUFFER];
+  uint32_t _sentUs[CONTROL_BUFFER];
+  uint8_t _count = 0;
+  uint32_t _bootId = 0;
+  int64_t _clockOffsetUs = 0; // Server clock minus esp_timer clock
+  uint32_t _clockRttUs = 0;   // Round trip of the probe that set it
+  bool _clockSynced = false;
+  int64_t _probeOffsetUs[CLOCK_WINDOW];
+  uint32_t _probeRttUs[CLOCK_WINDOW];
+  uint8_t _probeCount = 0;
+  uint8_t _probeNext = 0;
+  unsigned long _lastClockProbe = 0;
+
+  void drop(uint8_t index) {
+    for (uint8_t i = index; i + 1 < _count; i++) {
+      _reports[i] = _reports[i + 1];
+      _seqs[i] = _seqs[i + 1];
+      _takenAt[i] = _takenAt[i + 1];
+      _sentUs[i] = _sentUs[i + 1];
+    }
+    _count--;
+    _reports[_count] = String();
+  }
+
+  void transmit(uint8_t index) {
+    String frame = String("{\"type\":\"report\",\"age_ms\":") +
+                   String(millis() - _takenAt[index]) + ",\"data\":" +
+                   _reports[index] + "}";
+    _sentUs[index] = micros();
+    _ws.sendTXT(frame);
+  }
+
+  void acked(uint32_t seq) {
+    for (uint8_t i = 0; i < _count; i++) {
+      if (_seqs[i] == seq) {
+        lastAckUs = micros() - _sentUs[i];
+        drop(i);
+        return;
+      }
+    }
+  }
+
+  void probeClock() {
+    StaticJsonDocument<64> probe;
+    probe["type"] = "clock";
+    probe["t0"] = esp_timer_get_time();
+    String out;
+    serializeJson(probe, out);
+    _ws.sendTXT(out);
+    _lastClockProbe = millis();
+  }
+
+  // Server time is taken halfway through the round trip. Queueing only
+  // ever adds delay, so of the last CLOCK_WINDOW probes the one with the
+  // lowest round trip has the least asymmetry and sets the offset.
+  void clockAnswer(int64_t t0, int64_t serverUs) {
+    int64_t t3 = esp_timer_get_time();
+    if (t0 <= 0 || t3 - t0 > CLOCK_MAX_RTT_US)
+      return;
+    _probeRttUs[_probeNext] = t3 - t0;
+    _probeOffsetUs[_probeNext] = serverUs + (t3 - t0) / 2 - t3;
+    _probeNext = (_probeNext + 1) % CLOCK_WINDOW;
+    if (_probeCount < CLOCK_WINDOW)
+      _probeCount++;
+    uint8_t best = 0;
+    for (uint8_t i = 1; i < _probeCount; i++)
+      if (_probeRttUs[i] < _probeRttUs[best])
+        best = i;
+    _clockRttUs = _probeRttUs[best];
+    _clockOffsetUs = _probeOffsetUs[best];
+    _clockSynced = true;
+  }
+
+  void onEvent(WStype_t type, uint8_t *payload, size_t length) {
+    if (type == WStype_CONNECTED) {
+      StaticJsonDocument<128> hello;
+      hello["type"] = "hello";
+      hello["device_name"] = DEVICE_NAME;
+      hello["boot_id"] = _bootId;
+      String out;
+      serializeJson(hello, out);
+      _ws.sendTXT(out);
+      for (uint8_t i = 0; i < _count; i++)
+        transmit(i);
+      probeClock();
+      Serial.printf("Control link up (%d report(s) resent)\n", (int)_count);
+    } else if (type == WStype_TEXT) {
+      DynamicJsonDocument doc(CONTROL_DOC_SIZE);
+      if (deserializeJson(doc, (const char *)payload, length))
+        return;
+      const char *kind = doc["type"] | "";
+      if (strcmp(kind, "ack") == 0) {
+        acked(doc["seq"] | 0UL);
+        handleReply(doc["code"] | 0, doc["reply"]);
+      } else if (strcmp(kind, "command") == 0) {
+        execute(doc.as<JsonVariant>());
+      } else if (strcmp(kind, "clock") == 0) {
+        clockAnswer(doc["t0"] | (int64_t)0, doc["server_us"] | (int64_t)0);
+      }
+    }
+  }
+
+public:
+  uint32_t lastAckUs = 0; // Send-to-ack time of the last acked report
+
+  void begin(uint32_t bootId, const char *host) {
+    _bootId = bootId;
+    _ws.onEvent([this](WStype_t type, uint8_t *payload, size_t length) {
+      onEvent(type, payload, length);
+    });
+    _ws.setReconnectInterval(CONTROL_RECONNECT_MS);
+    _ws.enableHeartbeat(CONTROL_HEARTBEAT_MS, 3000, 3);
+    _ws.begin(host, CONTROL_WS_PORT, "/ws");
+  }
+
+  // Reconnects to another server; unacked reports are resent there
+  void retarget(const char *host) {
+    _ws.disconnect();
+    _ws.begin(host, CONTROL_WS_PORT, "/ws");
+  }
+
+  void loop() {
+    _ws.loop();
+    if (_ws.isConnected() && millis() - _lastClockProbe >= CLOCK_SYNC_MS)
+      probeClock();
+  }
+
+  bool clockSynced() { return _clockSynced; }
+  int64_t clockOffsetUs() { return _clockOffsetUs; }
+  uint32_t clockRttUs() { return _clockRttUs; }
+
+  // Sends one message without buffering; false if the link is down
+  bool send(JsonVariant message) {
+    if (!_ws.isConnected())
+      return false;
+    String out;
+    serializeJson(message, out);
+    return _ws.sendTXT(out);
+  }
+
+  // Sends a report and keeps it until acked; false if the link is down
+  bool sendReport(const String &report, uint32_t seq) {
+    if (!_ws.isConnected())
+      return false;
+    if (_count == CONTROL_BUFFER)
+      drop(0); // Give up on the oldest unacked report
+    _reports[_count] = report;
+    _seqs[_count] = seq;
+    _takenAt[_count] = millis();
+    _count++;
+    transmit(_count - 1);
+    return true;
+  }
+
+  // Runs one server command and answers it by id (when the link is up)
+  void execute(JsonVariant command) {
+    StaticJsonDocument<256> answer;
+    answer["type"] = "result";
+    answer["id"] = command["id"] | 0UL;
+    const char *error = runCommand(command["command"] | "", command["args"],
+                                   answer.createNestedObject("result"));
+    answer["ok"] = error == nullptr;
+    if (error)
+      answer["error"] = error;
+    if (_ws.isConnected()) {
+      String out;
+      serializeJson(answer, out);
+      _ws.sendTXT(out);
+    }
+  }
+};
+
+// ============================================
+// SERVER FAILOVER
+// ============================================
+// With a REPLICA_PI_IP set, FAILOVER_AFTER reports in a row that get no
+// HTTP status at all (connect failed or timed out) move every uplink to the
+// other Pi: reports, control link, flight uploads, waterfall. While on the
+// replica, a TCP connect to the primary every FAILBACK_CHECK_MS (from the
+// report step) moves the node back as soon as the primary answers.
+class ServerFailover {
+private:
+  bool _onReplica = false;
+  uint8_t _failures = 0;
+  uint32_t _lastCheck = 0;
+
+  bool toggle() {
+    _onReplica = !_onReplica;
+    _failures = 0;
+    _lastCheck = millis();
+    switches++;
+    Serial.printf("Switched to the %s (%s)\n", _onReplica ? "replica" : "primary",
+                  host());
+    return true;
+  }
+
+public:
+  uint16_t switches = 0; // Since boot, reported in status
+
+  const char *host() { return _onReplica ? REPLICA_PI_IP : RASPBERRY_PI_IP; }
+  bool onReplica() { return _onReplica; }
+
+  // Feed each HTTP report's outcome; true when the node switched Pi
+  bool reported(bool reached) {
+    if (reached || REPLICA_PI_IP[0] == '\0') {
+      _failures = 0;
+      return false;
+    }
+    return ++_failures >= FAILOVER_AFTER && toggle();
+  }
+
+  // True when the primary answered again and the node moved back to it
+  bool checkPrimary() {
+    if (!_onReplica || millis() - _lastCheck < FAILBACK_CHECK_MS)
+      return false;
+    _lastCheck = millis();
+    WiFiClient probe;
+    bool up = probe.connect(RASPBERRY_PI_IP, UPLINK_PORT, FAILBACK_CONNECT_MS);
+    probe.stop();
+    return up && toggle();
+  }
+};
+
 // ============================================
 // GLOBAL OBJECTS
 // ============================================
-DHTSensor dhtSensor;
+BootProfiler bootProfiler;
+FlightRecorder flightRecorder;
+ControlLink controlLink;
+ServerFailover failover;
+#if UPLINK_TLS
+WiFiClientSecure uplinkClient;
+#else
+WiFiClient uplinkClient;
+#endif
+uint32_t uplinkUs = 0;       // Last report's POST time, handshake included
+uint32_t uplinkBytes = 0;    // Last report's JSON size
+uint32_t uplinkConnects = 0; // New uplink connections (TLS handshakes) since boot
+DHTSensor dhtSensor(DHT_PIN);
 MicrophoneSensor micSensor;
+BandAnalyzer bandAnalyzer;
+SoundClassifier soundClassifier;
+OnsetDetector onsetDetector;
+MicCapture micCapture;
+FlashHistory flashHistory;
+WebServer historyServer(HISTORY_HTTP_PORT);
+WiFiUDP udp;
 unsigned long lastSend = 0;
 unsigned long lastSample = 0;
+uint32_t bootId = 0;    // Random per boot, lets the server reset its dedup window
+uint32_t reportSeq = 0; // Idempotency key for retransmits
+unsigned long reportInterval = WIFI_SEND_INTERVAL; // Changed by the set_interval command
+unsigned long sendInterval = WIFI_SEND_INTERVAL; // Stretched while the server asks us to slow down
+unsigned long restartAt = 0; // millis() of a commanded restart; 0 = none
+unsigned long waterfallUntil = 0; // Lease end (millis); 0 = not streaming
+unsigned long lastFrame = 0;
+uint16_t frameSeq = 0;
+
+void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+  if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED) {
+    bootProfiler.mark(BOOT_WIFI_ASSOC);
+    flightRecorder.record(FLIGHT_WIFI, WIFI_CONNECTED, 0);
+  } else if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    bootProfiler.mark(BOOT_DHCP);
+    flightRecorder.record(FLIGHT_WIFI, WIFI_GOT_IP, 0);
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+    flightRecorder.record(FLIGHT_WIFI, WIFI_DISCONNECTED,
+                          info.wifi_sta_disconnected.reason);
+  }
+}
 
 void connectWiFi() {
   Serial.print("Connecting to WiFi");
@@ -135,30 +1198,146 @@ void connectWiFi() {
   Serial.println("\nWiFi Connected!");
 }
 
+// Applies the server's reply to a report, whichever way it travelled
+void handleReply(int code, JsonVariant reply) {
+  if (code == 429) {
+    // Server is over its ingest budget: wait as long as it asks
+    unsigned long retryAfterMs = reply["retry_after_ms"] | reportInterval;
+    sendInterval = max(retryAfterMs, reportInterval);
+    Serial.printf("Server busy, next send in %lu ms\n", sendInterval);
+  } else if (code > 0) {
+    sendInterval = reportInterval;
+  }
+  if (code < 200 || code >= 300)
+    return;
+
+  bootProfiler.landed();
+
+  // Someone is watching the live waterfall: stream until the lease lapses
+  unsigned long leaseMs = reply["waterfall_ms"] | 0UL;
+  if (leaseMs > 0)
+    waterfallUntil = (millis() + leaseMs) | 1;
+
+  // No NTP on this network: take the Pi's clock for rollup timestamps
+  uint32_t serverTime = reply["time"] | 0UL;
+  if (time(nullptr) < CLOCK_VALID_AFTER && serverTime > CLOCK_VALID_AFTER) {
+    struct timeval tv = {(time_t)serverTime, 0};
+    settimeofday(&tv, nullptr);
+  }
+
+  // Commands queued while the control link was down
+  for (JsonVariant command : reply["commands"].as<JsonArray>())
+    controlLink.execute(command);
+}
+
+// Server commands; returns nullptr on success or a short error
+const char *runCommand(const char *command, JsonVariant args, JsonObject result) {
+  if (strcmp(command, "set_interval") == 0) {
+    unsigned long ms = args["ms"] | 0UL;
+    if (ms < MIN_REPORT_INTERVAL)
+      return "interval too short";
+    reportInterval = ms;
+    sendInterval = ms;
+    result["interval_ms"] = ms;
+  } else if (strcmp(command, "report_now") == 0) {
+    lastSend = millis() - sendInterval;
+  } else if (strcmp(command, "waterfall") == 0) {
+    unsigned long ms = args["ms"] | 0UL;
+    waterfallUntil = ms ? (millis() + ms) | 1 : 0;
+  } else if (strcmp(command, "restart") == 0) {
+    restartAt = (millis() + 500) | 1; // Let the result go out first
+  } else {
+    return "unknown command";
+  }
+  result["uptime_ms"] = millis();
+  return nullptr;
+}
+
+// Drops connections to the old Pi; the next report and the control link's
+// reconnect go to failover.host()
+void serverChanged() {
+  uplinkClient.stop();
+  if (CONTROL_CHANNEL)
+    controlLink.retarget(failover.host());
+}
+
 void sendData(float temp, float hum, int audioPeak) {
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi Disconnected. Reconnecting...");
     connectWiFi();
   }
+  if (failover.checkPrimary())
+    serverChanged();
 
-  HTTPClient http;
-  String url = "http://" + String(RASPBERRY_PI_IP) + ":5000/sensor-data";
-
-  http.begin(url);
-  http.addHeader("Content-Type", "application/json");
-
-  StaticJsonDocument<256> doc;
+  StaticJsonDocument<1536> doc;
   doc["device_name"] = DEVICE_NAME;
+  doc["boot_id"] = bootId;
+  uint32_t seq = reportSeq++;
+  doc["seq"] = seq;
 
   JsonObject s = doc.createNestedObject("sensors");
   s["temperature"] = temp;
   s["humidity"] = hum;
   s["audio_peak"] = audioPeak;
+  soundClassifier.addTo(s);
+
+  JsonObject status = doc.createNestedObject("status");
+  status["wifi_rssi"] = WiFi.RSSI();
+  status["uptime_ms"] = millis();
+  status["uplink_tls"] = UPLINK_TLS;
+  status["uplink_us"] = uplinkUs;
+  status["uplink_bytes"] = uplinkBytes;
+  status["uplink_connects"] = uplinkConnects;
+  status["on_replica"] = failover.onReplica();
+  status["failovers"] = failover.switches;
+  status["sound_us"] = soundClassifier.lastUs();
+  // Per 100 ms frame; a second of classifier input costs 10x this
+  status["sound_frontend_us"] = bandAnalyzer.lastUs();
+  status["sound_model_captured_s"] = SOUND_MODEL_CAPTURED_S;
+  addMemoryStatus(status);
+
+  if (bootProfiler.pending())
+    bootProfiler.addTo(doc.createNestedObject("boot"));
 
   String jsonString;
   serializeJson(doc, jsonString);
+  uplinkBytes = jsonString.length();
+
+  // Link up: the ack and its reply come back through controlLink.loop()
+  if (CONTROL_CHANNEL && controlLink.sendReport(jsonString, seq)) {
+    uplinkUs = controlLink.lastAckUs;
+    return;
+  }
+
+  // Static so the connection outlives the call; end() keeps it open
+  static HTTPClient http;
+  http.setReuse(true);
+  http.begin(uplinkClient, failover.host(), UPLINK_PORT, "/sensor-data",
+             UPLINK_TLS);
+  http.addHeader("Content-Type", "application/json");
+
+  // Retry with the same seq; the server acks duplicates without storing them
+  int responseCode = -1;
+  int attempts = 0;
+  if (!uplinkClient.connected())
+    uplinkConnects++;
+  uint32_t started = micros();
+  for (int attempt = 0; attempt < SEND_MAX_ATTEMPTS; attempt++) {
+    if (attempt > 0)
+      delay(SEND_RETRY_BACKOFF_MS << (attempt - 1));
+    responseCode = http.POST(jsonString);
+    attempts++;
+    if ((responseCode >= 200 && responseCode < 300) || responseCode == 429)
+      break;
+  }
+  uplinkUs = micros() - started;
+  flightRecorder.record(FLIGHT_POST, attempts, (uint16_t)(int16_t)responseCode);
+
+  DynamicJsonDocument reply(CONTROL_DOC_SIZE);
+  if (responseCode > 0)
+    deserializeJson(reply, http.getString());
+  handleReply(responseCode, reply.as<JsonVariant>());
 
-  int responseCode = http.POST(jsonString);
   if (responseCode > 0)
     Serial.printf("Sent Data (Code %d)\n", responseCode);
   else
@@ -166,31 +1345,127 @@ void sendData(float temp, float hum, int audioPeak) {
                   http.errorToString(responseCode).c_str());
 
   http.end();
+  if (failover.reported(responseCode > 0))
+    serverChanged();
+}
+
+// Onset times go out on the server's clock; without a synced clock (or a
+// link) the server couldn't place them, so they are dropped
+void sendOnset() {
+  StaticJsonDocument<768> msg;
+  msg["type"] = "onset";
+  msg["synced"] = controlLink.clockSynced();
+  msg["sync_rtt_us"] = controlLink.clockRttUs();
+  onsetDetector.take(msg.as<JsonObject>(), controlLink.clockOffsetUs());
+  controlLink.send(msg.as<JsonVariant>());
+}
+
+void sendWaterfallFrame(const uint8_t *bands) {
+  // "HPW1" | boot id | seq | band count | name length | name | bands
+  // (multi-byte fields little-endian, native on the ESP32)
+  const uint8_t header[4] = {'H', 'P', 'W', '1'};
+  const uint8_t counts[2] = {WATERFALL_BANDS, (uint8_t)strlen(DEVICE_NAME)};
+  udp.beginPacket(failover.host(), WATERFALL_UDP_PORT);
+  udp.write(header, sizeof(header));
+  udp.write((const uint8_t *)&bootId, sizeof(bootId));
+  udp.write((const uint8_t *)&frameSeq, sizeof(frameSeq));
+  udp.write(counts, sizeof(counts));
+  udp.write((const uint8_t *)DEVICE_NAME, counts[1]);
+  udp.write(bands, WATERFALL_BANDS);
+  udp.endPacket();
+  frameSeq++;
 }
 
 // ============================================
 // MAIN LOOP
 // ============================================
 void setup() {
+  bootProfiler.mark(BOOT_APP_START);
   Serial.begin(115200);
+  bootProfiler.mark(BOOT_SERIAL);
+  bootId = esp_random();
+  flightRecorder.begin(bootId);
+#if UPLINK_TLS
+  uplinkClient.setPreSharedKey(DEVICE_NAME, UPLINK_PSK);
+#endif
+  WiFi.onEvent(onWiFiEvent);
   dhtSensor.begin();
-  micSensor.begin();
+  bootProfiler.mark(BOOT_DHT);
+  micCapture.begin(onsetDetector);
+  bootProfiler.mark(BOOT_MIC);
+  bandAnalyzer.begin();
+  Serial.printf("Sound model: %s\n", SOUND_MODEL_INFO);
+  bootProfiler.mark(BOOT_BANDS);
+  if (!flashHistory.begin())
+    Serial.println("No SPIFFS partition: flash history disabled");
+  bootProfiler.mark(BOOT_FLASH);
   connectWiFi();
+  configTime(0, 0, "pool.ntp.org");
+  historyServer.on("/history", []() { flashHistory.handleQuery(historyServer); });
+  historyServer.begin();
+  if (CONTROL_CHANNEL)
+    controlLink.begin(bootId, failover.host());
   Serial.println("Living Room Node Initialized");
+  bootProfiler.mark(BOOT_SETUP_DONE);
 }
 
 void loop() {
   unsigned long currentMillis = millis();
+  flightRecorder.enter(TASK_HISTORY);
+  historyServer.handleClient();
+  flightRecorder.exit();
+  if (CONTROL_CHANNEL) {
+    flightRecorder.enter(TASK_CONTROL);
+    controlLink.loop();
+    flightRecorder.exit();
+  }
+  if (restartAt && (long)(currentMillis - restartAt) >= 0)
+    ESP.restart();
 
   // 1. High Frequency Audio Sampling (Every 100ms)
   if (currentMillis - lastSample >= 100) {
     lastSample = currentMillis;
-    micSensor.sample();
+    flightRecorder.enter(TASK_SAMPLE);
+    int16_t samples[AUDIO_SAMPLES];
+    micCapture.latest(samples, AUDIO_SAMPLES);
+    micSensor.sample(samples);
+    flightRecorder.exit();
+  }
+
+  // 2. Band energies (10 fps): classifier input, streamed while leased
+  if (waterfallUntil && (long)(waterfallUntil - currentMillis) <= 0)
+    waterfallUntil = 0;
+  if (currentMillis - lastFrame >= WATERFALL_FRAME_MS) {
+    lastFrame = currentMillis;
+    flightRecorder.enter(TASK_WATERFALL);
+    int16_t block[WATERFALL_BLOCK];
+    micCapture.latest(block, WATERFALL_BLOCK);
+    uint8_t bands[WATERFALL_BANDS];
+    bandAnalyzer.analyze(block, bands);
+    if (waterfallUntil)
+      sendWaterfallFrame(bands);
+    flightRecorder.exit();
+
+    if (soundClassifier.addFrame(bands)) {
+      flightRecorder.enter(TASK_SOUND);
+      soundClassifier.classify();
+      flightRecorder.exit();
+    }
+  }
+
+  // 3. Noise onsets, ~330 ms after the event
+  if (onsetDetector.ready()) {
+    flightRecorder.enter(TASK_SOUND);
+    sendOnset();
+    flightRecorder.exit();
   }
 
-  // 2. Data Reporting (Every 10s)
-  if (currentMillis - lastSend >= WIFI_SEND_INTERVAL) {
+  // 4. Data Reporting (Every 10s)
+  if (currentMillis - lastSend >= sendInterval) {
     lastSend = currentMillis;
+    flightRecorder.enter(TASK_REPORT);
+    flightRecorder.watermarks();
+    flightRecorder.upload(bootId, failover.host(), uplinkClient);
 
     float t, h;
     if (dhtSensor.read(t, h)) {
@@ -198,9 +1473,13 @@ void loop() {
 
       Serial.printf("Temp: %.1f C | Hum: %.1f %% | Audio Peak: %d\n", t, h,
                     peak);
+      const float rollup[] = {t, h, (float)peak};
+      flashHistory.add(rollup, 3);
       sendData(t, h, peak);
     } else {
       Serial.println("Failed to read DHT sensor!");
+      flightRecorder.record(FLIGHT_SENSOR_ERROR, FLIGHT_SENSOR_DHT, 0);
     }
+    flightRecorder.exit();
   }
 }
@@ -0,0 +1,145 @@
+// Generated by `python3 homepod_server_v3.py train-sound`; do not edit.
+// 2026-10-18, 0 captured + 900 synthetic s, held-out int8 accuracy 93%
+#ifndef SOUND_MODEL_H
+#define SOUND_MODEL_H
+
+#define SOUND_MODEL_INFO "2026-10-18, 0 captured + 900 synthetic s, held-out int8 accuracy 93%"
+#define SOUND_MODEL_CAPTURED_S 0
+#define SOUND_FEATURES 32
+#define SOUND_HIDDEN1 32
+#define SOUND_HIDDEN2 16
+#define SOUND_CLASSES 6
+
+static const char *const SOUND_CLASS_NAMES[SOUND_CLASSES] = {"silence", "speech", "music", "tv", "appliance", "alarm"};
+
+static const int8_t SOUND_W1[1024] = {
+  15, 44, -6, 16, -11, -2, 31, 22, 29, -19, 4, -29, 32, 27, -9, 48,
+  23, 8, -11, -13, 2, 25, 16, -28, 7, 10, 6, 18, -10, 14, -5, -13,
+  68, -6, 30, 0, 11, 17, -10, -31, -36, -10, 73, 9, 27, -32, -2, 112,
+  4, -12, -33, -17, -74, -59, -70, -53, -27, -58, 14, -54, -1, 2, -23, 64,
+  9, 40, -13, -77, -21, -27, -51, -20, -34, -38, -19, -20, -73, -27, -22, 2,
+  35, 37, 11, 21, -1, -3, -38, 19, 9, 38, 32, 40, -48, -25, 2, -6,
+  -46, 10, 5, 24, -15, 51, 32, -15, 1, 2, -16, 0, -20, -39, 7, 30,
+  16, -16, 27, 33, -45, -1, -17, -36, -12, 11, 10, 8, 51, -1, -46, 8,
+  10, 65, 28, -22, 35, 23, -10, 19, -2, -48, -37, -56, -10, 31, -10, -4,
+  -9, -22, 39, 41, 14, 7, 34, -26, -14, 24, 5, 39, -38, 13, -45, -20,
+  31, 76, 29, 36, 39, 24, -35, 10, -1, -40, -13, -75, -45, -86, -114, -38,
+  1, -10, 24, 35, 15, -1, -55, 6, 10, 28, -34, -33, -16, -32, -37, -20,
+  108, 92, 0, -1, 2, 11, -49, 1, 18, -40, -60, -70, -57, -50, -19, -25,
+  20, 22, 46, 10, 22, 42, 13, 13, 46, 42, -20, -22, -21, -52, -79, -64,
+  127, 9, -21, 8, -26, -25, -66, -64, -78, -40, -42, 56, -5, 68, 36, 97,
+  -68, -24, -57, -21, -19, 25, 22, 20, 4, -34, -22, 29, 3, -18, -25, -39,
+  -11, 21, -21, 16, 30, 17, -41, 18, 36, 10, 3, -5, -54, -28, -14, -8,
+  24, -5, 33, 20, 5, -34, 20, -19, 29, 17, 33, -23, -2, 7, -1, 30,
+  -5, -37, 8, 4, 18, -43, -17, -29, 9, -16, 31, -17, -25, -16, 38, 21,
+  19, -42, 9, 20, -10, 12, 14, -12, 11, -22, 26, 30, -14, -9, 49, 4,
+  -47, -44, 66, 24, 24, -11, 45, 75, 39, -15, 12, -119, -22, -35, -56, -43,
+  63, 24, 36, 13, -2, 13, -53, -40, -1, -18, -83, -48, -26, -11, -18, 33,
+  -64, -16, -43, -33, -2, -25, -14, -8, 11, 45, 37, 38, -19, 7, -23, 8,
+  7, 27, -15, 13, 5, 19, 37, -22, -29, 12, 43, 8, 19, -43, -21, -34,
+  -13, 14, 17, -32, 25, 0, -34, -16, 3, -56, -12, -48, 21, 21, -12, 0,
+  -4, -3, 9, -14, 2, -4, -13, -3, -13, -5, 18, 4, 9, -41, -76, 10,
+  -47, -12, 33, 1, -9, 9, -10, 57, 57, 34, 0, -69, -43, -49, 35, -98,
+  12, 35, 0, 33, 20, -2, -10, 32, 59, 32, -21, -37, -11, -19, 42, -69,
+  -27, -25, -12, -35, 1, 5, 2, -49, -47, 12, 20, 19, 10, 10, -4, 19,
+  -5, -11, -6, 19, 1, -6, 8, -22, -15, -17, 10, 19, 49, 12, 26, 16,
+  -13, 6, 27, -49, -5, -8, -11, 55, 21, 40, -58, 18, 13, 34, 74, -107,
+  -38, -44, -15, -7, -2, 2, 10, 27, 40, 63, 24, -13, 31, 59, 44, -90,
+  -45, -65, -13, 9, 17, -16, 17, 96, 79, 17, 38, -38, -1, -1, -32, -58,
+  5, 20, 4, 19, 22, -1, -23, -9, 27, -15, -35, -35, -12, 12, 25, 20,
+  -64, 60, 3, 59, -22, 29, 41, 21, -14, 3, 25, -22, -8, -6, -68, -12,
+  -36, -5, -13, 0, 20, -49, -55, -20, -31, -4, -55, 17, 2, -4, -15, 4,
+  -23, -34, -7, 43, 45, 46, 3, -23, 40, 35, -17, 14, -6, -9, 36, -73,
+  -12, -11, -6, -31, -6, 18, -38, 15, -14, -26, -17, -22, 26, 26, 66, -2,
+  8, 54, -5, -15, 13, 10, 8, -29, 27, -4, -6, -10, -30, 26, -4, 58,
+  -45, 4, 6, -49, 25, -36, 52, -11, 16, -1, 16, -16, 2, -44, 6, -9,
+  8, -31, -10, -51, -33, -40, -14, -32, 20, 24, 36, 56, 15, 51, 13, 27,
+  -24, -36, -34, -65, -67, 0, 72, 39, 56, -11, -4, 40, -21, 37, -5, 32,
+  49, -7, -3, 27, -18, 44, 40, 55, 12, -19, -20, -6, -6, -12, -3, 53,
+  -32, 21, 2, 0, -10, -39, -54, -43, -4, -21, -10, -32, -18, 8, 17, 25,
+  1, 15, -9, -19, -19, 33, -14, -16, -47, -25, -21, -14, -7, 29, 27, 64,
+  16, -6, -5, -25, 3, 7, -26, -86, -56, -35, 28, -8, 30, 24, -29, 47,
+  -52, -26, 36, 11, 3, 28, 14, 24, 32, 29, 10, 7, 0, -42, -10, -74,
+  -6, -20, 17, -22, 18, 18, -1, 19, 11, 8, -15, 25, -26, 27, 5, 21,
+  67, 52, 6, 6, -19, -55, -23, -46, -24, -7, -45, -37, -59, -36, 3, 46,
+  25, -21, -2, 3, 9, 25, 5, 17, -5, -1, -14, 1, -8, 6, 13, -14,
+  -5, -15, -24, -23, -29, -33, 34, -57, 2, -9, 6, 68, 21, 39, 3, 21,
+  -32, -13, 12, -20, -39, 25, 51, -6, -25, -55, 11, 29, 4, -7, -67, 30,
+  22, -16, -58, -49, -31, -52, -15, -22, -50, -24, 10, 43, 28, 34, -9, 33,
+  -43, 15, 5, -32, -61, 8, -28, 16, -60, -1, 23, 90, 40, 9, 16, 33,
+  -20, -21, -17, 25, 21, 1, 23, 35, 17, -12, -18, 18, -14, 5, 49, -65,
+  -23, 7, -29, -1, -32, 25, 27, -1, 42, 42, -15, 47, 33, -27, 29, -46,
+  -91, -26, -15, -27, 3, -4, 27, 39, 19, 12, 39, 34, 18, 35, -1, 44,
+  -6, -8, 22, -65, 3, -5, 15, -4, -36, -54, -36, 4, 3, 33, 17, 31,
+  -76, -28, 0, -2, -23, -2, -1, -10, -27, -26, -15, -17, -5, -12, -10, 15,
+  14, -20, -24, 67, 25, 25, 17, 84, -5, 29, -7, -20, 16, 35, 34, 11,
+  -48, 6, -29, -8, -1, -3, 6, 14, 19, -16, -44, 55, 12, -27, 0, -9,
+  26, 27, -11, 7, 19, -24, -17, 18, 32, 39, 20, 21, -56, 18, -14, -9,
+  -2, -60, -4, 8, 17, 35, -13, 46, -22, -3, 20, 19, 15, 5, -45, -34,
+  1, 27, -31, 44, 41, 36, -21, -26, 14, -1, -21, 14, 28, 14, 48, 6
+};
+
+static const int32_t SOUND_B1[32] = {
+  -888, -10669, -6303, -2110, 4384, -17222, -3668, -2686, -183, 2897, -6373, 3331, -7195, 6623, 1705, 15063,
+  3964, -12629, 1282, -1388, 7148, -2440, -5851, 6181, -2864, -3023, -2516, 8427, 1835, 12048, -128, 49
+};
+
+static const int32_t SOUND_M1 = 1568823146;
+static const int SOUND_S1 = 39;
+
+static const int8_t SOUND_W2[512] = {
+  -32, 29, 6, 47, -10, 45, -42, -81, 16, -3, 127, 15, 19, -4, 2, -76,
+  67, 53, 0, -17, -18, 29, 24, 25, -52, 9, -14, -42, 52, -8, -15, 15,
+  11, -20, 25, -4, -55, -10, -45, -28, 4, 15, 27, -53, -20, 15, 14, -3,
+  -27, 22, -25, 16, 2, -5, -2, -17, 6, -17, 30, 2, 24, -3, 3, 4,
+  4, -53, 90, 18, -5, 33, 30, -2, -29, 0, 29, 44, 58, 47, -24, -10,
+  -15, 17, -45, 17, -28, -57, 12, -40, 42, 26, 41, 1, -32, 42, 29, 44,
+  18, -16, -31, -40, -17, 12, 12, -13, 0, -4, -39, 6, 19, -7, -1, -6,
+  8, 26, -4, 16, 10, -16, -13, -1, -21, -9, -11, -22, -1, 24, 5, 13,
+  -24, -72, -1, 20, 43, -9, 61, -36, 42, -12, 45, 2, -24, 25, -25, 59,
+  27, -27, 20, -35, 27, 16, -40, 47, 8, -53, -37, 13, -3, 69, 28, -12,
+  53, 23, -17, 1, -43, -68, -54, -3, 6, 14, -25, 39, -15, -49, 35, 28,
+  -18, 43, 13, 8, 47, -6, 30, 23, 3, 8, 62, -4, 36, 22, -12, 12,
+  -1, -22, 36, 25, 43, -40, 5, 78, 28, 30, -13, 34, -7, -4, -10, 12,
+  -10, -54, -32, 34, 66, -13, 55, 15, 1, 35, 40, 23, -4, 56, 12, 1,
+  19, -22, 8, -35, 6, 9, -20, 20, -1, 25, -20, -5, 24, 1, 19, 14,
+  7, 28, 23, -1, -12, -3, 3, 22, -13, 0, -16, 46, 9, -31, -17, 31,
+  10, 16, -30, -35, 38, -53, -11, -24, 30, 40, -9, -23, 1, 13, -16, 62,
+  35, -7, -2, -1, -32, -24, -18, 14, -12, -14, -15, -17, -15, -5, -43, -38,
+  -13, 98, 10, 15, 28, 63, 73, 90, -4, -18, 7, -40, 36, -64, 10, -42,
+  -51, 25, -28, 45, -1, 53, 26, -59, 14, -2, 11, -57, -30, -26, 38, 42,
+  13, -2, 3, -11, -18, 7, 15, -11, -4, 31, 1, -22, 16, -4, 15, -18,
+  -3, -14, 30, -10, -6, -22, 22, -7, -3, 3, -24, -14, -30, -12, 30, 4,
+  -29, -6, -1, 2, 3, 57, 16, -16, 23, 4, 38, -21, 8, 64, 2, 50,
+  22, 48, 56, -26, -80, 16, -57, -6, -37, -57, -39, 10, -36, -19, 23, 21,
+  -15, 15, -6, 4, 8, -79, -66, 1, -72, 30, -26, 11, 34, 19, 6, 10,
+  35, -22, 29, -12, 20, -3, 4, 11, -13, 33, 31, 39, 14, 28, 11, 37,
+  15, -3, 24, -15, -16, 12, -3, 24, -48, 12, 14, -3, -63, 16, 6, 3,
+  -35, 11, -17, -7, 40, -16, 19, -25, -26, 23, -33, -31, 7, -11, -30, 21,
+  6, 3, 4, -21, 14, 2, 0, 32, -20, 3, -11, 17, 14, -40, 1, 5,
+  18, -26, -14, 28, -15, -20, -9, -5, -13, -12, 3, -47, 3, -7, 21, 12,
+  -18, -39, 56, -1, 37, -8, -45, -16, -10, 31, -29, -31, -20, 19, 35, 34,
+  -63, -54, -20, -18, -18, 13, 2, -14, 27, 15, 29, 20, 6, 50, 0, -3
+};
+
+static const int32_t SOUND_B2[16] = {
+  -1987, -128, -1188, -383, 2158, 1453, 2569, 1, 409, -1679, -541, 932, 2097, -102, -22, 561
+};
+
+static const int32_t SOUND_M2 = 1413469175;
+static const int SOUND_S2 = 38;
+
+static const int8_t SOUND_W3[96] = {
+  -11, 20, 86, 3, -22, -11, 20, 7, 19, 24, -38, -64, -37, -11, -1, -38,
+  -14, -7, 46, 1, 73, -25, 13, -16, 41, -40, -35, -2, 5, -12, 30, -9,
+  127, -12, -45, 34, -17, 16, -29, 1, -18, 1, 26, 3, -3, 21, -2, 8,
+  55, -33, 8, 2, 12, 16, -74, 26, 13, -54, -5, 56, 9, 9, -13, 9,
+  -15, 29, -44, -34, -13, -36, -34, -15, 6, 109, -35, 2, -54, -2, -26, 25,
+  -48, 25, -5, -18, -5, 56, 69, 6, -18, -1, 26, -73, 44, -14, 10, 26
+};
+
+static const int32_t SOUND_B3[6] = {
+  -452, 566, -661, 303, -281, 525
+};
+
+#endif
@@ -10,15 +10,47 @@ HomePOD Sensor Server v3 - Enhanced Multi-App Dashboard
 - Touch-friendly UI optimized for 7-inch displays
 """
 
-from flask import Flask, request, jsonify, redirect
+from flask import Flask, Response, request, jsonify, redirect
 from datetime import datetime
 import json
+import base64
+import hashlib
 import requests
 import time
 import os
+import sys
 import uuid
+import re
 import subprocess
 import platform
+import threading
+import queue
+import math
+import random
+import operator
+import struct
+import socket
+import ssl
+import bisect
+import gzip
+import zlib
+import io
+import csv
+import argparse
+from array import array
+from collections import deque
+
+try:
+    import brotli
+except ImportError:
+    brotli = None
+
+try:
+    import pyarrow
+    import pyarrow.ipc
+    import pyarrow.parquet
+except ImportError:
+    pyarrow = None
 
 app = Flask(__name__)
 
@@ -27,7 +59,10 @@ TODO_FILE = "todo_data.json"
 NOTES_FILE = "notes_data.json"
 TIMERS_FILE = "timers_data.json"
 MUSIC_FILE = "music_queue.json"
-latest_readings = {}
+DEVICES_FILE = "device_registry.json"
+
+# Bumped on every save so cached page fragments know to re-render
+data_versions = {'todo': 0, 'notes': 0, 'timers': 0, 'music': 0}
 
 # ============================================
 # TO-DO LIST STORAGE
@@ -42,6 +77,7 @@ def load_todos():
     return []
 
 def save_todos(todos):
+    data_versions['todo'] += 1
     with open(TODO_FILE, 'w') as f:
         json.dump(todos, f)
 
@@ -60,11 +96,91 @@ def load_notes():
     return []
 
 def save_notes(notes):
+    data_versions['notes'] += 1
     with open(NOTES_FILE, 'w') as f:
         json.dump(notes, f)
 
 notes_list = load_notes()
 
+# ============================================
+# SEARCH INDEX
+# ============================================
+# Inverted index over todo text and note titles/content. Postings map each
+# word to the documents containing it; a sorted term list lets each query
+# word match as a prefix ("piz" finds "pizza") with a bisect instead of a
+# scan. The index is kept in step with add/delete instead of being rebuilt.
+SEARCH_RESULT_LIMIT = 50
+SEARCH_MAX_LIMIT = 500         # ?limit= is clamped to 1..this
+WORD_RE = re.compile(r"\w+")
+
+def tokenize(text):
+    return set(WORD_RE.findall(text.lower()))
+
+class SearchIndex:
+    def __init__(self):
+        self.postings = {}   # term -> set of doc keys
+        self.terms = []      # sorted list of postings keys
+        self.docs = {}       # doc key -> (terms, item)
+
+    def add(self, key, text, item):
+        self.remove(key)
+        terms = tokenize(text)
+        self.docs[key] = (terms, item)
+        for term in terms:
+            docs = self.postings.get(term)
+            if docs is None:
+                docs = self.postings[term] = set()
+                bisect.insort(self.terms, term)
+            docs.add(key)
+
+    def remove(self, key):
+        entry = self.docs.pop(key, None)
+        if entry is None:
+            return
+        for term in entry[0]:
+            docs = self.postings[term]
+            docs.discard(key)
+            if not docs:
+                del self.postings[term]
+                del self.terms[bisect.bisect_left(self.terms, term)]
+
+    def matching(self, prefix):
+        """Union of the postings of every term starting with prefix."""
+        docs = set()
+        i = bisect.bisect_left(self.terms, prefix)
+        while i < len(self.terms) and self.terms[i].startswith(prefix):
+            docs |= self.postings[self.terms[i]]
+            i += 1
+        return docs
+
+    def search(self, query, limit=SEARCH_RESULT_LIMIT):
+        """Return (kind, item) for documents matching every query word.
+
+        Exact word matches rank above prefix-only matches."""
+        words = sorted(tokenize(query), key=len, reverse=True)
+        if not words:
+            return []
+        result = None
+        for word in words:
+            docs = self.matching(word)
+            result = docs if result is None else result & docs
+            if not result:
+                return []
+        scored = sorted(result, key=lambda key: -sum(w in self.docs[key][0] for w in words))
+        return [(key[0], self.docs[key][1]) for key in scored[:limit]]
+
+def index_todo(item):
+    search_index.add(('todo', item['id']), item['text'], item)
+
+def index_note(note):
+    search_index.add(('note', note['id']), note['title'] + ' ' + note['content'], note)
+
+search_index = SearchIndex()
+for item in todo_list:
+    index_todo(item)
+for note in notes_list:
+    index_note(note)
+
 # ============================================
 # TIMERS STORAGE
 # ============================================
@@ -78,11 +194,973 @@ def load_timers():
     return []
 
 def save_timers(timers):
+    data_versions['timers'] += 1
     with open(TIMERS_FILE, 'w') as f:
         json.dump(timers, f)
 
 timers_list = load_timers()
 
+# ============================================
+# EVENT PUSH
+# ============================================
+# Server-Sent Events to every open dashboard page. Each event is encoded
+# once and the same bytes object is queued to every subscriber.
+EVENT_QUEUE_SIZE = 64
+EVENT_KEEPALIVE = 15  # seconds
+
+class EventHub:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.subscribers = set()
+
+    def subscribe(self):
+        q = queue.Queue(maxsize=EVENT_QUEUE_SIZE)
+        with self.lock:
+            self.subscribers.add(q)
+        return q
+
+    def unsubscribe(self, q):
+        with self.lock:
+            self.subscribers.discard(q)
+
+    def publish(self, event, data):
+        self.broadcast(f"event: {event}\ndata: {json.dumps(data)}\n\n".encode())
+
+    def broadcast(self, message):
+        """Queue the same bytes object to every subscriber."""
+        with self.lock:
+            subscribers = list(self.subscribers)
+        for q in subscribers:
+            try:
+                q.put_nowait(message)
+            except queue.Full:
+                pass  # Stalled client; it will resync on its next page load
+
+event_hub = EventHub()
+
+# ============================================
+# LIVE SOUND WATERFALL
+# ============================================
+# Mic nodes send per-block band energies (one dB-scaled byte per band) as
+# UDP datagrams, but only while their /sensor-data reply carries a
+# streaming lease, which is granted only while someone is watching that
+# device. Each datagram is re-framed once and that bytes object is shared
+# by every viewer's queue.
+WATERFALL_UDP_PORT = 5001
+WATERFALL_LEASE_MS = 15000    # a little over one report interval
+WATERFALL_MAX_BANDS = 64
+WATERFALL_MAGIC = b'HPW1'
+# magic, boot_id, seq, band count, name length; then name, then band bytes
+WATERFALL_HEADER = struct.Struct('<4sIHBB')
+WATERFALL_KEEPALIVE = b'\x00\x00\x00\x00'   # zero-band frame
+
+waterfall_hubs = {}   # device_name -> EventHub of binary frames
+waterfall_stats = {'frames': 0, 'dropped': 0}
+
+def waterfall_viewers(device_name):
+    hub = waterfall_hubs.get(device_name)
+    return len(hub.subscribers) if hub else 0
+
+def handle_waterfall_datagram(packet):
+    if len(packet) < WATERFALL_HEADER.size:
+        return False
+    magic, boot_id, seq, bands, name_len = WATERFALL_HEADER.unpack_from(packet)
+    end = WATERFALL_HEADER.size + name_len
+    if (magic != WATERFALL_MAGIC or not 0 < bands <= WATERFALL_MAX_BANDS
+            or len(packet) != end + bands):
+        return False
+    device_name = packet[WATERFALL_HEADER.size:end].decode('utf-8', 'replace')
+    if device_name in sound_captures:
+        capture_sound_frame(device_name, packet[end:])
+    hub = waterfall_hubs.get(device_name)
+    if hub is None or not hub.subscribers:
+        return False
+    # Browser frame: band count, reserved, seq (LE), band bytes
+    hub.broadcast(struct.pack('<BBH', bands, 0, seq) + packet[end:])
+    return True
+
+def run_waterfall_listener():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('0.0.0.0', WATERFALL_UDP_PORT))
+    while True:
+        packet = sock.recv(2048)
+        if handle_waterfall_datagram(packet):
+            waterfall_stats['frames'] += 1
+        else:
+            waterfall_stats['dropped'] += 1
+
+def start_waterfall_listener():
+    threading.Thread(target=run_waterfall_listener, daemon=True).start()
+
+# ============================================
+# SOUND SCENE CLASSIFIER
+# ============================================
+# Mic nodes classify the sound scene themselves, once per second, with a
+# small int8 network (HomePOD_*_Node/sound_model.h) over the same 16 log
+# band energies the waterfall streams. Each report carries, per class, the
+# share of the interval's seconds given that class (sound_<class>), and a
+# room shows the class with the largest share across its nodes.
+#
+# The model is trained here, with the standard library only:
+#   python3 homepod_server_v3.py train-sound -o HomePOD_Env_Node/sound_model.h
+# Training mixes synthetic scenes with labelled captures, which are recorded
+# from a node's waterfall stream via POST /api/sound/capture. Features and
+# integer inference below match SoundClassifier on the nodes bit for bit.
+SOUND_CLASSES = ('silence', 'speech', 'music', 'tv', 'appliance', 'alarm')
+SOUND_LABELS = {'silence': 'Quiet', 'speech': 'Talking', 'music': 'Music',
+                'tv': 'TV', 'appliance': 'Appliance', 'alarm': 'Alarm'}
+SOUND_CHANNELS = tuple('sound_' + c for c in SOUND_CLASSES)
+SOUND_FRAMES = 10            # 100 ms frames per inference
+SOUND_BANDS = 16
+SOUND_HIDDEN = (32, 16)
+SOUND_CAPTURE_FILE = "sound_captures_v3.log"
+SOUND_CAPTURE_MAX_SECONDS = 600
+SOUND_SAMPLE_RATE = 8000     # node-side band analysis, see BandAnalyzer
+SOUND_BLOCK = 128
+SOUND_DB_FLOOR = 20.0
+SOUND_DB_RANGE = 80.0
+
+sound_captures = {}   # device_name -> {'label', 'until', 'frames'}
+sound_capture_lock = threading.Lock()
+
+def sound_scene_trusted(room_name):
+    """True once a node in the room runs a model trained on real captures.
+
+    The shipped sound_model.h is synthetic-only, so until then the room card
+    keeps the peak-level label."""
+    return any((latest_state.get(d, 'status.sound_model_captured_s') or 0) > 0
+               for d in device_registry.room_devices.get(room_name, ()))
+
+def sound_scene(sensors):
+    """(label, share) of the dominant class in fused room sensors, or None."""
+    shares = [(sensors.get(ch), c) for ch, c in zip(SOUND_CHANNELS, SOUND_CLASSES)]
+    shares = [(v, c) for v, c in shares if isinstance(v, (int, float))]
+    if not shares:
+        return None
+    share, cls = max(shares)
+    return SOUND_LABELS[cls], share
+
+def sound_features(frames):
+    """Per-band mean and 2x mean absolute frame-to-frame change, as uint8."""
+    n = len(frames)
+    feats = [sum(f[b] for f in frames) // n for b in range(SOUND_BANDS)]
+    for b in range(SOUND_BANDS):
+        change = sum(abs(frames[i][b] - frames[i - 1][b]) for i in range(1, n))
+        feats.append(min(255, change * 2 // (n - 1)))
+    return feats
+
+# ---- Capture ----
+
+def start_sound_capture(device_name, label, seconds):
+    with sound_capture_lock:
+        sound_captures[device_name] = {'label': label, 'until': time.time() + seconds, 'frames': []}
+    # Starts the stream at once over the control link; otherwise the lease
+    # rides on the next /sensor-data reply
+    send_command(device_name, 'waterfall', {'ms': int(seconds * 1000)})
+
+def sound_capture_active(device_name):
+    capture = sound_captures.get(device_name)
+    return capture is not None and capture['until'] > time.time()
+
+def capture_sound_frame(device_name, bands):
+    with sound_capture_lock:
+        capture = sound_captures.get(device_name)
+        if capture is None:
+            return
+        if capture['until'] <= time.time():
+            del sound_captures[device_name]
+            return
+        if len(bands) != SOUND_BANDS:
+            return
+        capture['frames'].append(list(bands))
+        if len(capture['frames']) < SOUND_FRAMES:
+            return
+        frames, capture['frames'] = capture['frames'], []
+        line = json.dumps({'device_name': device_name, 'label': capture['label'],
+                           'time': format_timestamp(time.time()), 'frames': frames})
+    with open(local_log(SOUND_CAPTURE_FILE), 'a') as f:
+        f.write(line + '\n')
+
+def load_sound_captures(path):
+    examples = []
+    if not os.path.exists(path):
+        return examples
+    with open(path) as f:
+        for line in f:
+            try:
+                entry = json.loads(line)
+            except ValueError:
+                continue
+            if entry.get('label') in SOUND_CLASSES and len(entry.get('frames') or ()) == SOUND_FRAMES:
+                examples.append((sound_features(entry['frames']), SOUND_CLASSES.index(entry['label'])))
+    return examples
+
+# ---- Synthetic scenes ----
+# Each scene is rendered only where the node samples: a 16 ms block every
+# 100 ms, run through the node's Goertzel bands and dB scaling.
+
+def goertzel_bands(block):
+    mean = sum(block) / len(block)
+    lo, hi = 100.0, SOUND_SAMPLE_RATE * 0.45
+    bands = []
+    for b in range(SOUND_BANDS):
+        f = lo * (hi / lo) ** (b / (SOUND_BANDS - 1))
+        coeff = 2.0 * math.cos(2.0 * math.pi * f / SOUND_SAMPLE_RATE)
+        s1 = s2 = 0.0
+        for x in block:
+            s1, s2 = (x - mean) + coeff * s1 - s2, s1
+        power = max(0.0, s1 * s1 + s2 * s2 - coeff * s1 * s2)
+        q = (10.0 * math.log10(power + 1.0) - SOUND_DB_FLOOR) * 255.0 / SOUND_DB_RANGE
+        bands.append(0 if q <= 0 else min(255, int(q)))
+    return bands
+
+def synth_tones(rng, t, tones):
+    """tones: [(freq, amplitude)]; one block starting at time t."""
+    block = []
+    for i in range(SOUND_BLOCK):
+        ti = t + i / SOUND_SAMPLE_RATE
+        block.append(sum(a * math.sin(2 * math.pi * f * ti + p) for f, a, p in tones))
+    return block
+
+def synth_speech_tones(rng, t, level, pause_p, state):
+    # Syllables at 3-6 Hz with pauses; harmonics of a gliding f0 shaped by
+    # three formants that move per syllable
+    syllable = int(t * state['rate'])
+    if syllable != state.get('syllable'):
+        state['syllable'] = syllable
+        state['voiced'] = rng.random() > pause_p
+        state['formants'] = (rng.uniform(300, 900), rng.uniform(900, 2400), rng.uniform(2400, 3400))
+        state['f0'] = state['base_f0'] * rng.uniform(0.85, 1.2)
+    if not state['voiced']:
+        return []
+    env = max(0.0, math.sin(math.pi * ((t * state['rate']) % 1.0)))
+    f0 = state['f0']
+    tones = []
+    for k in range(1, int(3500 / f0)):
+        f = k * f0
+        gain = sum(math.exp(-((f - F) / 180.0) ** 2) for F in state['formants']) + 0.05
+        tones.append((f, level * env * gain / k ** 0.5, rng.uniform(0, 2 * math.pi)))
+    return tones
+
+def synth_music_tones(rng, t, level, state):
+    step = int(t / state['note_len'])
+    if step != state.get('step'):
+        state['step'] = step
+        root = rng.randint(45, 72)
+        state['chord'] = [440.0 * 2 ** ((root + i - 69) / 12) for i in rng.sample([0, 3, 4, 7, 10, 12, 16], rng.randint(2, 4))]
+    tones = []
+    for f in state['chord']:
+        for k in range(1, 6):
+            if f * k < 3600:
+                tones.append((f * k, level * 0.6 / k, rng.uniform(0, 2 * math.pi)))
+    return tones
+
+def synth_scene(label, rng):
+    level = math.exp(rng.uniform(math.log(30), math.log(600)))
+    noise = math.exp(rng.uniform(math.log(1), math.log(8)))
+    t0 = rng.uniform(0, 100)
+    speech = {'rate': rng.uniform(3, 6), 'base_f0': rng.uniform(90, 260)}
+    music = {'note_len': rng.uniform(0.25, 0.8)}
+    hum_f = rng.choice((50.0, 60.0))
+    whine_f = rng.uniform(150, 1500)
+    fan = rng.uniform(0.5, 4.0)
+    alarm_f = rng.uniform(1800, 3600)
+    alarm_period = rng.uniform(0.2, 1.2)
+    siren = rng.random() < 0.3
+    frames = []
+    lowpass = 0.0
+    for k in range(SOUND_FRAMES):
+        t = t0 + k * 0.1 + rng.uniform(0, 0.01)
+        if label == 'silence':
+            tones = []
+        elif label == 'speech':
+            tones = synth_speech_tones(rng, t, level, 0.3, speech)
+        elif label == 'music':
+            tones = synth_music_tones(rng, t, level, music)
+            drum = level * 0.3 if rng.random() < 0.3 else 0.0
+        elif label == 'tv':
+            tones = (synth_speech_tones(rng, t, level, 0.1, speech)
+                     + [(f, a * 0.4, p) for f, a, p in synth_music_tones(rng, t, level, music)])
+        elif label == 'appliance':
+            tones = [(hum_f * h, level * 0.5 / h, 0.0) for h in range(2, 8)]
+            tones.append((whine_f, level * 0.3, 0.0))
+        else:
+            if siren:
+                f = 900 + 500 * math.sin(2 * math.pi * t / alarm_period)
+                tones = [(f, level * 2, 0.0), (2 * f, level * 0.6, 0.0)]
+            else:
+                on = (t % alarm_period) < alarm_period / 2
+                tones = [(alarm_f, level * 2, 0.0), (alarm_f * 2, level * 0.5, 0.0)] if on else []
+        block = synth_tones(rng, t, tones)
+        for i in range(SOUND_BLOCK):
+            x = rng.gauss(0, noise)
+            if label == 'appliance':
+                # Fan: low-passed broadband noise
+                lowpass += 0.3 * (rng.gauss(0, level * fan * 0.2) - lowpass)
+                x += lowpass
+            elif label == 'music' and drum:
+                x += rng.gauss(0, drum)
+            block[i] += 1900 + x
+        frames.append(goertzel_bands(block))
+    return frames
+
+# ---- Training and int8 quantisation ----
+
+def sound_inputs(feats):
+    return [(f - 128) / 128.0 for f in feats]
+
+def mlp_forward(layers, x):
+    acts = [x]
+    for i, (w, b) in enumerate(layers):
+        y = [bi + sum(map(operator.mul, row, acts[-1])) for row, bi in zip(w, b)]
+        if i < len(layers) - 1:
+            y = [v if v > 0 else 0.0 for v in y]
+        acts.append(y)
+    return acts
+
+def train_sound_mlp(examples, epochs, rng, lr=0.02):
+    sizes = (2 * SOUND_BANDS,) + SOUND_HIDDEN + (len(SOUND_CLASSES),)
+    layers = []
+    for n_in, n_out in zip(sizes, sizes[1:]):
+        scale = math.sqrt(2.0 / n_in)
+        layers.append(([[rng.gauss(0, scale) for _ in range(n_in)] for _ in range(n_out)], [0.0] * n_out))
+    data = [(sound_inputs(f), c) for f, c in examples]
+    for epoch in range(epochs):
+        rng.shuffle(data)
+        rate = lr * (1.0 - epoch / epochs) + lr * 0.05
+        for x, c in data:
+            acts = mlp_forward(layers, x)
+            out = acts[-1]
+            top = max(out)
+            exps = [math.exp(v - top) for v in out]
+            total = sum(exps)
+            grad = [e / total for e in exps]
+            grad[c] -= 1.0
+            for i in range(len(layers) - 1, -1, -1):
+                w, b = layers[i]
+                inp = acts[i]
+                if i:
+                    back = [0.0] * len(inp)
+                    for row, g in zip(w, grad):
+                        if g:
+                            for j, wj in enumerate(row):
+                                back[j] += wj * g
+                    back = [g if a > 0 else 0.0 for g, a in zip(back, inp)]
+                for o, g in enumerate(grad):
+                    if g:
+                        step = rate * g
+                        w[o] = [wj - step * xj for wj, xj in zip(w[o], inp)]
+                        b[o] -= step
+                if i:
+                    grad = back
+    return layers
+
+def fixed_multiplier(m):
+    """m as (mult, shift) with mult in [2^30, 2^31): m ~= mult / 2^shift."""
+    shift = 0
+    while m * (1 << shift) < (1 << 30):
+        shift += 1
+    return int(round(m * (1 << shift))), shift
+
+def quantize_sound_mlp(layers, examples):
+    # Calibrate each hidden layer's activation range on the training set
+    act_max = [0.0] * len(SOUND_HIDDEN)
+    for feats, _ in examples:
+        acts = mlp_forward(layers, sound_inputs(feats))
+        for i in range(len(SOUND_HIDDEN)):
+            act_max[i] = max(act_max[i], max(acts[i + 1]))
+    in_scale = 1.0 / 128
+    quant = []
+    for i, (w, b) in enumerate(layers):
+        w_scale = max(abs(v) for row in w for v in row) / 127 or 1.0
+        acc_scale = w_scale * in_scale
+        layer = {'w': [max(-127, min(127, int(round(v / w_scale)))) for row in w for v in row],
+                 'b': [int(round(v / acc_scale)) for v in b], 'inputs': len(w[0])}
+        if i < len(SOUND_HIDDEN):
+            out_scale = (act_max[i] or 1.0) / 127
+            layer['mult'], layer['shift'] = fixed_multiplier(acc_scale / out_scale)
+            in_scale = out_scale
+        quant.append(layer)
+    return quant
+
+def sound_infer_int8(quant, feats):
+    """Integer inference exactly as on the node; returns int32 logits."""
+    x = [f - 128 for f in feats]
+    for layer in quant:
+        n = layer['inputs']
+        w = layer['w']
+        acc = [bias + sum(map(operator.mul, w[o * n:(o + 1) * n], x)) for o, bias in enumerate(layer['b'])]
+        if 'mult' not in layer:
+            return acc
+        mult, shift = layer['mult'], layer['shift']
+        x = [max(0, min(127, (a * mult + (1 << (shift - 1))) >> shift)) for a in acc]
+
+def sound_accuracy(predict, examples):
+    if not examples:
+        return None
+    hits = sum(1 for feats, c in examples if max(range(len(SOUND_CLASSES)), key=predict(feats).__getitem__) == c)
+    return hits / len(examples)
+
+def c_array(ctype, name, values, per_line=16):
+    lines = [', '.join(str(v) for v in values[i:i + per_line]) for i in range(0, len(values), per_line)]
+    return f"static const {ctype} {name}[{len(values)}] = {{\n  " + ',\n  '.join(lines) + "\n};\n"
+
+def write_sound_model(path, quant, note, captured_s):
+    out = ["// Generated by `python3 homepod_server_v3.py train-sound`; do not edit.",
+           f"// {note}",
+           "#ifndef SOUND_MODEL_H", "#define SOUND_MODEL_H", "",
+           f'#define SOUND_MODEL_INFO "{note}"',
+           f"#define SOUND_MODEL_CAPTURED_S {captured_s}",
+           f"#define SOUND_FEATURES {2 * SOUND_BANDS}"]
+    out += [f"#define SOUND_HIDDEN{i + 1} {n}" for i, n in enumerate(SOUND_HIDDEN)]
+    out += [f"#define SOUND_CLASSES {len(SOUND_CLASSES)}",
+            "",
+            "static const char *const SOUND_CLASS_NAMES[SOUND_CLASSES] = {"
+            + ', '.join(f'"{c}"' for c in SOUND_CLASSES) + "};", ""]
+    for i, layer in enumerate(quant, 1):
+        out.append(c_array('int8_t', f'SOUND_W{i}', layer['w']))
+        out.append(c_array('int32_t', f'SOUND_B{i}', layer['b']))
+        if 'mult' in layer:
+            out.append(f"static const int32_t SOUND_M{i} = {layer['mult']};")
+            out.append(f"static const int SOUND_S{i} = {layer['shift']};\n")
+    out.append("#endif")
+    with open(path, 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+def train_sound_main(argv):
+    parser = argparse.ArgumentParser(prog='homepod_server_v3.py train-sound',
+                                     description='Train the int8 sound scene model for the mic nodes')
+    parser.add_argument('--captures', default=SOUND_CAPTURE_FILE, help='labelled captures (JSON lines)')
+    parser.add_argument('--synthetic', type=int, default=150, help='synthetic seconds per class (0 = captures only)')
+    parser.add_argument('--epochs', type=int, default=25)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--output', '-o', action='append', help='header to write (repeatable; default sound_model.h)')
+    args = parser.parse_args(argv)
+    rng = random.Random(args.seed)
+
+    captured = load_sound_captures(args.captures)
+    synthetic = [(sound_features(synth_scene(c, rng)), i)
+                 for i, c in enumerate(SOUND_CLASSES) for _ in range(args.synthetic)]
+    examples = captured + synthetic
+    if not examples:
+        parser.error(f"no training data: record captures into {args.captures} or use --synthetic")
+    rng.shuffle(examples)
+    held = examples[:len(examples) // 5]
+    train = examples[len(examples) // 5:]
+    print(f"Training on {len(train)} seconds ({len(captured)} captured), holding out {len(held)}")
+
+    layers = train_sound_mlp(train, args.epochs, rng)
+    quant = quantize_sound_mlp(layers, train)
+    float_acc = sound_accuracy(lambda f: mlp_forward(layers, sound_inputs(f))[-1], held)
+    int8_acc = sound_accuracy(lambda f: sound_infer_int8(quant, f), held)
+    print(f"Held-out accuracy: float {float_acc:.1%}, int8 {int8_acc:.1%}")
+    weights = sum(len(layer['w']) + 4 * len(layer['b']) for layer in quant)
+    print(f"Model: {weights} bytes of weights")
+
+    note = (f"{datetime.now().strftime('%Y-%m-%d')}, {len(captured)} captured + {len(synthetic)} synthetic s, "
+            f"held-out int8 accuracy {int8_acc:.0%}")
+    for path in args.output or ['sound_model.h']:
+        write_sound_model(path, quant, note, len(captured))
+        print(f"Wrote {path}")
+
+# ============================================
+# NOISE LOCALIZATION
+# ============================================
+# Mic nodes keep their clocks within a few ms of the server's (NTP-style
+# exchanges over the control link; the lowest round trip of the last six
+# probes wins) and watch a 1 kHz loudness envelope. When the level jumps
+# well over the background they send an onset: its time on the server
+# clock, the peak and background level, and 320 ms of 10 ms envelope bins
+# (no audio). Onsets from different nodes that land within NOISE_WINDOW_MS
+# and have similar envelopes are one event. An event is settled once every
+# connected mic node has answered or NOISE_SETTLE_S has passed. The source
+# is the room of the node that heard it loudest above its own background;
+# the onset order gives the path.
+NOISE_WINDOW_MS = 60          # sound crosses the house in ~30 ms, plus sync error
+NOISE_SETTLE_S = 0.4          # after the first onset arrives
+NOISE_MIN_CORRELATION = 0.5   # envelope shape similarity to join an event
+NOISE_CLEAR_MARGIN_DB = 3.0   # loudest must beat the next room by this much
+NOISE_HISTORY = 100
+NOISE_MIC_DEVICES = ('HomePOD_Env_Node', 'HomePOD_Env_Node_2')
+
+noise_lock = threading.Lock()
+noise_pending = []    # open events: {'t_us', 'onsets': {device: onset}, 'timer'}
+noise_events = deque(maxlen=NOISE_HISTORY)
+noise_stats = {'onsets': 0, 'events': 0, 'unsynced': 0}
+
+def level_db(level):
+    return 20.0 * math.log10(max(level, 1.0))
+
+def envelope_correlation(a, b):
+    n = min(len(a), len(b))
+    if n < 3:
+        return 1.0
+    a = [level_db(v) for v in a[:n]]
+    b = [level_db(v) for v in b[:n]]
+    ma, mb = sum(a) / n, sum(b) / n
+    cov = sum((x - ma) * (y - mb) for x, y in zip(a, b))
+    va = sum((x - ma) ** 2 for x in a)
+    vb = sum((y - mb) ** 2 for y in b)
+    if va == 0 or vb == 0:
+        return 1.0
+    return cov / math.sqrt(va * vb)
+
+def parse_onset(device_name, message):
+    onset_us = message.get('onset_us')
+    level = message.get('level')
+    if not isinstance(onset_us, int) or not isinstance(level, (int, float)):
+        return None
+    background = message.get('background')
+    envelope = message.get('envelope')
+    return {'device_name': device_name, 'onset_us': onset_us, 'level': float(level),
+            'background': float(background) if isinstance(background, (int, float)) else 0.0,
+            'envelope': [v for v in envelope if isinstance(v, (int, float))] if isinstance(envelope, list) else [],
+            'sync_rtt_us': message.get('sync_rtt_us')}
+
+def add_noise_onset(device_name, message):
+    """Fold one node's onset into an open event, or open a new one."""
+    onset = parse_onset(device_name, message)
+    if onset is None:
+        return
+    if not message.get('synced'):
+        # Without a shared clock its onset time can't be compared
+        noise_stats['unsynced'] += 1
+        return
+    noise_stats['onsets'] += 1
+    with noise_lock:
+        for event in noise_pending:
+            first = next(iter(event['onsets'].values()))
+            if (device_name not in event['onsets']
+                    and abs(onset['onset_us'] - event['t_us']) <= NOISE_WINDOW_MS * 1000
+                    and envelope_correlation(first['envelope'], onset['envelope']) >= NOISE_MIN_CORRELATION):
+                event['onsets'][device_name] = onset
+                event['t_us'] = min(event['t_us'], onset['onset_us'])
+                break
+        else:
+            event = {'t_us': onset['onset_us'], 'onsets': {device_name: onset}}
+            event['timer'] = threading.Timer(NOISE_SETTLE_S, settle_noise_event, [event])
+            event['timer'].daemon = True
+            noise_pending.append(event)
+            event['timer'].start()
+        with control_lock:
+            listening = [d for d in NOISE_MIC_DEVICES if d in control_links]
+        event['listening'] = len(listening)
+        complete = all(d in event['onsets'] for d in listening)
+    if complete:
+        event['timer'].cancel()
+        settle_noise_event(event)
+
+def settle_noise_event(event):
+    with noise_lock:
+        if event not in noise_pending:
+            return
+        noise_pending.remove(event)
+    onsets = sorted(event['onsets'].values(), key=lambda o: o['onset_us'])
+    first_us = onsets[0]['onset_us']
+    path = []
+    for onset in onsets:
+        path.append({'device_name': onset['device_name'],
+                     'room': device_registry.device_room.get(onset['device_name']),
+                     'delay_ms': round((onset['onset_us'] - first_us) / 1000, 1),
+                     'level_db': round(level_db(onset['level']), 1),
+                     'snr_db': round(level_db(onset['level']) - level_db(onset['background']), 1)})
+    by_snr = sorted(path, key=lambda p: p['snr_db'], reverse=True)
+    source = by_snr[0]
+    margin = source['snr_db'] - by_snr[1]['snr_db'] if len(by_snr) > 1 else None
+    # Agreeing cues (loudest and heard first) make a confident call. If only
+    # one of several listening nodes heard it, the others didn't even cross
+    # their threshold; with one node listening there is nothing to compare.
+    if margin is None:
+        confidence = 'high' if event.get('listening', 1) > 1 else 'low'
+    elif margin >= NOISE_CLEAR_MARGIN_DB and source is path[0]:
+        confidence = 'high'
+    elif margin >= NOISE_CLEAR_MARGIN_DB or source is path[0]:
+        confidence = 'medium'
+    else:
+        confidence = 'low'
+    result = {'time': format_timestamp(first_us / 1e6),
+              'source_room': source['room'], 'source_device': source['device_name'],
+              'confidence': confidence, 'margin_db': None if margin is None else round(margin, 1),
+              'path': path,
+              'latency_ms': round(time.time() * 1000 - first_us / 1000)}
+    noise_events.append(result)
+    noise_stats['events'] += 1
+    event_hub.publish('noise', result)
+
+# ============================================
+# TIMER SCHEDULER
+# ============================================
+# Timers run on the server: each running timer has an absolute deadline and
+# sits in a hierarchical timing wheel (4 levels of 64 one-second slots, so
+# about 194 days of range). Scheduling, cancelling and each tick are O(1);
+# timers far in the future are cascaded down a level as their slot comes up.
+# Running timers are persisted with their deadline and re-armed on startup.
+WHEEL_BITS = 6
+WHEEL_SLOTS = 1 << WHEEL_BITS
+WHEEL_LEVELS = 4
+TIMER_BUZZER_DEVICES = []   # node names that should buzz when a timer expires
+
+class TimingWheel:
+    def __init__(self, tick):
+        self.tick = tick
+        self.wheels = [[set() for _ in range(WHEEL_SLOTS)] for _ in range(WHEEL_LEVELS)]
+        self.where = {}       # key -> (level, slot)
+        self.deadlines = {}   # key -> deadline tick
+
+    def _place(self, key, deadline):
+        delta = deadline - self.tick
+        level = 0
+        while level < WHEEL_LEVELS - 1 and delta >= 1 << (WHEEL_BITS * (level + 1)):
+            level += 1
+        slot = (deadline >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)
+        self.wheels[level][slot].add(key)
+        self.where[key] = (level, slot)
+
+    def schedule(self, key, deadline):
+        self.cancel(key)
+        deadline = max(deadline, self.tick + 1)
+        self.deadlines[key] = deadline
+        self._place(key, deadline)
+
+    def cancel(self, key):
+        loc = self.where.pop(key, None)
+        if loc is not None:
+            self.wheels[loc[0]][loc[1]].discard(key)
+            del self.deadlines[key]
+
+    def advance(self, to_tick):
+        """Move time forward to to_tick and return the keys that expired."""
+        expired = []
+        while self.tick < to_tick:
+            self.tick += 1
+            for level in range(1, WHEEL_LEVELS):
+                if self.tick & ((1 << (WHEEL_BITS * level)) - 1):
+                    break
+                slot = (self.tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)
+                keys = self.wheels[level][slot]
+                self.wheels[level][slot] = set()
+                for key in keys:
+                    self._place(key, self.deadlines[key])
+            slot = self.tick & (WHEEL_SLOTS - 1)
+            keys = self.wheels[0][slot]
+            if not keys:
+                continue
+            self.wheels[0][slot] = set()
+            for key in keys:
+                if self.deadlines[key] <= self.tick:
+                    del self.where[key]
+                    del self.deadlines[key]
+                    expired.append(key)
+                else:
+                    self._place(key, self.deadlines[key])
+        return expired
+
+timers_lock = threading.Lock()
+timer_wheel = TimingWheel(int(time.time()))
+
+def timer_remaining(timer, now=None):
+    if timer.get('running') and timer.get('deadline'):
+        return max(0.0, timer['deadline'] - (now or time.time()))
+    return timer.get('remaining', timer['duration'])
+
+def arm_timer(timer):
+    timer_wheel.schedule(timer['id'], math.ceil(timer['deadline']))
+
+def fire_timer(timer):
+    timer['running'] = False
+    timer['finished'] = True
+    timer['remaining'] = 0
+    timer['deadline'] = None
+    event_hub.publish('timer', {'type': 'expired', 'id': timer['id'], 'name': timer['name']})
+    if not replica_following():    # the primary buzzes its own nodes
+        for device_name in TIMER_BUZZER_DEVICES:
+            send_command(device_name, 'buzz', {'timer': timer['name']})
+    print(f"Timer finished: {timer['name']}")
+
+def run_timer_scheduler():
+    while True:
+        time.sleep(1.0 - (time.time() % 1.0))
+        with timers_lock:
+            expired = timer_wheel.advance(int(time.time()))
+            if not expired:
+                continue
+            expired = set(expired)
+            for timer in timers_list:
+                if timer['id'] in expired:
+                    fire_timer(timer)
+            save_timers(timers_list)
+
+def start_timer_scheduler():
+    """Re-arm timers that were running before a restart and start ticking."""
+    with timers_lock:
+        for timer in timers_list:
+            if timer.get('running') and timer.get('deadline'):
+                arm_timer(timer)
+    threading.Thread(target=run_timer_scheduler, daemon=True).start()
+
+# ============================================
+# NODE CONTROL CHANNEL
+# ============================================
+# Each node holds one WebSocket open to CONTROL_WS_PORT. Reports travel up
+# it and are acked with the same reply /sensor-data gives; commands travel
+# down it the moment they are issued, tagged with an id the node echoes in
+# its result, so a round trip is one LAN hop instead of a report interval.
+# A node that reconnects resends its unacked reports and ingest dedup drops
+# the ones that already landed. Nodes without a live link still get their
+# commands piggybacked on the next /sensor-data reply.
+CONTROL_WS_PORT = 5002
+CONTROL_WS_PATH = '/ws'
+CONTROL_MAX_MESSAGE = 64 * 1024
+CONTROL_IDLE_TIMEOUT = 60        # seconds; nodes ping every 15 s
+CONTROL_COMMAND_TIMEOUT = 2.0    # seconds an API caller waits for a result
+CONTROL_MAX_AGE_MS = 10 * 60 * 1000  # older resent reports are acked and dropped
+WS_GUID = b'258EAFA5-E914-47DA-95CA-C5AB0DC85B11'
+WS_TEXT, WS_CLOSE, WS_PING, WS_PONG = 0x1, 0x8, 0x9, 0xA
+
+control_lock = threading.Lock()  # guards control_links, pending_commands and command ids
+control_links = {}               # device_name -> ControlLink
+pending_commands = {}            # device_name -> [command, ...] for nodes without a link
+control_stats = {'connections': 0, 'reports': 0, 'expired': 0, 'commands': 0, 'results': 0,
+                 'timeouts': 0, 'rtt_ms_total': 0.0}
+next_command_id = 1
+
+class ControlLink:
+    """Server end of one node's WebSocket (RFC 6455, text frames only)."""
+
+    def __init__(self, sock, address):
+        self.sock = sock
+        self.address = address
+        self.device_name = None
+        self.send_lock = threading.Lock()
+        self.waiting = {}   # command id -> [Event, result message, sent at]
+
+    def recv_exact(self, n):
+        buf = bytearray()
+        while len(buf) < n:
+            chunk = self.sock.recv(n - len(buf))
+            if not chunk:
+                raise ConnectionError('control link closed')
+            buf += chunk
+        return bytes(buf)
+
+    def handshake(self):
+        request_bytes = b''
+        while b'\r\n\r\n' not in request_bytes:
+            chunk = self.sock.recv(1024)
+            if not chunk or len(request_bytes) > 8192:
+                return False
+            request_bytes += chunk
+        lines = request_bytes.split(b'\r\n\r\n', 1)[0].decode('latin-1').split('\r\n')
+        request_line = lines[0].split()
+        headers = {}
+        for line in lines[1:]:
+            name, _, value = line.partition(':')
+            headers[name.strip().lower()] = value.strip()
+        key = headers.get('sec-websocket-key')
+        if len(request_line) < 2 or request_line[1] != CONTROL_WS_PATH or not key:
+            self.sock.sendall(b'HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n')
+            return False
+        accept = base64.b64encode(hashlib.sha1(key.encode() + WS_GUID).digest()).decode()
+        self.sock.sendall(('HTTP/1.1 101 Switching Protocols\r\n'
+                           'Upgrade: websocket\r\nConnection: Upgrade\r\n'
+                           f'Sec-WebSocket-Accept: {accept}\r\n\r\n').encode())
+        return True
+
+    def send_frame(self, opcode, payload=b''):
+        n = len(payload)
+        if n < 126:
+            header = struct.pack('!BB', 0x80 | opcode, n)
+        elif n < 65536:
+            header = struct.pack('!BBH', 0x80 | opcode, 126, n)
+        else:
+            header = struct.pack('!BBQ', 0x80 | opcode, 127, n)
+        with self.send_lock:
+            self.sock.sendall(header + payload)
+
+    def send_json(self, message):
+        self.send_frame(WS_TEXT, json.dumps(message, separators=(',', ':')).encode())
+
+    def recv_message(self):
+        """Next whole message as (opcode, payload). Pings are answered here;
+        fragments are joined."""
+        opcode = None
+        data = b''
+        while True:
+            b1, b2 = self.recv_exact(2)
+            frame_opcode = b1 & 0x0F
+            n = b2 & 0x7F
+            if n == 126:
+                n = struct.unpack('!H', self.recv_exact(2))[0]
+            elif n == 127:
+                n = struct.unpack('!Q', self.recv_exact(8))[0]
+            if len(data) + n > CONTROL_MAX_MESSAGE:
+                raise ValueError('control message too large')
+            mask = self.recv_exact(4) if b2 & 0x80 else None
+            payload = self.recv_exact(n)
+            if mask and n:
+                key = (mask * (n // 4 + 1))[:n]
+                payload = (int.from_bytes(payload, 'big') ^ int.from_bytes(key, 'big')).to_bytes(n, 'big')
+            if frame_opcode == WS_PING:
+                self.send_frame(WS_PONG, payload)
+                continue
+            if frame_opcode == WS_PONG:
+                continue
+            if frame_opcode == WS_CLOSE:
+                return WS_CLOSE, payload
+            if frame_opcode:
+                opcode = frame_opcode
+            data += payload
+            if b1 & 0x80:
+                return opcode, data
+
+    def close(self):
+        try:
+            self.sock.close()
+        except OSError:
+            pass
+
+def attach_control_link(link, device_name):
+    with control_lock:
+        previous = control_links.get(device_name)
+        control_links[device_name] = link
+        queued = pending_commands.pop(device_name, [])
+    link.device_name = device_name
+    if previous is not None and previous is not link:
+        previous.close()
+    for command in queued:
+        link.send_json(command)
+
+def handle_control_message(link, message):
+    kind = message.get('type')
+    if kind == 'hello' and message.get('device_name'):
+        attach_control_link(link, str(message['device_name']))
+        link.send_json({'type': 'hello', 'time': int(time.time())})
+    elif kind == 'report' and isinstance(message.get('data'), dict):
+        data = message['data']
+        age = message.get('age_ms')
+        age = age / 1000 if isinstance(age, (int, float)) and age > 0 else 0.0
+        if age * 1000 > CONTROL_MAX_AGE_MS:
+            # Too old to place reliably; ack it so the node lets go of it
+            control_stats['expired'] += 1
+            reply, code = {'status': 'expired', 'device_name': data.get('device_name'),
+                           'seq': data.get('seq')}, 200
+        else:
+            reply, code = ingest_report(data, link.address[0], age)
+        control_stats['reports'] += 1
+        link.send_json({'type': 'ack', 'seq': data.get('seq'), 'code': code, 'reply': reply})
+    elif kind == 'clock':
+        # NTP-style: the node halves the round trip to get its offset
+        link.send_json({'type': 'clock', 't0': message.get('t0'), 'server_us': int(time.time() * 1e6)})
+    elif kind == 'onset' and link.device_name:
+        add_noise_onset(link.device_name, message)
+    elif kind == 'result':
+        waiter = link.waiting.get(message.get('id'))
+        if waiter:
+            waiter[1] = message
+            waiter[0].set()
+
+def run_control_link(sock, address):
+    link = ControlLink(sock, address)
+    try:
+        sock.settimeout(CONTROL_IDLE_TIMEOUT)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        if not link.handshake():
+            return
+        control_stats['connections'] += 1
+        while True:
+            opcode, payload = link.recv_message()
+            if opcode == WS_CLOSE:
+                link.send_frame(WS_CLOSE, payload[:2])
+                break
+            if opcode != WS_TEXT:
+                continue
+            try:
+                message = json.loads(payload)
+            except ValueError:
+                continue
+            if not isinstance(message, dict):
+                continue
+            try:
+                handle_control_message(link, message)
+            except OSError:
+                raise    # the socket itself failed
+            except Exception as e:
+                # A malformed message must not drop the link and stall every
+                # report buffered behind it; a bad report is acked like a 500
+                print(f"Control message from {link.device_name or link.address[0]} failed: {e}")
+                if message.get('type') == 'report':
+                    data = message.get('data')
+                    link.send_json({'type': 'ack', 'seq': data.get('seq') if isinstance(data, dict) else None,
+                                    'code': 500, 'reply': {'status': 'error', 'message': str(e)}})
+    except (OSError, ValueError):
+        pass
+    finally:
+        with control_lock:
+            if link.device_name and control_links.get(link.device_name) is link:
+                del control_links[link.device_name]
+        for waiter in list(link.waiting.values()):
+            waiter[0].set()
+        link.close()
+
+def send_command(device_name, command, args=None, wait=None):
+    """Push a command to a node, or queue it for the node's next report.
+    With wait (seconds), block until the node's result comes back."""
+    global next_command_id
+    with control_lock:
+        message = {'type': 'command', 'id': next_command_id, 'command': command,
+                   'args': args or {}}
+        next_command_id += 1
+        link = control_links.get(device_name)
+        if link is None:
+            pending_commands.setdefault(device_name, []).append(message)
+            return {'id': message['id'], 'status': 'queued'}
+    control_stats['commands'] += 1
+    waiter = [threading.Event(), None, time.monotonic()]
+    if wait:
+        link.waiting[message['id']] = waiter
+    try:
+        link.send_json(message)
+    except OSError:
+        link.waiting.pop(message['id'], None)
+        with control_lock:
+            pending_commands.setdefault(device_name, []).append(message)
+        return {'id': message['id'], 'status': 'queued'}
+    if not wait:
+        return {'id': message['id'], 'status': 'sent'}
+    waiter[0].wait(wait)
+    link.waiting.pop(message['id'], None)
+    result = waiter[1]
+    if result is None:
+        control_stats['timeouts'] += 1
+        return {'id': message['id'], 'status': 'timeout'}
+    rtt_ms = (time.monotonic() - waiter[2]) * 1000
+    control_stats['results'] += 1
+    control_stats['rtt_ms_total'] += rtt_ms
+    return {'id': message['id'], 'status': 'ok' if result.get('ok') else 'error',
+            'rtt_ms': round(rtt_ms, 1), 'result': result.get('result', {}),
+            'error': result.get('error')}
+
+def control_summary():
+    with control_lock:
+        connected = sorted(control_links)
+        queued = {name: len(commands) for name, commands in pending_commands.items() if commands}
+    results = control_stats['results']
+    return {'port': CONTROL_WS_PORT, 'connected': connected, 'queued': queued,
+            'avg_rtt_ms': round(control_stats['rtt_ms_total'] / results, 1) if results else None,
+            **{k: v for k, v in control_stats.items() if k != 'rtt_ms_total'}}
+
+def run_control_listener():
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('0.0.0.0', CONTROL_WS_PORT))
+    server.listen(16)
+    while True:
+        sock, address = server.accept()
+        threading.Thread(target=run_control_link, args=(sock, address), daemon=True).start()
+
+def start_control_listener():
+    threading.Thread(target=run_control_listener, daemon=True).start()
+
 # ============================================
 # MUSIC QUEUE STORAGE
 # ============================================
@@ -96,6 +1174,7 @@ def load_music_queue():
     return {'queue': [], 'current_index': 0, 'is_playing': False}
 
 def save_music_queue(music_data):
+    data_versions['music'] += 1
     with open(MUSIC_FILE, 'w') as f:
         json.dump(music_data, f)
 
@@ -192,12 +1271,1936 @@ weather_cache = {
 WEATHER_CACHE_DURATION = 600  # 10 minutes
 
 # ============================================
-# ROOM CONFIGURATION
+# DEVICE REGISTRY
 # ============================================
-ROOM_CONFIG = {
+# Device -> room assignments live in DEVICES_FILE. Unknown devices register
+# themselves (unassigned) on first report and are placed in a room from the
+# Devices page or /api/devices. The file is re-read when it changes on disk,
+# so hand edits also apply without a restart.
+DEFAULT_ROOM_CONFIG = {
     "Bedroom": ["HomePOD_Env_Node", "HomePOD_Light_Node"],
     "Living Room": ["HomePOD_Env_Node_2"],
 }
+REGISTRY_RELOAD_CHECK = 1.0  # seconds between mtime checks
+
+class DeviceRegistry:
+    def __init__(self, path):
+        self.path = path
+        self.lock = threading.Lock()
+        self.devices = {}
+        self.device_room = {}
+        self.room_devices = {}
+        self.version = 0
+        self.mtime = None
+        self.last_check = 0
+        self.unreadable = False   # file on disk failed to parse; don't overwrite it
+        self.load()
+
+    def load(self):
+        if os.path.exists(self.path):
+            try:
+                self.mtime = os.path.getmtime(self.path)
+                with open(self.path, 'r') as f:
+                    devices = json.load(f)
+                if not isinstance(devices, dict):
+                    raise ValueError('not a JSON object')
+            except (OSError, ValueError) as e:
+                # Keep the devices in memory; a typo in a hand edit must not
+                # wipe every assignment. Fixing the file reloads it.
+                print(f"Device registry {self.path} not loaded: {e}")
+                self.unreadable = True
+                return
+            self.unreadable = False
+            self.devices = devices
+        else:
+            self.devices = {}
+            for room, device_list in DEFAULT_ROOM_CONFIG.items():
+                for device_name in device_list:
+                    self.devices[device_name] = {'room': room, 'first_seen': None}
+            self.save()
+        self.reindex()
+
+    def save(self):
+        if self.unreadable:
+            print(f"Device registry {self.path} is unreadable; fix it to save changes")
+            return
+        tmp_path = self.path + '.tmp'
+        with open(tmp_path, 'w') as f:
+            json.dump(self.devices, f, indent=2)
+        os.replace(tmp_path, self.path)
+        self.mtime = os.path.getmtime(self.path)
+
+    def reindex(self):
+        device_room = {}
+        room_devices = {}
+        for device_name, info in self.devices.items():
+            room = info.get('room')
+            device_room[device_name] = room
+            if room:
+                room_devices.setdefault(room, []).append(device_name)
+        # Swap whole dicts so readers never see a half-built index
+        self.device_room = device_room
+        self.room_devices = room_devices
+        self.version += 1
+
+    def refresh(self):
+        """Pick up external edits to the registry file."""
+        now = time.monotonic()
+        if now - self.last_check < REGISTRY_RELOAD_CHECK:
+            return
+        self.last_check = now
+        try:
+            mtime = os.path.getmtime(self.path)
+        except OSError:
+            return
+        if mtime != self.mtime:
+            with self.lock:
+                self.load()
+
+    def register(self, device_name):
+        """Add a device on first report. Returns True if it was new."""
+        if device_name in self.device_room:
+            return False
+        with self.lock:
+            if device_name in self.devices:
+                return False
+            self.devices[device_name] = {
+                'room': None,
+                'first_seen': datetime.now().strftime('%Y-%m-%d %H:%M:%S')
+            }
+            self.save()
+            self.reindex()
+        print(f"New device registered: {device_name}")
+        return True
+
+    def assign(self, device_name, room):
+        room = (room or '').strip() or None
+        with self.lock:
+            if device_name not in self.devices:
+                return False
+            self.devices[device_name]['room'] = room
+            self.save()
+            self.reindex()
+        return True
+
+    def update_info(self, device_name, **fields):
+        """Store node-reported metadata; the file is rewritten only on change."""
+        with self.lock:
+            info = self.devices.get(device_name)
+            if info is None:
+                return False
+            changed = {k: v for k, v in fields.items() if info.get(k) != v}
+            if not changed:
+                return False
+            info.update(changed)
+            self.save()
+        return True
+
+    def remove(self, device_name):
+        with self.lock:
+            if self.devices.pop(device_name, None) is None:
+                return False
+            self.save()
+            self.reindex()
+        return True
+
+device_registry = DeviceRegistry(DEVICES_FILE)
+
+# ============================================
+# LATEST STATE STORE
+# ============================================
+# Latest value of every channel for every device, kept column-wise: devices
+# and channels are interned to small integer IDs and each channel is a
+# fixed-width array indexed by device ID. Status fields are stored as
+# "status.<name>" channels, nested ones as "status.<name>.<key>".
+# Non-numeric values are dropped.
+INT_MISSING = -(1 << 63)
+CHANNEL_TYPES = {
+    'audio_level': 'q',
+    'audio_peak': 'q',
+    'status.wifi_rssi': 'q',
+    'status.uptime_ms': 'q',
+    'status.heap_free': 'q',
+    'status.heap_min': 'q',
+    'status.heap_largest': 'q',
+    'status.stack_min': 'q',
+    'status.uplink_tls': 'q',
+    'status.uplink_us': 'q',
+    'status.uplink_bytes': 'q',
+    'status.uplink_connects': 'q',
+    'status.sound_us': 'q',
+    'status.sound_frontend_us': 'q',
+    'status.sound_model_captured_s': 'q',
+    'status.on_replica': 'q',
+    'status.failovers': 'q',
+}
+CHANNEL_TYPE_PREFIXES = {
+    'status.stacks.': 'q',   # per-task stack high-water marks, bytes
+}
+
+def channel_type(channel):
+    """Array typecode for a channel: 'q' (int64) or 'd' (float64)."""
+    typecode = CHANNEL_TYPES.get(channel)
+    if typecode is not None:
+        return typecode
+    for prefix, typecode in CHANNEL_TYPE_PREFIXES.items():
+        if channel.startswith(prefix):
+            return typecode
+    return 'd'
+
+class LatestStateStore:
+    def __init__(self):
+        self.device_ids = {}
+        self.device_names = []
+        self.channel_ids = {}
+        self.channel_names = []
+        self.columns = []
+        self.received_at = array('d')   # epoch seconds, 0 = never
+        self.boot_id = array('q')
+        self.seq = array('q')
+
+    def intern_device(self, device_name):
+        dev_id = self.device_ids.get(device_name)
+        if dev_id is None:
+            dev_id = len(self.device_names)
+            self.device_ids[device_name] = dev_id
+            self.device_names.append(device_name)
+            for col in self.columns:
+                col.append(INT_MISSING if col.typecode == 'q' else math.nan)
+            self.received_at.append(0.0)
+            self.boot_id.append(INT_MISSING)
+            self.seq.append(INT_MISSING)
+        return dev_id
+
+    def intern_channel(self, channel):
+        ch_id = self.channel_ids.get(channel)
+        if ch_id is None:
+            ch_id = len(self.channel_names)
+            self.channel_ids[channel] = ch_id
+            self.channel_names.append(channel)
+            typecode = channel_type(channel)
+            fill = INT_MISSING if typecode == 'q' else math.nan
+            self.columns.append(array(typecode, [fill]) * len(self.device_names))
+        return ch_id
+
+    def _set(self, dev_id, channel, value):
+        """Stores a numeric value; returns its channel id, or None if skipped."""
+        if isinstance(value, bool) or not isinstance(value, (int, float)):
+            return None
+        ch_id = self.intern_channel(channel)
+        col = self.columns[ch_id]
+        col[dev_id] = int(value) if col.typecode == 'q' else float(value)
+        return ch_id
+
+    def update(self, device_name, data, received_at):
+        dev_id = self.intern_device(device_name)
+        present = set()
+        for key, value in (data.get('sensors') or {}).items():
+            present.add(self._set(dev_id, key, value))
+        for key, value in (data.get('status') or {}).items():
+            if isinstance(value, dict):
+                # Nested counters, e.g. status.stacks.<task>
+                for sub, v in value.items():
+                    present.add(self._set(dev_id, f'status.{key}.{sub}', v))
+            else:
+                present.add(self._set(dev_id, 'status.' + key, value))
+        # Each report is the device's full state: a channel it left out or
+        # sent as null (sensor unplugged, task gone) is no longer current
+        for ch_id, col in enumerate(self.columns):
+            if ch_id not in present:
+                col[dev_id] = INT_MISSING if col.typecode == 'q' else math.nan
+        self.received_at[dev_id] = received_at
+        if isinstance(data.get('boot_id'), int):
+            self.boot_id[dev_id] = data['boot_id']
+        if isinstance(data.get('seq'), int):
+            self.seq[dev_id] = data['seq']
+        return dev_id
+
+    def value(self, dev_id, ch_id):
+        """Direct column read; None if the device never reported the channel."""
+        v = self.columns[ch_id][dev_id]
+        if v == INT_MISSING or v != v:
+            return None
+        return v
+
+    def get(self, device_name, channel):
+        dev_id = self.device_ids.get(device_name)
+        ch_id = self.channel_ids.get(channel)
+        if dev_id is None or ch_id is None:
+            return None
+        return self.value(dev_id, ch_id)
+
+    def to_dict(self, dev_id):
+        """Rebuild the JSON shape nodes send, for the /latest API."""
+        sensors = {}
+        status = {}
+        for ch_id, channel in enumerate(self.channel_names):
+            v = self.value(dev_id, ch_id)
+            if v is None:
+                continue
+            if channel.startswith('status.'):
+                key, _, sub = channel[7:].partition('.')
+                if sub:
+                    status.setdefault(key, {})[sub] = v
+                else:
+                    status[key] = v
+            else:
+                sensors[channel] = v
+        entry = {
+            'device_name': self.device_names[dev_id],
+            'sensors': sensors,
+            'received_at': format_timestamp(self.received_at[dev_id])
+        }
+        if status:
+            entry['status'] = status
+        if self.seq[dev_id] != INT_MISSING:
+            entry['boot_id'] = self.boot_id[dev_id]
+            entry['seq'] = self.seq[dev_id]
+        return entry
+
+def format_timestamp(epoch):
+    return datetime.fromtimestamp(epoch).strftime('%Y-%m-%d %H:%M:%S')
+
+latest_state = LatestStateStore()
+
+# Nodes report heap and per-task stack high-water marks in "status"; these
+# are the levels at which the Devices page starts warning
+NODE_STACK_WARN = 512          # bytes of stack never used by some task
+NODE_STACK_WARN_SKIP = ('IDLE',)  # task name prefixes; idle tasks are tiny by design
+NODE_HEAP_WARN = 16 * 1024     # minimum-ever free heap
+NODE_BLOCK_WARN = 8 * 1024     # largest allocatable block (fragmentation)
+
+def memory_warnings(device_name):
+    warnings = []
+    dev_id = latest_state.device_ids.get(device_name)
+    if dev_id is None:
+        return warnings
+    for ch_id, channel in enumerate(latest_state.channel_names):
+        if channel.startswith('status.stacks.') and not channel[14:].startswith(NODE_STACK_WARN_SKIP):
+            left = latest_state.value(dev_id, ch_id)
+            if left is not None and left < NODE_STACK_WARN:
+                warnings.append(f"{channel[14:]} stack {int(left)} B left")
+    heap_min = latest_state.get(device_name, 'status.heap_min')
+    if heap_min is not None and heap_min < NODE_HEAP_WARN:
+        warnings.append(f"heap fell to {heap_min // 1024} KB")
+    largest = latest_state.get(device_name, 'status.heap_largest')
+    if largest is not None and largest < NODE_BLOCK_WARN:
+        warnings.append(f"largest free block {largest // 1024} KB")
+    return warnings
+
+# ============================================
+# INGEST DEDUPLICATION
+# ============================================
+# Nodes tag every report with (boot_id, seq) and resend the same pair when a
+# POST fails. Each device keeps a sliding window of the last DEDUP_WINDOW
+# sequence numbers as a bitmap, so a retransmit is recognised in O(1).
+DEDUP_WINDOW = 64
+DEDUP_MASK = (1 << DEDUP_WINDOW) - 1
+
+class DedupWindow:
+    __slots__ = ('boot_id', 'highest', 'bitmap')
+
+    def __init__(self):
+        self.boot_id = None
+        self.highest = -1
+        self.bitmap = 0
+
+    def accept(self, boot_id, seq):
+        """Mark (boot_id, seq) as seen. Returns False if it was already seen."""
+        if boot_id != self.boot_id:
+            # Node rebooted: sequence numbers start over
+            self.boot_id = boot_id
+            self.highest = seq
+            self.bitmap = 1
+            return True
+
+        if seq > self.highest:
+            shift = seq - self.highest
+            self.bitmap = ((self.bitmap << shift) | 1) & DEDUP_MASK if shift < DEDUP_WINDOW else 1
+            self.highest = seq
+            return True
+
+        offset = self.highest - seq
+        if offset >= DEDUP_WINDOW:
+            # Older than the window; can't tell, so don't risk a double store
+            return False
+        bit = 1 << offset
+        if self.bitmap & bit:
+            return False
+        self.bitmap |= bit
+        return True
+
+dedup_windows = {}
+ingest_lock = threading.Lock()
+ingest_stats = {
+    'accepted': 0,
+    'duplicates': 0
+}
+
+def is_duplicate_report(device_name, data):
+    """Check the report's idempotency key. Reports without one are never duplicates."""
+    boot_id = data.get('boot_id')
+    seq = data.get('seq')
+    if boot_id is None or not isinstance(seq, int):
+        return False
+    window = dedup_windows.get(device_name)
+    if window is None:
+        window = dedup_windows[device_name] = DedupWindow()
+    return not window.accept(boot_id, seq)
+
+# ============================================
+# INGEST ADMISSION CONTROL
+# ============================================
+# Token buckets: each device may burst a few reports (retries) but is held to
+# DEVICE_INGEST_RATE on average, and all devices together share a global
+# budget so a runaway node can't starve the dashboard pages. Only reports a
+# device's own bucket admits are charged to the global budget, so one
+# flooding node can't push every other node into 429s. Near the budget,
+# the console banner and the per-report rollups (history, profile cubes,
+# forecasts) are shed before reports are rejected.
+DEVICE_INGEST_RATE = 1.0     # reports/second per device
+DEVICE_INGEST_BURST = 5
+GLOBAL_INGEST_RATE = 20.0    # reports/second across all devices
+GLOBAL_INGEST_BURST = 40
+INGEST_SHED_LEVEL = 0.5      # shed low-priority work below this fraction of the global burst
+
+class TokenBucket:
+    __slots__ = ('rate', 'burst', 'tokens', 'last')
+
+    def __init__(self, rate, burst):
+        self.rate = rate
+        self.burst = burst
+        self.tokens = float(burst)
+        self.last = time.monotonic()
+
+    def take(self, now):
+        """Take one token. Returns 0 on success, else seconds until one is available."""
+        self.tokens = min(self.burst, self.tokens + (now - self.last) * self.rate)
+        self.last = now
+        if self.tokens >= 1.0:
+            self.tokens -= 1.0
+            return 0
+        return (1.0 - self.tokens) / self.rate
+
+global_ingest_bucket = TokenBucket(GLOBAL_INGEST_RATE, GLOBAL_INGEST_BURST)
+device_ingest_buckets = {}
+ingest_stats['rejected'] = 0
+ingest_stats['shed'] = {}
+
+def admit_report(device_name):
+    """Charge the device's bucket, then the global budget.
+    Returns 0 if admitted, else the retry-after delay in seconds."""
+    now = time.monotonic()
+    bucket = device_ingest_buckets.get(device_name)
+    if bucket is None:
+        bucket = device_ingest_buckets[device_name] = TokenBucket(DEVICE_INGEST_RATE, DEVICE_INGEST_BURST)
+    retry_after = bucket.take(now)
+    if retry_after:
+        return retry_after
+    retry_after = global_ingest_bucket.take(now)
+    if retry_after:
+        bucket.tokens += 1.0    # turned away for others' traffic; keep its token
+    return retry_after
+
+def should_shed(work):
+    """True if low-priority `work` should be skipped because ingest is near its budget."""
+    if global_ingest_bucket.tokens >= GLOBAL_INGEST_BURST * INGEST_SHED_LEVEL:
+        return False
+    ingest_stats['shed'][work] = ingest_stats['shed'].get(work, 0) + 1
+    return True
+
+def slow_down_reply(device_name, retry_after):
+    ingest_stats['rejected'] += 1
+    return {'status': 'slow_down', 'device_name': device_name,
+            'retry_after_ms': int(retry_after * 1000) + 1}
+
+# ============================================
+# ROOM FUSION
+# ============================================
+# Rooms with several nodes get one value per channel instead of whichever
+# device reported last. Each (device, channel) stream is resampled onto a
+# FUSION_GRID-second grid and the sources are averaged, weighted by health
+# (share of recent readings that were plausible) and recency. Loudness
+# channels take the loudest fresh source instead. The fused room is rebuilt
+# on ingest, so rendering a room is one dict lookup regardless of node count;
+# it is also rebuilt on read once its oldest source passes FUSION_MAX_AGE, so
+# a node that stops reporting drops out even if nothing else arrives.
+FUSION_GRID = 10.0        # seconds
+FUSION_TAU = 60.0         # recency weight halves roughly every 40 s
+FUSION_MAX_AGE = 600.0    # sources older than this are ignored
+FUSION_HEALTH_ALPHA = 0.2
+FUSION_MAX_CHANNELS = ('audio_level', 'audio_peak') + SOUND_CHANNELS
+CHANNEL_RANGES = {
+    'temperature': (-40.0, 80.0),
+    'humidity': (0.0, 100.0),
+    'light': (0.0, 100000.0),
+    'light_2': (0.0, 100000.0),
+    'audio_level': (0, 4095),
+    'audio_peak': (0, 4095),
+    **{channel: (0.0, 1.0) for channel in SOUND_CHANNELS},
+}
+
+class FusionSource:
+    __slots__ = ('t0', 'v0', 't1', 'v1', 'health')
+
+    def __init__(self):
+        self.t0 = self.v0 = None
+        self.t1 = self.v1 = None
+        self.health = 1.0
+
+    def add(self, t, value, valid):
+        self.health += FUSION_HEALTH_ALPHA * ((1.0 if valid else 0.0) - self.health)
+        if valid:
+            self.t0, self.v0 = self.t1, self.v1
+            self.t1, self.v1 = t, value
+
+    def at(self, t):
+        """Value resampled at time t: linear between the last two samples, held after."""
+        if self.t0 is None or t >= self.t1 or self.t1 <= self.t0:
+            return self.v1
+        if t <= self.t0:
+            return self.v0
+        return self.v0 + (self.v1 - self.v0) * (t - self.t0) / (self.t1 - self.t0)
+
+class RoomFusion:
+    def __init__(self):
+        self.sources = {}          # device_name -> {channel: FusionSource}
+        self.fused = {}            # room -> {'sensors': {...}, 'received_at': epoch}
+        self.expires = {}          # room -> when its oldest source goes stale
+        self.registry_version = None
+        self.version = 0           # bumped whenever a fused room changes
+
+    def on_report(self, device_name, room, sensors, t, outdoor=None):
+        channels = self.sources.setdefault(device_name, {})
+        for channel, value in sensors.items():
+            if isinstance(value, bool) or not isinstance(value, (int, float)):
+                continue
+            src = channels.get(channel)
+            if src is None:
+                src = channels[channel] = FusionSource()
+            lo_hi = CHANNEL_RANGES.get(channel)
+            src.add(t, value, lo_hi is None or lo_hi[0] <= value <= lo_hi[1])
+        if room:
+            self.sync_registry()
+            fused = self.fused[room] = self.fuse(device_registry.room_devices.get(room, ()), t, room)
+            self.version += 1
+            record_room_history(room, fused['sensors'], t, outdoor)
+
+    def fuse(self, device_list, now, room):
+        grid_t = now - (now % FUSION_GRID)
+        weighted = {}
+        loudest = {}
+        latest = 0.0
+        oldest = math.inf
+        for device_name in device_list:
+            for channel, src in self.sources.get(device_name, {}).items():
+                if src.t1 is None or now - src.t1 > FUSION_MAX_AGE:
+                    continue
+                latest = max(latest, src.t1)
+                oldest = min(oldest, src.t1)
+                value = src.at(grid_t)
+                if channel in FUSION_MAX_CHANNELS:
+                    if channel not in loudest or value > loudest[channel]:
+                        loudest[channel] = value
+                    continue
+                weight = src.health * math.exp(-max(0.0, grid_t - src.t1) / FUSION_TAU)
+                if weight <= 0:
+                    continue
+                acc = weighted.get(channel)
+                if acc is None:
+                    weighted[channel] = [weight * value, weight]
+                else:
+                    acc[0] += weight * value
+                    acc[1] += weight
+        sensors = {channel: acc[0] / acc[1] for channel, acc in weighted.items()}
+        sensors.update(loudest)
+        self.expires[room] = oldest + FUSION_MAX_AGE
+        return {'sensors': sensors, 'received_at': latest}
+
+    def sync_registry(self):
+        if self.registry_version != device_registry.version:
+            # Room membership changed: every cached room may be wrong
+            self.registry_version = device_registry.version
+            self.fused = {}
+            self.version += 1
+        now = time.time()
+        stale = [room for room in self.fused if now > self.expires.get(room, math.inf)]
+        if stale:
+            # A source aged out with no newer report to trigger a re-fuse
+            for room in stale:
+                del self.fused[room]
+            self.version += 1
+
+    def room(self, room_name, device_list):
+        self.sync_registry()
+        fused = self.fused.get(room_name)
+        if fused is None:
+            fused = self.fused[room_name] = self.fuse(device_list, time.time(), room_name)
+        return fused
+
+room_fusion = RoomFusion()
+
+# ============================================
+# ROOM HISTORY & CHARTS
+# ============================================
+# Fused room channels are kept for HISTORY_MAX_AGE at one point per fusion
+# grid slot. Charts are downsampled with Largest-Triangle-Three-Buckets to
+# the kiosk's pixel width and served as binary: a little-endian float64
+# start time followed by float32 (seconds since start, value) pairs.
+HISTORY_RANGES = {'24h': 86400, '7d': 7 * 86400, '30d': 30 * 86400}
+HISTORY_MAX_AGE = 30 * 86400
+CHART_WIDTH_PX = 800     # 7-inch display
+
+class SeriesHistory:
+    __slots__ = ('t', 'v', 'start', 'version')
+
+    def __init__(self):
+        self.t = array('d')
+        self.v = array('f')
+        self.start = 0
+        self.version = 0
+
+    def append(self, t, value):
+        slot = t - (t % FUSION_GRID)
+        if len(self.t) > self.start and self.t[-1] >= slot:
+            # Same grid slot: latest fused value wins
+            self.t[-1] = t
+            self.v[-1] = value
+        else:
+            self.t.append(t)
+            self.v.append(value)
+        self.version += 1
+        cutoff = t - HISTORY_MAX_AGE
+        while self.start < len(self.t) and self.t[self.start] < cutoff:
+            self.start += 1
+        if self.start > 4096 and self.start * 2 > len(self.t):
+            del self.t[:self.start]
+            del self.v[:self.start]
+            self.start = 0
+
+    def merge(self, ts, vs):
+        """Insert sorted older points (node backfill) into the gap they fall in."""
+        i = bisect.bisect_left(self.t, ts[0], self.start)
+        lo = self.t[i - 1] if i > self.start else -math.inf
+        hi = self.t[i] if i < len(self.t) else math.inf
+        keep = [(t, v) for t, v in zip(ts, vs) if lo < t < hi]
+        if keep:
+            self.t[i:i] = array('d', [t for t, _ in keep])
+            self.v[i:i] = array('f', [v for _, v in keep])
+            self.version += 1
+        return len(keep)
+
+    def since(self, t_from):
+        lo = bisect.bisect_left(self.t, t_from, self.start)
+        return self.t[lo:], self.v[lo:]
+
+room_history = {}   # (room, channel) -> SeriesHistory
+chart_cache = {}    # (room, channel, range) -> (last_t, payload)
+
+def record_room_history(room, sensors, t, outdoor=None):
+    if not should_shed('history'):
+        for channel, value in sensors.items():
+            series = room_history.get((room, channel))
+            if series is None:
+                series = room_history[(room, channel)] = SeriesHistory()
+            series.append(t, value)
+    if not should_shed('profiles'):
+        room_profiles.record(room, sensors, t)
+    temperature = sensors.get('temperature')
+    if isinstance(temperature, (int, float)) and not should_shed('forecasts'):
+        room_forecasts.record(room, temperature, t, outdoor)
+
+def lttb(ts, vs, threshold):
+    """Largest-Triangle-Three-Buckets downsampling. Returns (ts, vs) lists."""
+    n = len(ts)
+    if threshold >= n or threshold < 3:
+        return list(ts), list(vs)
+    out_t = [ts[0]]
+    out_v = [vs[0]]
+    every = (n - 2) / (threshold - 2)
+    a = 0
+    for i in range(threshold - 2):
+        # Average of the next bucket is the third triangle vertex
+        next_lo = int((i + 1) * every) + 1
+        next_hi = min(int((i + 2) * every) + 1, n)
+        count = next_hi - next_lo
+        avg_t = sum(ts[next_lo:next_hi]) / count
+        avg_v = sum(vs[next_lo:next_hi]) / count
+
+        lo = int(i * every) + 1
+        hi = next_lo
+        at = ts[a]
+        av = vs[a]
+        best_area = -1.0
+        best = lo
+        for j in range(lo, hi):
+            area = abs((at - avg_t) * (vs[j] - av) - (at - ts[j]) * (avg_v - av))
+            if area > best_area:
+                best_area = area
+                best = j
+        out_t.append(ts[best])
+        out_v.append(vs[best])
+        a = best
+    out_t.append(ts[-1])
+    out_v.append(vs[-1])
+    return out_t, out_v
+
+def get_chart_payload(room, channel, range_name):
+    series = room_history.get((room, channel))
+    span = HISTORY_RANGES[range_name]
+    if series is None or len(series.t) <= series.start:
+        return struct.pack('<d', time.time())
+
+    last_t = series.t[-1]
+    key = (room, channel, range_name)
+    cached = chart_cache.get(key)
+    # New points only move the chart once they cover another pixel column
+    if cached and last_t - cached[0] < span / CHART_WIDTH_PX:
+        return cached[1]
+
+    ts, vs = series.since(last_t - span)
+    ts, vs = lttb(ts, vs, CHART_WIDTH_PX)
+    t0 = ts[0]
+    pairs = array('f')
+    for t, v in zip(ts, vs):
+        pairs.append(t - t0)
+        pairs.append(v)
+    if sys.byteorder == 'big':
+        pairs.byteswap()
+    payload = struct.pack('<d', t0) + pairs.tobytes()
+    chart_cache[key] = (last_t, payload)
+    return payload
+
+def replay_sensor_log():
+    """Rebuild latest state and room history from the data log after a restart.
+    What a replica ingested itself during a failover is merged in afterwards."""
+    cutoff = time.time() - HISTORY_MAX_AGE
+    count = 0
+    for path in (DATA_LOG_FILE, failover_log(DATA_LOG_FILE)):
+        if not os.path.exists(path):
+            continue
+        with open(path, 'r') as f:
+            for line in f:
+                try:
+                    data = json.loads(line)
+                    t = datetime.fromisoformat(data['received_at']).timestamp()
+                except:
+                    continue
+                if t < cutoff:
+                    continue
+                if path == DATA_LOG_FILE:
+                    apply_logged_report(data, t)
+                else:
+                    merge_logged_report(data, t)
+                count += 1
+    return count
+
+def apply_logged_report(data, t):
+    device_name = data.get('device_name', 'Unknown Device')
+    latest_state.update(device_name, data, t)
+    # Outdoor temperature as it was when the report arrived, not as it is now
+    outdoor = data.get('outdoor_c')
+    room_fusion.on_report(device_name, device_registry.device_room.get(device_name),
+                          data.get('sensors') or {}, t,
+                          outdoor if isinstance(outdoor, (int, float)) else None)
+
+def merge_logged_report(data, t):
+    """Merge a report that arrives out of time order (resent, or from a failover
+    log) into history, and into latest state only if it is newer."""
+    device_name = data.get('device_name', 'Unknown Device')
+    sensors = {k: v for k, v in (data.get('sensors') or {}).items()
+               if isinstance(v, (int, float)) and not isinstance(v, bool)}
+    merge_backfill(device_name, [{'t': t, 'sensors': sensors}])
+    dev_id = latest_state.device_ids.get(device_name)
+    if dev_id is None or t > latest_state.received_at[dev_id]:
+        latest_state.update(device_name, data, t)
+
+# ============================================
+# WEEKLY ROOM PROFILES
+# ============================================
+# "Typical week" cubes: for each room, metric and hour-of-week (Monday 00:00
+# = 0 .. Sunday 23:00 = 167) the mean over the last few weeks. Readings are
+# summed for the current hour only; when the hour ends its mean is folded
+# into that hour-of-week bin as a running mean over PROFILE_WEEKS weeks, so
+# each reading is O(1) and the cube never needs a history scan. The log
+# replay at startup covers HISTORY_MAX_AGE, which rebuilds the cubes.
+PROFILE_METRICS = [
+    ('occupancy', '🚶 Occupancy', '%'),
+    ('audio_level', '🔊 Noise', ''),
+    ('light', '💡 Light', ' lux'),
+    ('temperature', '🌡️ Temperature', '°C'),
+]
+PROFILE_WEEKS = 4
+HOURS_PER_WEEK = 168
+OCCUPANCY_AUDIO_PEAK = 50   # above "Quiet" in interpret_audio
+
+class WeeklyProfile:
+    def __init__(self):
+        self.means = {m: array('d', [math.nan] * HOURS_PER_WEEK) for m, _, _ in PROFILE_METRICS}
+        self.weeks = {m: array('B', bytes(HOURS_PER_WEEK)) for m, _, _ in PROFILE_METRICS}
+        self.hour = 0          # hour-of-week being accumulated
+        self.hour_end = 0.0
+        self.acc = {}          # metric -> [sum, count] for the current hour
+
+    def add(self, sensors, t):
+        """Accumulate one reading; True when a finished hour was folded in."""
+        folded = False
+        if t >= self.hour_end:
+            folded = self.fold()
+            local = datetime.fromtimestamp(t)
+            self.hour = local.weekday() * 24 + local.hour
+            self.hour_end = t - (local.minute * 60 + local.second + local.microsecond / 1e6) + 3600
+        peak = sensors.get('audio_peak')
+        if isinstance(peak, (int, float)):
+            self._add('occupancy', 100.0 if peak > OCCUPANCY_AUDIO_PEAK else 0.0)
+        for metric, _, _ in PROFILE_METRICS[1:]:
+            value = sensors.get(metric)
+            if isinstance(value, (int, float)) and not isinstance(value, bool):
+                self._add(metric, value)
+        return folded
+
+    def _add(self, metric, value):
+        acc = self.acc.get(metric)
+        if acc is None:
+            self.acc[metric] = [value, 1]
+        else:
+            acc[0] += value
+            acc[1] += 1
+
+    def fold(self):
+        if not self.acc:
+            return False
+        h = self.hour
+        for metric, (total, count) in self.acc.items():
+            mean = total / count
+            n = self.weeks[metric][h]
+            if n == 0:
+                self.means[metric][h] = mean
+            else:
+                self.means[metric][h] += (mean - self.means[metric][h]) / min(n + 1, PROFILE_WEEKS)
+            self.weeks[metric][h] = min(n + 1, 255)
+        self.acc = {}
+        return True
+
+    def metric(self, metric):
+        return [None if v != v else round(v, 2) for v in self.means[metric]]
+
+class RoomProfiles:
+    def __init__(self):
+        self.rooms = {}
+        self.version = 0
+
+    def record(self, room, sensors, t):
+        profile = self.rooms.get(room)
+        if profile is None:
+            profile = self.rooms[room] = WeeklyProfile()
+        if profile.add(sensors, t):
+            self.version += 1
+
+room_profiles = RoomProfiles()
+
+# ============================================
+# ROOM TEMPERATURE FORECAST
+# ============================================
+# Per-room first-order thermal model fitted online with recursive least
+# squares:  T[k+1] = a*T[k] + b*T_outdoor + c  on a FORECAST_STEP grid.
+# Each step is one 3x3 RLS update with exponential forgetting, after which
+# the 30/60/120-minute predictions are recomputed in closed form, so
+# /api/forecast only reads stored numbers. A reading that falls well below
+# the one-step prediction is flagged as a possible open window. The outdoor
+# temperature is logged with each report (outdoor_c) so a replay fits the
+# same inputs; steps without one are not learned from.
+FORECAST_STEP = 300               # seconds per model step
+FORECAST_HORIZONS = (30, 60, 120)  # minutes
+FORECAST_FORGET = 0.995           # ~17 h effective memory at 5-minute steps
+FORECAST_MAX_GAP = 3              # steps; longer gaps restart the sample chain
+FORECAST_P_MAX = 1e4              # cap on covariance trace against windup
+WINDOW_OPEN_SIGMA = 3.0
+
+def outdoor_temperature():
+    """Latest outdoor temperature from the weather cache, without fetching."""
+    try:
+        return float(weather_cache['data']['main']['temp'])
+    except (TypeError, KeyError, ValueError):
+        return None
+
+class ThermalModel:
+    def __init__(self):
+        self.theta = [1.0, 0.0, 0.0]   # start as "temperature stays put"
+        self.P = [[100.0, 0.0, 0.0], [0.0, 100.0, 0.0], [0.0, 0.0, 100.0]]
+        self.prev = None               # (T, T_outdoor) at the previous step
+        self.current = None
+        self.step_end = 0.0
+        self.steps = 0
+        self.residual = 0.0
+        self.residual_var = 0.25
+        self.forecast = {}
+
+    def add(self, t, temperature, outdoor):
+        self.current = temperature
+        if t < self.step_end:
+            return False
+        gap = (t - self.step_end) // FORECAST_STEP
+        self.step_end = t - (t % FORECAST_STEP) + FORECAST_STEP
+        # A step without a known outdoor temperature has no input: it is
+        # neither learned from nor predicted from
+        if self.prev is not None and self.prev[1] is not None and gap < FORECAST_MAX_GAP:
+            self.update(self.prev, temperature)
+        self.prev = (temperature, outdoor)
+        if outdoor is not None:
+            self.predict()
+        return True
+
+    def update(self, prev, y):
+        x = [prev[0], prev[1], 1.0]
+        P = self.P
+        Px = [P[i][0] * x[0] + P[i][1] * x[1] + P[i][2] * x[2] for i in range(3)]
+        denom = FORECAST_FORGET + x[0] * Px[0] + x[1] * Px[1] + x[2] * Px[2]
+        k = [v / denom for v in Px]
+        error = y - (self.theta[0] * x[0] + self.theta[1] * x[1] + self.theta[2])
+        self.theta = [self.theta[i] + k[i] * error for i in range(3)]
+        self.P = [[(P[i][j] - k[i] * Px[j]) / FORECAST_FORGET for j in range(3)] for i in range(3)]
+        trace = self.P[0][0] + self.P[1][1] + self.P[2][2]
+        if trace > FORECAST_P_MAX:
+            scale = FORECAST_P_MAX / trace
+            self.P = [[v * scale for v in row] for row in self.P]
+        self.residual = error
+        self.residual_var += 0.05 * (error * error - self.residual_var)
+        self.steps += 1
+
+    def predict(self):
+        a, b, c = self.theta
+        a = min(max(a, 0.0), 0.9999)   # keep the closed form stable
+        T, outdoor = self.prev
+        drive = b * outdoor + c
+        equilibrium = drive / (1.0 - a)
+        for minutes in FORECAST_HORIZONS:
+            ah = a ** (minutes * 60 / FORECAST_STEP)
+            self.forecast[minutes] = round(equilibrium + (T - equilibrium) * ah, 2)
+
+    def window_open(self):
+        return (self.steps > 12 and
+                self.residual < -WINDOW_OPEN_SIGMA * math.sqrt(self.residual_var))
+
+class RoomForecasts:
+    def __init__(self):
+        self.models = {}
+
+    def record(self, room, temperature, t, outdoor):
+        model = self.models.get(room)
+        if model is None:
+            model = self.models[room] = ThermalModel()
+        model.add(t, temperature, outdoor)
+
+    def get(self, room):
+        model = self.models.get(room)
+        if model is None or model.prev is None:
+            return None
+        a, b, c = model.theta
+        return {
+            'temperature': model.current,
+            'outdoor': outdoor_temperature(),
+            'forecast': {str(m): v for m, v in model.forecast.items()},
+            'model': {'a': round(a, 5), 'b': round(b, 5), 'c': round(c, 4)},
+            'steps': model.steps,
+            'window_open': model.window_open(),
+        }
+
+room_forecasts = RoomForecasts()
+
+# ============================================
+# HISTORY EXPORT
+# ============================================
+# Streams a time range of the data log as Arrow IPC, Parquet (both need
+# pyarrow) or CSV. The log is appended in receive order under ingest_lock and
+# received_at is a fixed-width "YYYY-MM-DD HH:MM:SS" string, so the start of
+# the range is found by bisecting byte offsets and comparing strings; lines
+# outside the range are never JSON-decoded. Only the requested columns are
+# extracted, and rows are emitted in batches.
+EXPORT_FORMATS = {
+    'arrow': 'application/vnd.apache.arrow.stream',
+    'parquet': 'application/vnd.apache.parquet',
+    'csv': 'text/csv',
+}
+EXPORT_DEFAULT_COLUMNS = ['time', 'device', 'temperature', 'humidity', 'light',
+                          'audio_level', 'audio_peak']
+EXPORT_BATCH_ROWS = 8192
+RECEIVED_AT_KEY = '"received_at": "'
+
+def parse_time_arg(value, default):
+    """Epoch seconds or an ISO date/time, as a log timestamp string."""
+    if value in (None, ''):
+        return default
+    try:
+        return format_timestamp(float(value))
+    except ValueError:
+        return datetime.fromisoformat(value).strftime('%Y-%m-%d %H:%M:%S')
+
+def log_line_time(line):
+    i = line.rfind(RECEIVED_AT_KEY)
+    if i < 0:
+        return None
+    i += len(RECEIVED_AT_KEY)
+    return line[i:i + 19]
+
+def log_offset_at(f, start):
+    """Byte offset of the first log line received at or after start."""
+    f.seek(0, os.SEEK_END)
+    lo, hi = 0, f.tell()
+    while hi - lo > 4096:
+        mid = (lo + hi) // 2
+        f.seek(mid)
+        f.readline()   # skip the partial line
+        line_start = f.tell()
+        ts = None
+        while ts is None and line_start < hi:
+            line = f.readline()
+            if not line:
+                break
+            ts = log_line_time(line.decode('utf-8', 'replace'))
+            if ts is None:
+                line_start = f.tell()
+        if ts is None or ts >= start:
+            hi = mid
+        else:
+            lo = line_start
+    return lo
+
+def export_column(data, column, t, device_name):
+    if column == 'time':
+        return t
+    if column == 'device':
+        return device_name
+    if column.startswith('status.'):
+        key, _, sub = column[7:].partition('.')
+        value = (data.get('status') or {}).get(key)
+        if isinstance(value, dict):
+            return value.get(sub) if sub else None
+        return value
+    return (data.get('sensors') or {}).get(column)
+
+def read_log_batches(start, end, devices=None, columns=EXPORT_DEFAULT_COLUMNS):
+    """Yield {column: [values]} batches for log lines in [start, end]."""
+    if not os.path.exists(DATA_LOG_FILE):
+        return
+    batch = {c: [] for c in columns}
+    rows = 0
+    with open(DATA_LOG_FILE, 'rb') as f:
+        f.seek(log_offset_at(f, start))
+        for raw in f:
+            line = raw.decode('utf-8', 'replace')
+            ts = log_line_time(line)
+            if ts is None or ts < start:
+                continue
+            if ts > end:
+                break
+            try:
+                data = json.loads(line)
+            except ValueError:
+                continue
+            device_name = data.get('device_name', 'Unknown Device')
+            if devices and device_name not in devices:
+                continue
+            t = datetime.strptime(ts, '%Y-%m-%d %H:%M:%S').timestamp()
+            for c in columns:
+                batch[c].append(export_column(data, c, t, device_name))
+            rows += 1
+            if rows == EXPORT_BATCH_ROWS:
+                yield batch
+                batch = {c: [] for c in columns}
+                rows = 0
+    if rows:
+        yield batch
+
+class ChunkSink(io.RawIOBase):
+    """Write-only file object that hands written bytes to a generator."""
+    def __init__(self):
+        self.chunks = []
+        self.position = 0
+
+    def writable(self):
+        return True
+
+    def write(self, b):
+        self.chunks.append(bytes(b))
+        self.position += len(b)
+        return len(b)
+
+    def tell(self):
+        return self.position
+
+    def take(self):
+        data = b''.join(self.chunks)
+        self.chunks = []
+        return data
+
+def export_int(v):
+    """Value for an int64 column: integral floats (e.g. 3000.0) are kept."""
+    if isinstance(v, bool):
+        return None
+    if isinstance(v, int):
+        return v
+    if isinstance(v, float) and v.is_integer():
+        return int(v)
+    return None
+
+def export_schema(columns):
+    fields = []
+    for c in columns:
+        if c == 'time':
+            fields.append(pyarrow.field('time', pyarrow.timestamp('s')))
+        elif c == 'device':
+            fields.append(pyarrow.field('device', pyarrow.dictionary(pyarrow.int32(), pyarrow.string())))
+        elif channel_type(c) == 'q':
+            fields.append(pyarrow.field(c, pyarrow.int64()))
+        else:
+            fields.append(pyarrow.field(c, pyarrow.float64()))
+    return pyarrow.schema(fields)
+
+def export_history(fmt, start, end, devices=None, columns=EXPORT_DEFAULT_COLUMNS):
+    """Generator of encoded chunks for the requested range and columns."""
+    batches = read_log_batches(start, end, devices, columns)
+    if fmt == 'csv':
+        out = io.StringIO()
+        writer = csv.writer(out)
+        writer.writerow(columns)
+        for batch in batches:
+            writer.writerows(zip(*(batch[c] for c in columns)))
+            yield out.getvalue().encode()
+            out.seek(0)
+            out.truncate()
+        yield out.getvalue().encode()
+        return
+
+    schema = export_schema(columns)
+    sink = ChunkSink()
+    if fmt == 'arrow':
+        writer = pyarrow.ipc.new_stream(sink, schema)
+    else:
+        writer = pyarrow.parquet.ParquetWriter(sink, schema, compression='zstd')
+    for batch in batches:
+        arrays = []
+        for field in schema:
+            values = batch[field.name]
+            if field.name == 'time':
+                values = [int(t) for t in values]
+            elif pyarrow.types.is_dictionary(field.type):
+                arrays.append(pyarrow.array(values, pyarrow.string()).dictionary_encode())
+                continue
+            elif field.type == pyarrow.float64():
+                values = [v if isinstance(v, (int, float)) else None for v in values]
+            else:
+                values = [export_int(v) for v in values]
+            arrays.append(pyarrow.array(values, field.type))
+        writer.write_batch(pyarrow.record_batch(arrays, schema=schema))
+        yield sink.take()
+    writer.close()
+    yield sink.take()
+
+def export_main(argv):
+    parser = argparse.ArgumentParser(prog='homepod_server_v3.py export',
+                                     description='Export sensor history from the data log')
+    parser.add_argument('--start', help='epoch seconds or ISO time (default: beginning)')
+    parser.add_argument('--end', help='epoch seconds or ISO time (default: now)')
+    parser.add_argument('--device', action='append', help='limit to device (repeatable)')
+    parser.add_argument('--columns', default=','.join(EXPORT_DEFAULT_COLUMNS),
+                        help='comma-separated columns, e.g. time,device,temperature,status.wifi_rssi')
+    parser.add_argument('--format', choices=sorted(EXPORT_FORMATS), default='csv',
+                        help='csv needs nothing extra; arrow and parquet need pyarrow')
+    parser.add_argument('--output', '-o', help='output file (default: stdout)')
+    args = parser.parse_args(argv)
+    if args.format != 'csv' and pyarrow is None:
+        parser.error(f"{args.format} export needs pyarrow (pip install pyarrow), or use --format csv")
+    start = parse_time_arg(args.start, '0000-00-00 00:00:00')
+    end = parse_time_arg(args.end, format_timestamp(time.time()))
+    columns = [c.strip() for c in args.columns.split(',') if c.strip()]
+    out = open(args.output, 'wb') if args.output else sys.stdout.buffer
+    try:
+        for chunk in export_history(args.format, start, end, set(args.device or ()), columns):
+            out.write(chunk)
+    finally:
+        if args.output:
+            out.close()
+
+# ============================================
+# NODE BACKFILL
+# ============================================
+# Nodes keep ~72 h of 1-minute rollups in flash. When a device reports after
+# a silence longer than BACKFILL_MIN_GAP (Pi or WiFi outage), the missing
+# range is pulled from the node in one GET /history transfer, the rollup
+# means are merged into room history, and the rollups are appended to
+# BACKFILL_LOG_FILE (same JSON shape as the data log plus min/max) so the
+# time-ordered data log is never rewritten.
+NODE_HISTORY_PORT = 80
+BACKFILL_MIN_GAP = 300        # seconds of silence before asking the node
+BACKFILL_TIMEOUT = 30
+BACKFILL_LOG_FILE = "sensor_backfill_v3.log"
+# minute, count, channels, version, min[4], max[4], mean[4], reserved, crc
+ROLLUP_RECORD = struct.Struct('<IHBB4f4f4fII')
+
+backfill_active = set()
+backfill_stats = {'requests': 0, 'records': 0, 'merged_points': 0, 'errors': 0}
+
+def parse_rollups(payload, channel_names):
+    entries = []
+    for offset in range(0, len(payload) - ROLLUP_RECORD.size + 1, ROLLUP_RECORD.size):
+        fields = ROLLUP_RECORD.unpack_from(payload, offset)
+        minute, count, channels = fields[0], fields[1], min(fields[2], len(channel_names), 4)
+        names = channel_names[:channels]
+        entries.append({
+            't': float(minute),
+            'samples': count,
+            'sensors': {n: round(fields[12 + i], 2) for i, n in enumerate(names)},
+            'min': {n: round(fields[4 + i], 2) for i, n in enumerate(names)},
+            'max': {n: round(fields[8 + i], 2) for i, n in enumerate(names)},
+        })
+    entries.sort(key=lambda e: e['t'])
+    return entries
+
+def merge_backfill(device_name, entries):
+    """Merge rollup means into the device's room history; returns points added."""
+    room = device_registry.device_room.get(device_name)
+    cutoff = time.time() - HISTORY_MAX_AGE
+    if not room:
+        return 0
+    per_channel = {}
+    for e in entries:
+        if e['t'] < cutoff:
+            continue
+        for channel, value in e['sensors'].items():
+            per_channel.setdefault(channel, ([], []))
+            per_channel[channel][0].append(e['t'])
+            per_channel[channel][1].append(value)
+    merged = 0
+    for channel, (ts, vs) in per_channel.items():
+        series = room_history.get((room, channel))
+        if series is None:
+            series = room_history[(room, channel)] = SeriesHistory()
+        merged += series.merge(ts, vs)
+    for key in [k for k in chart_cache if k[0] == room]:
+        del chart_cache[key]
+    return merged
+
+def run_backfill(device_name, address, t_from, t_to):
+    try:
+        resp = requests.get(f"http://{address}:{NODE_HISTORY_PORT}/history",
+                            params={'from': int(t_from) + 1, 'to': int(t_to)},
+                            timeout=BACKFILL_TIMEOUT)
+        resp.raise_for_status()
+        channel_names = [c for c in resp.headers.get('X-Channels', '').split(',') if c]
+        entries = parse_rollups(resp.content, channel_names)
+        with ingest_lock:
+            merged = merge_backfill(device_name, entries)
+            with open(local_log(BACKFILL_LOG_FILE), 'a') as f:
+                for e in entries:
+                    f.write(json.dumps({
+                        'device_name': device_name,
+                        'sensors': e['sensors'], 'min': e['min'], 'max': e['max'],
+                        'samples': e['samples'], 'backfill': True,
+                        'received_at': format_timestamp(e['t']),
+                    }) + '\n')
+            backfill_stats['records'] += len(entries)
+            backfill_stats['merged_points'] += merged
+        print(f"Backfilled {len(entries)} minutes from {device_name}")
+    except Exception as e:
+        backfill_stats['errors'] += 1
+        print(f"Backfill from {device_name} failed: {e}")
+    finally:
+        with ingest_lock:
+            backfill_active.discard(device_name)
+
+def start_backfill(device_name, address, t_from, t_to):
+    """Call with ingest_lock held."""
+    if device_name in backfill_active or not address:
+        return
+    backfill_active.add(device_name)
+    backfill_stats['requests'] += 1
+    threading.Thread(target=run_backfill, args=(device_name, address, t_from, t_to),
+                     daemon=True).start()
+
+def replay_backfill_log():
+    per_device = {}
+    for path in (BACKFILL_LOG_FILE, failover_log(BACKFILL_LOG_FILE)):
+        if not os.path.exists(path):
+            continue
+        with open(path, 'r') as f:
+            for line in f:
+                try:
+                    data = json.loads(line)
+                    t = datetime.fromisoformat(data['received_at']).timestamp()
+                except:
+                    continue
+                per_device.setdefault(data.get('device_name'), []).append(
+                    {'t': t, 'sensors': data.get('sensors') or {}})
+    count = 0
+    for device_name, entries in per_device.items():
+        entries.sort(key=lambda e: e['t'])
+        count += merge_backfill(device_name, entries)
+    return count
+
+# ============================================
+# BOOT PROFILES
+# ============================================
+# Nodes timestamp each boot stage in microseconds from app start and send the
+# table as "boot" in their first reports. The latest table per device is kept
+# in the device registry. Boots that reached first_report are appended to
+# BOOT_LOG_FILE and summarized per firmware build, so a stage that got slower
+# shows up as soon as a new build is flashed.
+BOOT_LOG_FILE = "boot_profiles_v3.log"
+BOOT_HISTORY = 50             # boots kept per firmware build
+
+boot_profiles = {}            # firmware -> [entry, ...], oldest first
+boot_logged = set()           # (device_name, boot_id) already in the log
+
+def boot_stages(us):
+    """Stage durations in ms, in the order the stages finished."""
+    stages = {}
+    prev = 0
+    for name, t in sorted(us.items(), key=lambda kv: kv[1]):
+        stages[name] = round((t - prev) / 1000.0, 1)
+        prev = t
+    return stages
+
+def add_boot_profile(entry):
+    boot_logged.add((entry['device_name'], entry.get('boot_id')))
+    entries = boot_profiles.setdefault(entry['firmware'], [])
+    entries.append(entry)
+    del entries[:-BOOT_HISTORY]
+
+def record_boot(device_name, boot_id, boot):
+    """Call with ingest_lock held."""
+    us = boot.get('us')
+    if not isinstance(us, dict):
+        return
+    us = {name: int(t) for name, t in us.items() if isinstance(t, (int, float))}
+    firmware = str(boot.get('firmware') or 'unknown')
+    device_registry.update_info(device_name, boot={'firmware': firmware, 'boot_id': boot_id, 'us': us})
+    if 'first_report' not in us or (device_name, boot_id) in boot_logged:
+        return
+    entry = {'device_name': device_name, 'boot_id': boot_id, 'firmware': firmware,
+             'us': us, 'received_at': format_timestamp(time.time())}
+    add_boot_profile(entry)
+    with open(local_log(BOOT_LOG_FILE), 'a') as f:
+        f.write(json.dumps(entry) + '\n')
+
+def median(values):
+    values = sorted(values)
+    n = len(values)
+    if not n:
+        return None
+    return values[n // 2] if n % 2 else (values[n // 2 - 1] + values[n // 2]) / 2
+
+def boot_summary(firmware):
+    entries = boot_profiles.get(firmware, [])
+    per_stage = {}
+    for e in entries:
+        for name, ms in boot_stages(e['us']).items():
+            per_stage.setdefault(name, []).append(ms)
+    ttfr = [e['us']['first_report'] / 1000.0 for e in entries]
+    return {
+        'boots': len(entries),
+        'devices': sorted({e['device_name'] for e in entries}),
+        'time_to_first_report_ms': {'median': round(median(ttfr), 1), 'max': round(max(ttfr), 1)} if ttfr else None,
+        'stages_ms': {name: round(median(v), 1) for name, v in per_stage.items()},
+    }
+
+def replay_boot_log():
+    count = 0
+    for path in (BOOT_LOG_FILE, failover_log(BOOT_LOG_FILE)):
+        if not os.path.exists(path):
+            continue
+        with open(path, 'r') as f:
+            for line in f:
+                try:
+                    entry = json.loads(line)
+                    entry['us']['first_report']
+                except:
+                    continue
+                add_boot_profile(entry)
+                count += 1
+    return count
+
+# ============================================
+# FLIGHT RECORDER
+# ============================================
+# After each boot a node POSTs the event ring it kept in RTC memory during the
+# previous boot (8-byte records, see FlightRecorder in the sketches) together
+# with the reset reason and the loop() step it was in. Uploads are decoded,
+# appended to FLIGHT_LOG_FILE, and the latest one per device is summarized in
+# the device registry.
+FLIGHT_LOG_FILE = "flight_recorder_v3.log"
+FLIGHT_RECORD = struct.Struct('<IBBH')   # ms, type, a, b
+FLIGHT_KEEP = 10                         # uploads kept in memory per device
+RESET_REASONS = {
+    0: 'unknown', 1: 'power_on', 2: 'external', 3: 'software', 4: 'panic',
+    5: 'interrupt_wdt', 6: 'task_wdt', 7: 'other_wdt', 8: 'deep_sleep',
+    9: 'brownout', 10: 'sdio',
+}
+CRASH_RESETS = {'panic', 'interrupt_wdt', 'task_wdt', 'other_wdt', 'brownout'}
+FLIGHT_TASKS = {0: None, 1: 'sample', 2: 'waterfall', 3: 'report', 4: 'history', 5: 'control', 6: 'sound'}
+FLIGHT_WIFI_STATES = {1: 'connected', 2: 'got_ip', 3: 'disconnected'}
+FLIGHT_SENSORS = {1: 'dht', 2: 'light'}
+
+flight_reports = {}   # device_name -> [upload, ...], oldest first
+
+def decode_flight_record(ms, kind, a, b):
+    if kind == 1:
+        return {'ms': ms, 'event': 'boot', 'reset_reason': RESET_REASONS.get(b, b)}
+    if kind == 2:
+        return {'ms': ms, 'event': 'slow_task', 'task': FLIGHT_TASKS.get(a, a), 'duration_ms': b}
+    if kind == 3:
+        event = {'ms': ms, 'event': 'wifi', 'state': FLIGHT_WIFI_STATES.get(a, a)}
+        if a == 3:
+            event['reason'] = b
+        return event
+    if kind == 4:
+        return {'ms': ms, 'event': 'sensor_error', 'sensor': FLIGHT_SENSORS.get(a, a)}
+    if kind == 5:
+        return {'ms': ms, 'event': 'heap', 'free_kb': b, 'largest_block_kb': a}
+    if kind == 6:
+        return {'ms': ms, 'event': 'stack', 'task': FLIGHT_TASKS.get(a, a), 'stack_free_bytes': b}
+    if kind == 7:
+        return {'ms': ms, 'event': 'post', 'attempts': a, 'status': b - 0x10000 if b & 0x8000 else b}
+    return {'ms': ms, 'event': kind, 'a': a, 'b': b}
+
+def add_flight_report(report):
+    uploads = flight_reports.setdefault(report['device_name'], [])
+    uploads.append(report)
+    del uploads[:-FLIGHT_KEEP]
+
+def replay_flight_log():
+    count = 0
+    for path in (FLIGHT_LOG_FILE, failover_log(FLIGHT_LOG_FILE)):
+        if not os.path.exists(path):
+            continue
+        with open(path, 'r') as f:
+            for line in f:
+                try:
+                    add_flight_report(json.loads(line))
+                except:
+                    continue
+                count += 1
+    return count
+
+# ============================================
+# ENCRYPTED UPLINK
+# ============================================
+# Nodes built with UPLINK_TLS post over TLS 1.2 with a pre-shared key. There
+# are no certificates, so the ESP32 does no public-key crypto. The connection
+# is kept alive, so the handshake is paid once per connection rather than
+# once per report. Keys live in UPLINK_PSK_FILE as "identity:secret" lines
+# (stunnel's PSKsecrets format, identity = device name). The built-in
+# listener needs Python 3.13+ for SSLContext.set_psk_server_callback. On older
+# Pythons, stunnel terminates TLS with the same file and connects to
+# UPLINK_PROXY_PORT on localhost. That port speaks keep-alive HTTP/1.1 so
+# stunnel's connections stay open, and expects a PROXY protocol v1 line
+# first, so reports keep the node's address (flash backfill connects to it).
+# Port 5000 keeps the default one-request-per-connection handler.
+# Each node reports the time and size of its last POST in status, so TLS and
+# plain reports can be compared in /api/uplink.
+UPLINK_TLS_PORT = 5443
+UPLINK_PROXY_PORT = 5080      # stunnel's upstream; localhost only
+UPLINK_PSK_FILE = "uplink_psk.txt"
+UPLINK_IDLE_TIMEOUT = 60      # seconds before an idle kept-alive connection closes
+
+uplink_stats = {}             # (device_name, 'tls' | 'plain') -> running totals
+
+def load_psk_secrets(path=UPLINK_PSK_FILE):
+    secrets = {}
+    if os.path.exists(path):
+        with open(path, 'r') as f:
+            for line in f:
+                line = line.strip()
+                if line and not line.startswith('#') and ':' in line:
+                    identity, secret = line.split(':', 1)
+                    secrets[identity] = secret.encode()
+    return secrets
+
+def record_uplink(device_name, status):
+    """Call with ingest_lock held."""
+    us = status.get('uplink_us')
+    if not isinstance(us, int) or us <= 0:
+        return
+    mode = 'tls' if status.get('uplink_tls') else 'plain'
+    totals = uplink_stats.setdefault((device_name, mode), {'reports': 0, 'us': 0, 'bytes': 0})
+    totals['reports'] += 1
+    totals['us'] += us
+    totals['bytes'] += int(status.get('uplink_bytes') or 0)
+
+def uplink_summary(totals):
+    n = totals['reports']
+    return {'reports': n, 'avg_ms': round(totals['us'] / n / 1000.0, 1),
+            'avg_bytes': round(totals['bytes'] / n)}
+
+def keep_alive_handler():
+    """Werkzeug request handler that keeps HTTP/1.1 connections open."""
+    from werkzeug.serving import WSGIRequestHandler
+
+    class KeepAliveHandler(WSGIRequestHandler):
+        protocol_version = 'HTTP/1.1'
+        timeout = UPLINK_IDLE_TIMEOUT
+
+    return KeepAliveHandler
+
+def proxy_protocol_handler():
+    """Keep-alive handler whose connections start with a PROXY protocol v1
+    line ("PROXY TCP4 <src> <dst> <sport> <dport>"); src becomes remote_addr."""
+    class ProxyProtocolHandler(keep_alive_handler()):
+        def handle(self):
+            parts = self.rfile.readline(108).decode('ascii', 'replace').split()
+            if len(parts) != 6 or parts[0] != 'PROXY':
+                return   # not from stunnel: drop the connection
+            self.client_address = (parts[2], int(parts[4]) if parts[4].isdigit() else 0)
+            super().handle()
+
+    return ProxyProtocolHandler
+
+def start_tls_uplink():
+    """Returns a description for the startup banner, or None if not configured."""
+    secrets = load_psk_secrets()
+    if not secrets:
+        return None
+    from werkzeug.serving import make_server
+    if not hasattr(ssl.SSLContext, 'set_psk_server_callback'):
+        server = make_server('127.0.0.1', UPLINK_PROXY_PORT, app, threaded=True,
+                             request_handler=proxy_protocol_handler())
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        return (f"TLS-PSK needs Python 3.13+; run stunnel on port {UPLINK_TLS_PORT} "
+                f"with connect = 127.0.0.1:{UPLINK_PROXY_PORT} and protocol = proxy")
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.maximum_version = ssl.TLSVersion.TLSv1_2   # mbedTLS PSK suites
+    context.set_ciphers('PSK')
+    context.set_psk_server_callback(lambda identity: secrets.get(identity, b''))
+    server = make_server('0.0.0.0', UPLINK_TLS_PORT, app, threaded=True,
+                         request_handler=keep_alive_handler(), ssl_context=context)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return f"TLS-PSK on port {UPLINK_TLS_PORT} ({len(secrets)} keys)"
+
+# ============================================
+# REPLICATION
+# ============================================
+# Optional warm standby: a second server process (another Pi, or a local
+# process with its own data directory) started with the "replica" argument.
+# The primary connects to REPLICA_ADDRESS and ships the append-only logs as
+# whole-line segments, keyed by byte offset, and the JSON state files
+# (devices, to-dos, notes, timers, music) as whole snapshots whenever they
+# change. The replica appends each segment, records how far it has got in
+# REPLICA_STATE_FILE, applies it to its own live state and acks it. On
+# reconnect it sends those offsets back and shipping resumes from there.
+# Shipping is stop-and-wait, one segment in flight at a time. Ingest wakes
+# the shipper, so lag is normally one round trip. Lag past REPLICA_MAX_LAG is
+# flagged in /api/replication. Nodes built with a REPLICA_PI_IP post to the
+# replica while the primary is unreachable and move back when it answers;
+# the primary then backfills the gap from the nodes' flash history.
+REPLICA_PORT = 5003
+REPLICA_ADDRESS = ''          # "host" or "host:port" of the standby; empty = no replica
+REPLICA_STATE_FILE = "replica_state.json"
+REPLICA_SEGMENT_BYTES = 64 * 1024
+REPLICA_POLL = 0.5            # seconds between checks when nothing woke the shipper
+REPLICA_HEARTBEAT = 2.0
+REPLICA_TIMEOUT = 10.0        # silence (either side) before the link is dropped
+REPLICA_RETRY = 5.0
+REPLICA_MAX_LAG = 5.0         # seconds behind before the replica counts as lagging
+REPLICA_RATE_WINDOW = 10.0    # seconds of acks averaged into bytes_per_s
+REPLICA_MAX_FRAME = 16 * 1024 * 1024
+REPLICATED_LOGS = [DATA_LOG_FILE, BACKFILL_LOG_FILE, BOOT_LOG_FILE, FLIGHT_LOG_FILE,
+                   SOUND_CAPTURE_FILE]
+REPLICATED_SNAPSHOTS = [DEVICES_FILE, TODO_FILE, NOTES_FILE, TIMERS_FILE, MUSIC_FILE]
+
+replica_lock = threading.Lock()   # guards everything below
+replica_wakeup = threading.Event()
+replica_role = 'primary' if REPLICA_ADDRESS else None
+replica_offsets = {}          # log -> bytes the replica holds (primary: acked, replica: applied)
+replica_behind = {}           # log -> bytes the primary had that were not yet acked/applied
+replica_pending_since = {}    # log -> when the primary first saw unshipped bytes
+replica_digests = {}          # snapshot -> sha1 the replica holds
+replica_snapshot_keys = {}    # snapshot -> (mtime_ns, size) last checked on the primary
+replica_rate = deque()        # (time, bytes) per acked or applied frame
+replica_stats = {'connected': False, 'peer': None, 'connects': 0, 'segments': 0,
+                 'snapshots': 0, 'bytes': 0, 'resets': 0, 'max_lag_s': 0.0,
+                 'ack_ms': None, 'last_heard': None, 'last_error': None}
+
+def recv_exact(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError('connection closed')
+        data += chunk
+    return data
+
+def send_frame(sock, header, payload=b''):
+    """Length-prefixed JSON header, then header['size'] bytes of payload."""
+    header = json.dumps(dict(header, size=len(payload))).encode()
+    sock.sendall(struct.pack('>I', len(header)) + header + payload)
+
+def recv_frame(sock):
+    n = struct.unpack('>I', recv_exact(sock, 4))[0]
+    if n > REPLICA_MAX_FRAME:
+        raise ValueError(f'frame header of {n} bytes')
+    header = json.loads(recv_exact(sock, n))
+    size = header.get('size', 0)
+    if not isinstance(size, int) or not 0 <= size <= REPLICA_MAX_FRAME:
+        raise ValueError(f'frame payload of {size} bytes')
+    return header, recv_exact(sock, size)
+
+def file_digest(path):
+    try:
+        with open(path, 'rb') as f:
+            return hashlib.sha1(f.read()).hexdigest()
+    except OSError:
+        return None
+
+def count_replicated(nbytes, now):
+    """Call with replica_lock held."""
+    replica_stats['bytes'] += nbytes
+    replica_stats['last_heard'] = now
+    replica_rate.append((now, nbytes))
+    while replica_rate and replica_rate[0][0] < now - REPLICA_RATE_WINDOW:
+        replica_rate.popleft()
+
+def replication_lag(now):
+    """Seconds the oldest unshipped write has waited. Call with replica_lock held."""
+    if not replica_pending_since:
+        return 0.0
+    return now - min(replica_pending_since.values())
+
+def failover_log(name):
+    """Side log a replica appends its own ingest to, e.g. sensor_data_v3.failover.log."""
+    root, ext = os.path.splitext(name)
+    return root + '.failover' + ext
+
+def local_log(name):
+    """Log that locally ingested lines go to. A replica keeps its shipped logs
+    byte-identical to the primary's, so what it ingests during a failover goes
+    to a side log that the replays merge in."""
+    return failover_log(name) if replica_role == 'replica' else name
+
+def replica_following():
+    """True on a replica that has heard from its primary recently."""
+    last = replica_stats['last_heard']
+    return replica_role == 'replica' and last is not None and time.time() - last < REPLICA_TIMEOUT
+
+# --- primary side ---
+
+def ship_log(sock, name):
+    """Ship the next segment of one log; returns bytes shipped."""
+    try:
+        size = os.path.getsize(name)
+    except OSError:
+        return 0
+    with replica_lock:
+        offset = replica_offsets.get(name, 0)
+        if size < offset:
+            offset = 0    # replaced or truncated since; the replica treats 0 as a restart
+        replica_behind[name] = size - offset
+        if size == offset:
+            replica_pending_since.pop(name, None)
+            return 0
+        replica_pending_since.setdefault(name, time.time())
+    with open(name, 'rb') as f:
+        f.seek(offset)
+        chunk = f.read(REPLICA_SEGMENT_BYTES)
+        cut = chunk.rfind(b'\n') + 1
+        if not cut and len(chunk) == REPLICA_SEGMENT_BYTES:
+            chunk += f.readline()    # one line longer than a segment
+            cut = chunk.rfind(b'\n') + 1
+    if not cut:
+        return 0    # last line is still being written
+    started = time.time()
+    send_frame(sock, {'type': 'segment', 'file': name, 'offset': offset, 'end': size},
+               chunk[:cut])
+    ack, _ = recv_frame(sock)
+    now = time.time()
+    with replica_lock:
+        replica_offsets[name] = ack.get('offset', offset)
+        replica_behind[name] = max(0, size - replica_offsets[name])
+        if replica_offsets[name] >= size:
+            replica_pending_since.pop(name, None)
+        replica_stats['segments'] += 1
+        replica_stats['ack_ms'] = round((now - started) * 1000, 1)
+        count_replicated(cut, now)
+    return cut
+
+def ship_snapshot(sock, name):
+    """Ship a state file if it changed since the replica last got it."""
+    try:
+        st = os.stat(name)
+    except OSError:
+        return 0
+    key = (st.st_mtime_ns, st.st_size)
+    if replica_snapshot_keys.get(name) == key:
+        return 0
+    with open(name, 'rb') as f:
+        data = f.read()
+    try:
+        json.loads(data)
+    except ValueError:
+        return 0    # caught mid-save; try again on the next pass
+    replica_snapshot_keys[name] = key
+    digest = hashlib.sha1(data).hexdigest()
+    if replica_digests.get(name) == digest:
+        return 0
+    started = time.time()
+    send_frame(sock, {'type': 'snapshot', 'file': name, 'digest': digest}, data)
+    recv_frame(sock)
+    now = time.time()
+    with replica_lock:
+        replica_digests[name] = digest
+        replica_stats['snapshots'] += 1
+        replica_stats['ack_ms'] = round((now - started) * 1000, 1)
+        count_replicated(len(data), now)
+    return len(data)
+
+def ship_until_closed(sock):
+    last_sent = time.time()
+    while True:
+        shipped = sum(ship_log(sock, name) for name in REPLICATED_LOGS)
+        shipped += sum(ship_snapshot(sock, name) for name in REPLICATED_SNAPSHOTS)
+        now = time.time()
+        with replica_lock:
+            lag = replication_lag(now)
+            if lag > replica_stats['max_lag_s']:
+                replica_stats['max_lag_s'] = round(lag, 2)
+        if shipped:
+            last_sent = now
+            continue    # keep going until caught up
+        if now - last_sent >= REPLICA_HEARTBEAT:
+            send_frame(sock, {'type': 'heartbeat', 'sent_at': now,
+                              'sizes': {name: os.path.getsize(name) for name in REPLICATED_LOGS
+                                        if os.path.exists(name)}})
+            recv_frame(sock)
+            with replica_lock:
+                replica_stats['last_heard'] = time.time()
+            last_sent = now
+        replica_wakeup.wait(REPLICA_POLL)
+        replica_wakeup.clear()
+
+def run_replica_shipper():
+    host, _, port = REPLICA_ADDRESS.partition(':')
+    while True:
+        try:
+            with socket.create_connection((host, int(port or REPLICA_PORT)),
+                                          timeout=REPLICA_TIMEOUT) as sock:
+                hello, _ = recv_frame(sock)
+                ahead = [name for name, offset in (hello.get('offsets') or {}).items()
+                         if name in REPLICATED_LOGS and offset > (os.path.getsize(name)
+                                                                  if os.path.exists(name) else 0)]
+                if ahead:
+                    # A fresh primary would overwrite the standby's state files
+                    raise ValueError(f"replica holds more of {', '.join(ahead)} than this "
+                                     f"server; copy its data files here before shipping")
+                with replica_lock:
+                    replica_offsets.clear()
+                    replica_offsets.update(hello.get('offsets') or {})
+                    replica_digests.clear()
+                    replica_digests.update(hello.get('digests') or {})
+                    replica_snapshot_keys.clear()
+                    replica_stats.update(connected=True, peer=REPLICA_ADDRESS, last_error=None)
+                    replica_stats['connects'] += 1
+                print(f"Replica {REPLICA_ADDRESS} connected")
+                ship_until_closed(sock)
+        except (OSError, ValueError) as e:
+            with replica_lock:
+                if replica_stats['connected'] or replica_stats['last_error'] != str(e):
+                    print(f"Replica {REPLICA_ADDRESS} unavailable: {e}")
+                replica_stats.update(connected=False, last_error=str(e))
+        time.sleep(REPLICA_RETRY)
+
+def start_replica_shipper():
+    threading.Thread(target=run_replica_shipper, daemon=True).start()
+
+# --- replica side ---
+
+def load_replica_state():
+    if os.path.exists(REPLICA_STATE_FILE):
+        try:
+            with open(REPLICA_STATE_FILE, 'r') as f:
+                return json.load(f).get('offsets') or {}
+        except:
+            return {}
+    return {}
+
+def save_replica_state():
+    """Call with replica_lock held."""
+    tmp_path = REPLICA_STATE_FILE + '.tmp'
+    with open(tmp_path, 'w') as f:
+        json.dump({'offsets': replica_offsets}, f)
+    os.replace(tmp_path, REPLICA_STATE_FILE)
+
+def apply_replicated_line(name, line):
+    """Feed one shipped log line into live state, as the replay at startup would."""
+    try:
+        data = json.loads(line)
+    except ValueError:
+        return
+    if name == DATA_LOG_FILE or name == BACKFILL_LOG_FILE:
+        try:
+            t = datetime.fromisoformat(data['received_at']).timestamp()
+        except:
+            return
+        device_name = data.get('device_name', 'Unknown Device')
+        if name == BACKFILL_LOG_FILE:
+            merge_backfill(device_name, [{'t': t, 'sensors': data.get('sensors') or {}}])
+            return
+        # After a failover this replica may already hold newer readings
+        dev_id = latest_state.device_ids.get(device_name)
+        if dev_id is None or t > latest_state.received_at[dev_id]:
+            apply_logged_report(data, t)
+    elif name == BOOT_LOG_FILE:
+        if (isinstance(data.get('us'), dict) and 'first_report' in data['us'] and
+                (data.get('device_name'), data.get('boot_id')) not in boot_logged):
+            add_boot_profile(data)
+    elif name == FLIGHT_LOG_FILE:
+        add_flight_report(data)
+
+def reset_replicated_log(name):
+    """The primary's log shrank and is shipped again from the start: drop the
+    copy and what was built from it. Call with ingest_lock held."""
+    open(name, 'wb').close()
+    if name == BOOT_LOG_FILE:
+        boot_profiles.clear()
+        boot_logged.clear()
+        replay_boot_log()    # failover entries, if any
+    elif name == FLIGHT_LOG_FILE:
+        flight_reports.clear()
+        replay_flight_log()
+    # Data and backfill lines only apply when newer or into gaps, so the
+    # history built from them takes no duplicates when they come again
+
+def apply_segment(name, offset, payload):
+    """Append one shipped segment; returns the offset the replica now holds."""
+    with replica_lock:
+        expected = replica_offsets.get(name, 0)
+    if offset != expected:
+        if offset:
+            return expected    # out of step; the primary resumes from here
+        with replica_lock:
+            replica_stats['resets'] += 1
+        with ingest_lock:
+            reset_replicated_log(name)
+    with ingest_lock:
+        with open(name, 'ab') as f:
+            f.write(payload)
+            f.flush()
+            os.fsync(f.fileno())
+        for line in payload.splitlines():
+            apply_replicated_line(name, line)
+    with replica_lock:
+        replica_offsets[name] = offset + len(payload)
+        save_replica_state()
+        return replica_offsets[name]
+
+def apply_snapshot(name, payload):
+    tmp_path = name + '.tmp'
+    with open(tmp_path, 'wb') as f:
+        f.write(payload)
+    os.replace(tmp_path, name)
+    # The device registry notices the new file by itself
+    if name == TODO_FILE:
+        for item in todo_list:
+            search_index.remove(('todo', item['id']))
+        todo_list[:] = load_todos()
+        for item in todo_list:
+            index_todo(item)
+        data_versions['todo'] += 1
+    elif name == NOTES_FILE:
+        for note in notes_list:
+            search_index.remove(('note', note['id']))
+        notes_list[:] = load_notes()
+        for note in notes_list:
+            index_note(note)
+        data_versions['notes'] += 1
+    elif name == TIMERS_FILE:
+        with timers_lock:
+            for timer in timers_list:
+                timer_wheel.cancel(timer['id'])
+            timers_list[:] = load_timers()
+            for timer in timers_list:
+                if timer.get('running') and timer.get('deadline'):
+                    arm_timer(timer)
+            data_versions['timers'] += 1
+    elif name == MUSIC_FILE:
+        music_queue.clear()
+        music_queue.update(load_music_queue())
+        data_versions['music'] += 1
+
+def run_replica_link(sock, address):
+    sock.settimeout(REPLICA_TIMEOUT)
+    with replica_lock:
+        replica_stats.update(connected=True, peer=address[0], last_error=None,
+                             last_heard=time.time())
+        replica_stats['connects'] += 1
+        hello = {'type': 'hello', 'offsets': dict(replica_offsets)}
+    hello['digests'] = {name: file_digest(name) for name in REPLICATED_SNAPSHOTS}
+    print(f"Replicating from primary {address[0]}")
+    try:
+        send_frame(sock, hello)
+        while True:
+            header, payload = recv_frame(sock)
+            kind, name = header.get('type'), header.get('file')
+            ack = {'type': 'ack'}
+            if kind == 'segment' and name in REPLICATED_LOGS and isinstance(header.get('offset'), int):
+                ack['offset'] = apply_segment(name, header.get('offset'), payload)
+                with replica_lock:
+                    replica_behind[name] = max(0, header.get('end', 0) - ack['offset'])
+                    replica_stats['segments'] += 1
+            elif kind == 'snapshot' and name in REPLICATED_SNAPSHOTS:
+                apply_snapshot(name, payload)
+                with replica_lock:
+                    replica_stats['snapshots'] += 1
+            elif kind == 'heartbeat':
+                with replica_lock:
+                    for log, size in (header.get('sizes') or {}).items():
+                        if log in REPLICATED_LOGS:
+                            replica_behind[log] = max(0, size - replica_offsets.get(log, 0))
+            else:
+                raise ValueError(f"unexpected {kind} frame")
+            with replica_lock:
+                count_replicated(len(payload), time.time())
+            send_frame(sock, ack)
+    except (OSError, ValueError) as e:
+        with replica_lock:
+            replica_stats['last_error'] = str(e)
+        print(f"Primary {address[0]} link closed: {e}")
+    finally:
+        with replica_lock:
+            replica_stats['connected'] = False
+        sock.close()
+
+def run_replica_listener(port, primary):
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('0.0.0.0', port))
+    server.listen(1)
+    while True:
+        sock, address = server.accept()
+        if primary and address[0] != primary:
+            sock.close()
+            continue
+        run_replica_link(sock, address)    # one primary at a time
+
+def start_replica_listener(port, primary=None):
+    global replica_role
+    replica_role = 'replica'
+    replica_offsets.update(load_replica_state())
+    threading.Thread(target=run_replica_listener, args=(port, primary), daemon=True).start()
+
+def replication_summary():
+    now = time.time()
+    with replica_lock:
+        summary = dict(replica_stats, role=replica_role,
+                       behind_bytes=sum(replica_behind.values()),
+                       bytes_per_s=round(sum(n for _, n in replica_rate) / REPLICA_RATE_WINDOW),
+                       offsets=dict(replica_offsets))
+        last = summary.pop('last_heard')
+        summary['last_heard_s'] = round(now - last, 1) if last else None
+        if replica_role == 'primary':
+            lag = replication_lag(now)
+            summary['lag_s'] = round(lag, 2)
+            summary['lagging'] = lag > REPLICA_MAX_LAG or not replica_stats['connected']
+    return summary
 
 # ============================================
 # SENSOR INTERPRETATION FUNCTIONS
@@ -224,24 +3227,13 @@ def interpret_light(lux):
 
 def get_room_data():
     rooms = {}
-    for room_name, device_list in ROOM_CONFIG.items():
-        merged_sensors = {}
-        latest_timestamp = None
-        for device_name in device_list:
-            if device_name in latest_readings:
-                device_data = latest_readings[device_name]
-                sensors = device_data.get('sensors', {})
-                timestamp = device_data.get('received_at')
-                for key, value in sensors.items():
-                    if value is not None:
-                        merged_sensors[key] = value
-                if timestamp:
-                    if latest_timestamp is None or timestamp > latest_timestamp:
-                        latest_timestamp = timestamp
-        if merged_sensors:
+    device_registry.refresh()
+    for room_name, device_list in device_registry.room_devices.items():
+        fused = room_fusion.room(room_name, device_list)
+        if fused['sensors']:
             rooms[room_name] = {
-                'sensors': merged_sensors,
-                'received_at': latest_timestamp
+                'sensors': fused['sensors'],
+                'received_at': format_timestamp(fused['received_at'])
             }
     return rooms
 
@@ -669,6 +3661,27 @@ def get_base_styles():
             0%, 50% { opacity: 1; }
             51%, 100% { opacity: 0.3; }
         }
+        .pager {
+            display: flex;
+            justify-content: space-between;
+            align-items: center;
+            color: #888;
+            margin-top: 8px;
+        }
+        .timer-alert {
+            position: fixed;
+            top: 20px;
+            left: 50%;
+            transform: translateX(-50%);
+            background: #ff4444;
+            color: #fff;
+            padding: 16px 28px;
+            border-radius: 12px;
+            font-size: 20px;
+            font-weight: bold;
+            z-index: 1000;
+            cursor: pointer;
+        }
 
         /* Music Player */
         .now-playing {
@@ -743,55 +3756,321 @@ def get_base_styles():
             background: linear-gradient(90deg, #00d9ff, #00ff88);
             transition: width 0.3s;
         }
+
+        /* History Charts */
+        .chart {
+            width: 100%;
+            height: 160px;
+            background: rgba(255,255,255,0.03);
+            border-radius: 12px;
+            margin: 8px 0 20px 0;
+        }
+        .waterfall {
+            width: 100%;
+            height: 300px;
+            background: #000;
+            border-radius: 12px;
+            margin: 8px 0;
+        }
+        .heatmap {
+            display: grid;
+            grid-template-columns: 40px repeat(24, 1fr);
+            gap: 2px;
+            margin: 8px 0 20px 0;
+            font-size: 0.7rem;
+            color: #666;
+        }
+        .heat-cell {
+            height: 14px;
+            border-radius: 2px;
+            background: rgba(255,255,255,0.03);
+        }
     </style>
     """
 
 # ============================================
-# HOME PAGE
+# PAGE TEMPLATES & FRAGMENT CACHE
 # ============================================
-@app.route('/')
-def home():
-    rooms = get_room_data()
-    current_time = datetime.now().strftime('%I:%M %p')
-    current_date = datetime.now().strftime('%A, %b %d')
-
-    weather, forecast = fetch_weather()
-    weather_temp = weather['main']['temp'] if weather else "N/A"
-    weather_desc = weather['weather'][0]['description'].title() if weather else "Loading..."
-    weather_icon = get_weather_icon(weather['weather'][0]['icon']) if weather else "🌡️"
-
-    # Room emoji mapping
-    room_icons = {
-        "Bedroom": "🛏️",
-        "Living Room": "🛋️",
-        "Kitchen": "🍳",
-        "Office": "💼",
-        "Bathroom": "🚿"
-    }
-
-    # Get current playing track
-    current_track = None
-    if music_queue['queue'] and music_queue['current_index'] < len(music_queue['queue']):
-        current_track = music_queue['queue'][music_queue['current_index']]
-
-    html = f"""
+# The page shell (doctype, styles, header, refresh script) is assembled from
+# strings built once at startup. Page bodies are split into fragments cached
+# against the version of the data they show, so a page whose data hasn't
+# changed is a handful of string joins instead of a full re-render.
+PAGE_STYLES = get_base_styles()
+PAGE_OPEN = """
     <!DOCTYPE html>
     <html>
     <head>
-        <title>HomePOD Dashboard</title>
-        {get_base_styles()}
+        <title>"""
+PAGE_HEAD = "</title>\n" + PAGE_STYLES
+PAGE_BODY = """
     </head>
     <body>
+"""
+PAGE_CLOSE = """
+        <script>
+            (function() {
+                if (!window.EventSource) return;
+                const events = new EventSource('/api/events');
+                events.addEventListener('timer', (e) => {
+                    const data = JSON.parse(e.data);
+                    document.dispatchEvent(new CustomEvent('homepod-timer', {detail: data}));
+                    if (data.type !== 'expired') return;
+                    const banner = document.createElement('div');
+                    banner.className = 'timer-alert';
+                    banner.textContent = '⏰ ' + data.name + ' finished';
+                    banner.onclick = () => banner.remove();
+                    document.body.appendChild(banner);
+                    if ('vibrate' in navigator) navigator.vibrate([300, 100, 300]);
+                });
+                events.addEventListener('noise', (e) => {
+                    const data = JSON.parse(e.data);
+                    if (data.confidence === 'low') return;
+                    const banner = document.createElement('div');
+                    banner.className = 'timer-alert';
+                    banner.textContent = '🔊 Loud noise: ' + (data.source_room || data.source_device);
+                    banner.onclick = () => banner.remove();
+                    document.body.appendChild(banner);
+                    setTimeout(() => banner.remove(), 8000);
+                });
+            })();
+        </script>
+    </body>
+    </html>
+    """
+REFRESH_SCRIPT = """
+        <script>
+            setTimeout(() => location.reload(), %d);
+        </script>"""
+SYSTEM_STATS_TTL = 5  # seconds; matches the system page refresh
+
+fragment_cache = {}
+
+def cached_fragment(key, version, render):
+    """Return render()'s output, re-rendering only when version changes."""
+    entry = fragment_cache.get(key)
+    if entry is not None and entry[0] == version:
+        return entry[1]
+    html = render()
+    fragment_cache[key] = (version, html)
+    return html
+
+def render_page(title, body, head_extra='', refresh_ms=None):
+    parts = [PAGE_OPEN, title, PAGE_HEAD, head_extra, PAGE_BODY, body]
+    if refresh_ms:
+        parts.append(REFRESH_SCRIPT % refresh_ms)
+    parts.append(PAGE_CLOSE)
+    return ''.join(parts)
+
+def render_header(title, back='/'):
+    return f"""
+        <div class="header">
+            <a href="{back}" class="back-btn">←</a>
+            <div class="page-title">{title}</div>
+            <div style="width: 60px;"></div>
+        </div>
+    """
+
+LIST_PAGE_SIZE = 50
+
+def page_number(total):
+    """Current ?page= argument clamped to the pages that exist."""
+    try:
+        page = int(request.args.get('page', 1))
+    except ValueError:
+        page = 1
+    pages = max(1, -(-total // LIST_PAGE_SIZE))
+    return min(max(page, 1), pages), pages
+
+def render_pager(base, page, pages):
+    if pages <= 1:
+        return ''
+    prev_link = f'<a href="{base}?page={page - 1}" class="btn btn-secondary">← Prev</a>' if page > 1 else '<span></span>'
+    next_link = f'<a href="{base}?page={page + 1}" class="btn btn-secondary">Next →</a>' if page < pages else '<span></span>'
+    return f"""
+        <div class="pager">
+            {prev_link}
+            <span>Page {page} of {pages}</span>
+            {next_link}
+        </div>
+    """
+
+def render_search_form(query=''):
+    return f"""
+        <form action="/search" method="GET" class="input-group" style="margin-bottom: 16px;">
+            <input type="search" name="q" class="input" placeholder="Search notes and tasks..." value="{query}">
+            <button type="submit" class="btn btn-secondary">🔍</button>
+        </form>
+    """
+
+def rooms_version():
+    """Version of everything get_room_data() depends on."""
+    device_registry.refresh()
+    room_fusion.sync_registry()
+    return room_fusion.version
+
+ROOM_ICONS = {
+    "Bedroom": "🛏️",
+    "Living Room": "🛋️",
+    "Kitchen": "🍳",
+    "Office": "💼",
+    "Bathroom": "🚿"
+}
+
+# ============================================
+# RESPONSE COMPRESSION
+# ============================================
+# HTML responses are compressed according to Accept-Encoding (Brotli when
+# the brotli module is installed, else gzip). The compressed body is cached
+# per (path, encoding) next to the page's checksum, which doubles as the
+# ETag, so an unchanged page is compressed once and revalidating clients
+# get a 304.
+GZIP_LEVEL = 6
+BROTLI_QUALITY = 5
+COMPRESS_MIN_SIZE = 512
+COMPRESS_CACHE_SIZE = 64
+
+compressed_cache = {}   # (path, encoding) -> (etag, body)
+compress_lock = threading.Lock()   # guards compressed_cache and compression_stats
+compression_stats = {
+    'gzip_level': GZIP_LEVEL,
+    'brotli_quality': BROTLI_QUALITY if brotli else None,
+    'compressed': 0,
+    'cache_hits': 0,
+    'not_modified': 0,
+    'bytes_in': 0,
+    'bytes_out': 0,
+    'cpu_ms': 0.0
+}
+
+def choose_encoding(accept_encoding):
+    accepted = {}
+    for part in accept_encoding.split(','):
+        name, _, params = part.strip().partition(';')
+        q = 1.0
+        if params.strip().startswith('q='):
+            try:
+                q = float(params.strip()[2:])
+            except ValueError:
+                q = 0.0
+        accepted[name.strip().lower()] = q
+    if brotli and accepted.get('br', 0) > 0:
+        return 'br'
+    if accepted.get('gzip', 0) > 0:
+        return 'gzip'
+    return None
+
+def compress_body(body, encoding):
+    start = time.thread_time()
+    if encoding == 'br':
+        out = brotli.compress(body, quality=BROTLI_QUALITY)
+    else:
+        out = gzip.compress(body, compresslevel=GZIP_LEVEL, mtime=0)
+    with compress_lock:
+        compression_stats['cpu_ms'] += (time.thread_time() - start) * 1000
+        compression_stats['compressed'] += 1
+        compression_stats['bytes_in'] += len(body)
+        compression_stats['bytes_out'] += len(out)
+    return out
+
+@app.after_request
+def compress_response(response):
+    if (response.status_code != 200 or response.mimetype != 'text/html'
+            or response.direct_passthrough or 'Content-Encoding' in response.headers):
+        return response
+
+    body = response.get_data()
+    encoding = choose_encoding(request.headers.get('Accept-Encoding', ''))
+    if len(body) < COMPRESS_MIN_SIZE:
+        encoding = None
+    etag = '"%08x-%s"' % (zlib.crc32(body), encoding or 'id')
+    response.headers['ETag'] = etag
+    response.headers['Vary'] = 'Accept-Encoding'
+
+    if request.headers.get('If-None-Match') == etag:
+        with compress_lock:
+            compression_stats['not_modified'] += 1
+        response.set_data(b'')
+        response.status_code = 304
+        return response
+    if encoding is None:
+        return response
+
+    key = (request.full_path, encoding)
+    with compress_lock:
+        cached = compressed_cache.get(key)
+        if cached is not None and cached[0] == etag:
+            compression_stats['cache_hits'] += 1
+    if cached is not None and cached[0] == etag:
+        compressed = cached[1]
+    else:
+        # Compressed outside the lock; a concurrent miss just does it twice
+        compressed = compress_body(body, encoding)
+        with compress_lock:
+            compressed_cache.pop(key, None)
+            if len(compressed_cache) >= COMPRESS_CACHE_SIZE:
+                compressed_cache.pop(next(iter(compressed_cache)))
+            compressed_cache[key] = (etag, compressed)
+
+    response.set_data(compressed)
+    response.headers['Content-Encoding'] = encoding
+    return response
+
+# ============================================
+# HOME PAGE
+# ============================================
+@app.route('/')
+def home():
+    now = datetime.now()
+    weather, forecast = fetch_weather()
+
+    body = [f"""
         <div class="header">
             <div class="page-title">🏠 HomePOD</div>
             <div class="time-display">
-                <div class="time">{current_time}</div>
-                <div>{current_date}</div>
+                <div class="time">{now.strftime('%I:%M %p')}</div>
+                <div>{now.strftime('%A, %b %d')}</div>
             </div>
         </div>
 
         <div class="section-title">Apps</div>
         <div class="grid">
+    """]
+    body.append(cached_fragment('home:weather', weather_cache['last_update'],
+                                lambda: render_home_weather_card(weather)))
+    body.append(cached_fragment('home:apps',
+                                (data_versions['todo'], data_versions['timers'],
+                                 data_versions['notes'], data_versions['music']),
+                                render_home_app_cards))
+    body.append(f"""
+            <a href="/system" class="card">
+                <div class="card-header">
+                    <div>
+                        <div class="card-title">System Stats</div>
+                        <div class="card-value" style="font-size: 1.8rem;">{get_cpu_temp() or 'N/A'}°C</div>
+                        <div class="card-subtitle">CPU Temperature</div>
+                    </div>
+                    <div class="card-icon">📊</div>
+                </div>
+            </a>
+    """)
+    body.append(cached_fragment('home:devices', device_registry.version, render_home_devices_card))
+    body.append("""
+        </div>
+
+        <div class="section-title">Rooms</div>
+        <div class="grid">
+    """)
+    body.append(cached_fragment('home:rooms', rooms_version(), render_home_rooms))
+    body.append("""
+        </div>
+    """)
+    return render_page('HomePOD Dashboard', ''.join(body), refresh_ms=10000)
+
+def render_home_weather_card(weather):
+    weather_temp = weather['main']['temp'] if weather else "N/A"
+    weather_desc = weather['weather'][0]['description'].title() if weather else "Loading..."
+    weather_icon = get_weather_icon(weather['weather'][0]['icon']) if weather else "🌡️"
+    return f"""
             <a href="/weather" class="card">
                 <div class="card-header">
                     <div>
@@ -804,7 +4083,15 @@ def home():
                     </div>
                 </div>
             </a>
+    """
+
+def render_home_app_cards():
+    # Get current playing track
+    current_track = None
+    if music_queue['queue'] and music_queue['current_index'] < len(music_queue['queue']):
+        current_track = music_queue['queue'][music_queue['current_index']]
 
+    return f"""
             <a href="/todo" class="card">
                 <div class="card-header">
                     <div>
@@ -848,43 +4135,43 @@ def home():
                     <div class="card-icon">🎵</div>
                 </div>
             </a>
+    """
 
-            <a href="/system" class="card">
+def render_home_devices_card():
+    return f"""
+            <a href="/devices" class="card">
                 <div class="card-header">
                     <div>
-                        <div class="card-title">System Stats</div>
-                        <div class="card-value" style="font-size: 1.8rem;">{get_cpu_temp() or 'N/A'}°C</div>
-                        <div class="card-subtitle">CPU Temperature</div>
+                        <div class="card-title">Devices</div>
+                        <div class="card-value">{len(device_registry.device_room)}</div>
+                        <div class="card-subtitle">{sum(1 for r in device_registry.device_room.values() if not r)} unassigned</div>
                     </div>
-                    <div class="card-icon">📊</div>
+                    <div class="card-icon">📡</div>
                 </div>
             </a>
-        </div>
-
-        <div class="section-title">Rooms</div>
-        <div class="grid">
     """
 
+def render_home_rooms():
+    rooms = get_room_data()
     if not rooms:
-        html += '<div class="no-data">⏳ Waiting for sensor data...</div>'
-    else:
-        for room_name, data in rooms.items():
-            sensors = data['sensors']
-            room_icon = room_icons.get(room_name, "🏠")
-            temp = sensors.get('temperature', 'N/A')
-            humidity = sensors.get('humidity', 'N/A')
-            light = sensors.get('light')
-            audio_peak = sensors.get('audio_peak')
+        return '<div class="no-data">⏳ Waiting for sensor data...</div>'
 
-            if isinstance(temp, (int, float)):
-                temp = f"{temp:.1f}°C"
-            if isinstance(humidity, (int, float)):
-                humidity = f"{humidity:.0f}%"
+    html = ''
+    for room_name, data in rooms.items():
+        sensors = data['sensors']
+        room_icon = ROOM_ICONS.get(room_name, "🏠")
+        temp = sensors.get('temperature', 'N/A')
+        humidity = sensors.get('humidity', 'N/A')
+        light = sensors.get('light')
 
-            light_label = interpret_light(light) or "N/A"
-            audio_label = interpret_audio(audio_peak) or "N/A"
+        if isinstance(temp, (int, float)):
+            temp = f"{temp:.1f}°C"
+        if isinstance(humidity, (int, float)):
+            humidity = f"{humidity:.0f}%"
 
-            html += f"""
+        light_label = interpret_light(light) or "N/A"
+
+        html += f"""
             <a href="/room/{room_name}" class="card">
                 <div class="card-header">
                     <div>
@@ -905,38 +4192,20 @@ def home():
                 </div>
             </a>
             """
-
-    html += """
-        </div>
-        <script>
-            setTimeout(() => location.reload(), 10000);
-        </script>
-    </body>
-    </html>
-    """
     return html
 
 # ============================================
-# WEATHER PAGE (unchanged, keeping for completeness)
+# WEATHER PAGE
 # ============================================
 @app.route('/weather')
 def weather_page():
     current, forecast = fetch_weather()
+    body = cached_fragment('weather', weather_cache['last_update'],
+                           lambda: render_weather_body(current, forecast))
+    return render_page('Weather', body, refresh_ms=10000)
 
-    html = f"""
-    <!DOCTYPE html>
-    <html>
-    <head>
-        <title>Weather</title>
-        {get_base_styles()}
-    </head>
-    <body>
-        <div class="header">
-            <a href="/" class="back-btn">←</a>
-            <div class="page-title">Weather</div>
-            <div style="width: 60px;"></div>
-        </div>
-    """
+def render_weather_body(current, forecast):
+    html = render_header('Weather')
 
     if current:
         temp = current['main']['temp']
@@ -1007,52 +4276,39 @@ def weather_page():
 
         html += "</div>"
 
-    html += """
-        <script>
-            setTimeout(() => location.reload(), 10000);
-        </script>
-    </body>
-    </html>
-    """
     return html
 
 # ============================================
-# ROOM DETAIL PAGE (unchanged)
+# ROOM DETAIL PAGE
 # ============================================
 @app.route('/room/<room_name>')
 def room_detail(room_name):
-    rooms = get_room_data()
-    room_data = rooms.get(room_name)
+    range_name = request.args.get('range', '24h')
+    if range_name not in HISTORY_RANGES:
+        range_name = '24h'
 
+    version = rooms_version()
+    room_data = get_room_data().get(room_name)
     if not room_data:
         return redirect('/')
 
+    sensors = room_data['sensors']
+    body = cached_fragment('room:' + room_name, version,
+                           lambda: render_room_sensors(room_name, room_data))
+    # Chart layout only depends on which channels the room has
+    charts = [c for c in CHART_CHANNELS if c[0] in sensors]
+    body += cached_fragment(('room-history', room_name, range_name), tuple(c[0] for c in charts),
+                            lambda: render_room_history(room_name, range_name, charts))
+    body += cached_fragment(('room-profile', room_name), room_profiles.version,
+                            lambda: render_room_profile(room_name))
+    return render_page(room_name, body, refresh_ms=10000)
+
+def render_room_sensors(room_name, room_data):
     sensors = room_data['sensors']
     timestamp = room_data.get('received_at', 'Unknown')
+    room_icon = ROOM_ICONS.get(room_name, "🏠")
 
-    room_icons = {
-        "Bedroom": "🛏️",
-        "Living Room": "🛋️",
-        "Kitchen": "🍳",
-        "Office": "💼",
-        "Bathroom": "🚿"
-    }
-    room_icon = room_icons.get(room_name, "🏠")
-
-    html = f"""
-    <!DOCTYPE html>
-    <html>
-    <head>
-        <title>{room_name}</title>
-        {get_base_styles()}
-    </head>
-    <body>
-        <div class="header">
-            <a href="/" class="back-btn">←</a>
-            <div class="page-title">{room_icon} {room_name}</div>
-            <div style="width: 60px;"></div>
-        </div>
-
+    html = render_header(f"{room_icon} {room_name}") + """
         <div class="detail-card">
             <div class="section-title">Temperature & Humidity</div>
             <div class="sensor-grid">
@@ -1061,7 +4317,6 @@ def room_detail(room_name):
     temp = sensors.get('temperature')
     humidity = sensors.get('humidity')
     light = sensors.get('light')
-    audio_level = sensors.get('audio_level')
     audio_peak = sensors.get('audio_peak')
 
     if temp is not None:
@@ -1090,13 +4345,21 @@ def room_detail(room_name):
         </div>
         """
 
-    if audio_peak is not None:
-        audio_label = interpret_audio(audio_peak)
+    scene = sound_scene(sensors) if sound_scene_trusted(room_name) else None
+    if audio_peak is not None or scene:
+        # Nodes whose classifier was trained on real captures name the
+        # scene; synthetic-only models and older firmware show the peak level
+        if scene:
+            audio_label = scene[0]
+            audio_detail = f"{scene[1]:.0%} of the time"
+        else:
+            audio_label = interpret_audio(audio_peak)
+            audio_detail = f"Peak: {audio_peak}"
         html += f"""
         <div class="sensor-item">
             <div class="sensor-label">🔊 Sound</div>
             <div class="sensor-value">{audio_label}</div>
-            <div class="card-subtitle">Peak: {audio_peak}</div>
+            <div class="card-subtitle">{audio_detail} · <a href="/room/{room_name}/sound" style="color: #00ff88;">Live</a></div>
         </div>
         """
 
@@ -1107,34 +4370,191 @@ def room_detail(room_name):
                 Last updated: {timestamp}
             </div>
         </div>
+    """
+    return html
+
+@app.route('/room/<room_name>/sound')
+def room_sound(room_name):
+    # No auto-refresh here: a reload would drop the streams and their leases
+    mics = [d for d in device_registry.room_devices.get(room_name, ())
+            if latest_state.get(d, 'audio_peak') is not None]
+    body = render_header(f"🎚️ {room_name} Sound", back=f'/room/{room_name}')
+    if not mics:
+        body += '<div class="no-data">🔇 No microphone in this room.</div>'
+    for device_name in mics:
+        body += f"""
+        <div class="detail-card">
+            <div class="section-title">{device_name}</div>
+            <canvas class="waterfall" data-device="{device_name}" width="{CHART_WIDTH_PX}" height="300"></canvas>
+            <div class="card-subtitle">Low ← frequency → high · newest on top · starts within one report interval</div>
+        </div>
+        """
+    body += f"<script>{WATERFALL_SCRIPT}</script>"
+    return render_page(f'{room_name} Sound', body)
+
+WATERFALL_SCRIPT = """
+            function startWaterfall(canvas) {
+                const ctx = canvas.getContext('2d');
+                const w = canvas.width, h = canvas.height;
+                const row = ctx.createImageData(w, 1);
+                function drawRow(bands) {
+                    ctx.drawImage(canvas, 0, 0, w, h - 1, 0, 1, w, h - 1);
+                    for (let x = 0; x < w; x++) {
+                        const v = bands[Math.floor(x * bands.length / w)];
+                        const i = x * 4;
+                        row.data[i] = v;
+                        row.data[i + 1] = v > 128 ? (v - 128) * 2 : 0;
+                        row.data[i + 2] = v < 128 ? v * 2 : (255 - v) * 2;
+                        row.data[i + 3] = 255;
+                    }
+                    ctx.putImageData(row, 0, 0);
+                }
+                fetch('/api/waterfall/' + encodeURIComponent(canvas.dataset.device)).then(resp => {
+                    const reader = resp.body.getReader();
+                    let buf = new Uint8Array(0);
+                    function pump() {
+                        return reader.read().then(({done, value}) => {
+                            if (done) return;
+                            const merged = new Uint8Array(buf.length + value.length);
+                            merged.set(buf);
+                            merged.set(value, buf.length);
+                            let off = 0;
+                            // Frame: band count, reserved, seq (u16), band bytes
+                            while (merged.length - off >= 4 && merged.length - off >= 4 + merged[off]) {
+                                const bands = merged[off];
+                                if (bands) drawRow(merged.subarray(off + 4, off + 4 + bands));
+                                off += 4 + bands;
+                            }
+                            buf = merged.slice(off);
+                            return pump();
+                        });
+                    }
+                    return pump();
+                });
+            }
+            document.querySelectorAll('canvas.waterfall').forEach(startWaterfall);
+"""
+
+def render_room_history(room_name, range_name, charts):
+    html = """
+        <div class="detail-card">
+            <div class="section-title">History</div>
+            <div class="input-group">
+    """
+    for name in HISTORY_RANGES:
+        btn_class = 'btn-primary' if name == range_name else 'btn-secondary'
+        html += f'<a href="?range={name}" class="btn {btn_class}">{name}</a>'
+    html += '</div>'
+
+    for channel, label, unit in charts:
+        html += f"""
+            <div class="sensor-label">{label}</div>
+            <canvas class="chart" data-channel="{channel}" data-unit="{unit}" width="{CHART_WIDTH_PX}" height="160"></canvas>
+            """
+
+    html += f"""
+        </div>
 
         <script>
-            setTimeout(() => location.reload(), 10000);
+            const ROOM = {json.dumps(room_name)};
+            const RANGE = {json.dumps(range_name)};
+            const RANGE_SECONDS = {HISTORY_RANGES[range_name]};
+            {CHART_SCRIPT}
         </script>
-    </body>
-    </html>
     """
     return html
 
+WEEKDAY_LABELS = ['Mon', 'Tue', 'Wed', 'Thu', 'Fri', 'Sat', 'Sun']
+
+def render_room_profile(room_name):
+    profile = room_profiles.rooms.get(room_name)
+    if profile is None:
+        return ''
+    html = """
+        <div class="detail-card">
+            <div class="section-title">Typical Week</div>
+    """
+    for metric, label, unit in PROFILE_METRICS:
+        values = profile.metric(metric)
+        known = [v for v in values if v is not None]
+        if not known:
+            continue
+        lo, hi = min(known), max(known)
+        span = (hi - lo) or 1.0
+        html += f'<div class="sensor-label">{label}</div><div class="heatmap"><span></span>'
+        html += ''.join(f'<span class="heat-hour">{h if h % 6 == 0 else ""}</span>' for h in range(24))
+        for day in range(7):
+            html += f'<span class="heat-day">{WEEKDAY_LABELS[day]}</span>'
+            for v in values[day * 24:day * 24 + 24]:
+                if v is None:
+                    html += '<span class="heat-cell"></span>'
+                else:
+                    alpha = 0.1 + 0.9 * (v - lo) / span
+                    html += (f'<span class="heat-cell" style="background: rgba(0,255,136,{alpha:.2f})"'
+                             f' title="{v:g}{unit}"></span>')
+        html += '</div>'
+    html += """
+        </div>
+    """
+    return html
+
+CHART_CHANNELS = [
+    ('temperature', '🌡️ Temperature', '°C'),
+    ('humidity', '💧 Humidity', '%'),
+    ('light', '💡 Light', ' lux'),
+    ('audio_peak', '🔊 Sound Peak', ''),
+]
+
+CHART_SCRIPT = """
+            function drawChart(canvas, buf) {
+                const view = new DataView(buf);
+                const ctx = canvas.getContext('2d');
+                const w = canvas.width, h = canvas.height;
+                const n = Math.floor((buf.byteLength - 8) / 8);
+                ctx.clearRect(0, 0, w, h);
+                ctx.font = '14px sans-serif';
+                if (n < 2) {
+                    ctx.fillStyle = '#666';
+                    ctx.fillText('No history yet', 12, h / 2);
+                    return;
+                }
+                const xs = new Float32Array(n), ys = new Float32Array(n);
+                let lo = Infinity, hi = -Infinity;
+                for (let i = 0; i < n; i++) {
+                    xs[i] = view.getFloat32(8 + i * 8, true);
+                    ys[i] = view.getFloat32(12 + i * 8, true);
+                    lo = Math.min(lo, ys[i]);
+                    hi = Math.max(hi, ys[i]);
+                }
+                if (hi - lo < 0.1) { hi += 0.5; lo -= 0.5; }
+                const end = xs[n - 1];
+                ctx.strokeStyle = '#00d9ff';
+                ctx.lineWidth = 2;
+                ctx.beginPath();
+                for (let i = 0; i < n; i++) {
+                    const x = w - 1 - (end - xs[i]) / RANGE_SECONDS * (w - 1);
+                    const y = h - 8 - (ys[i] - lo) / (hi - lo) * (h - 32);
+                    if (i === 0) ctx.moveTo(x, y); else ctx.lineTo(x, y);
+                }
+                ctx.stroke();
+                ctx.fillStyle = '#888';
+                ctx.fillText(hi.toFixed(1) + canvas.dataset.unit, 8, 16);
+                ctx.fillText(lo.toFixed(1) + canvas.dataset.unit, 8, h - 10);
+            }
+
+            document.querySelectorAll('canvas.chart').forEach(canvas => {
+                fetch('/api/history/' + encodeURIComponent(ROOM) + '/' + canvas.dataset.channel + '?range=' + RANGE)
+                    .then(r => r.arrayBuffer())
+                    .then(buf => drawChart(canvas, buf));
+            });
+"""
+
 # ============================================
-# TO-DO LIST PAGE (unchanged)
+# TO-DO LIST PAGE
 # ============================================
 @app.route('/todo')
 def todo_page():
-    html = f"""
-    <!DOCTYPE html>
-    <html>
-    <head>
-        <title>To-Do List</title>
-        {get_base_styles()}
-    </head>
-    <body>
-        <div class="header">
-            <a href="/" class="back-btn">←</a>
-            <div class="page-title">✅ To-Do List</div>
-            <div style="width: 60px;"></div>
-        </div>
-
+    body = render_header('✅ To-Do List') + render_search_form() + """
         <div class="detail-card">
             <form action="/todo/add" method="POST" class="input-group">
                 <input type="text" name="text" class="input" placeholder="Add a new task..." required>
@@ -1144,48 +4564,57 @@ def todo_page():
 
         <div class="item-list">
     """
+    page, pages = page_number(len(todo_list))
+    body += cached_fragment(f'todo:list:{page}', data_versions['todo'],
+                            lambda: render_todo_items(page))
+    body += """
+        </div>
+    """ + render_pager('/todo', page, pages)
+    return render_page('To-Do List', body)
 
+def render_todo_items(page=1):
     if not todo_list:
-        html += '<div class="no-data">📝 No tasks yet. Add one above!</div>'
-    else:
-        for item in todo_list:
-            item_id = item['id']
-            text = item['text']
-            completed = item.get('completed', False)
-            completed_class = 'completed' if completed else ''
+        return '<div class="no-data">📝 No tasks yet. Add one above!</div>'
 
-            html += f"""
-            <div class="item {completed_class}">
-                <div class="item-text">{text}</div>
-                <div class="item-actions">
-                    <form action="/todo/toggle/{item_id}" method="POST" style="display:inline;">
-                        <button type="submit" class="btn btn-icon btn-secondary">
-                            {'✓' if not completed else '↩'}
-                        </button>
-                    </form>
-                    <form action="/todo/delete/{item_id}" method="POST" style="display:inline;">
-                        <button type="submit" class="btn btn-icon btn-secondary">🗑️</button>
-                    </form>
-                </div>
-            </div>
-            """
+    start = (page - 1) * LIST_PAGE_SIZE
+    html = ''
+    for item in todo_list[start:start + LIST_PAGE_SIZE]:
+        html += render_todo_item(item)
+    return html
 
-    html += """
+def render_todo_item(item):
+    item_id = item['id']
+    text = item['text']
+    completed = item.get('completed', False)
+    completed_class = 'completed' if completed else ''
+
+    return f"""
+        <div class="item {completed_class}">
+            <div class="item-text">{text}</div>
+            <div class="item-actions">
+                <form action="/todo/toggle/{item_id}" method="POST" style="display:inline;">
+                    <button type="submit" class="btn btn-icon btn-secondary">
+                        {'✓' if not completed else '↩'}
+                    </button>
+                </form>
+                <form action="/todo/delete/{item_id}" method="POST" style="display:inline;">
+                    <button type="submit" class="btn btn-icon btn-secondary">🗑️</button>
+                </form>
+            </div>
         </div>
-    </body>
-    </html>
-    """
-    return html
+        """
 
 @app.route('/todo/add', methods=['POST'])
 def todo_add():
     text = request.form.get('text', '').strip()
     if text:
-        todo_list.append({
+        item = {
             'id': str(uuid.uuid4()),
             'text': text,
             'completed': False
-        })
+        }
+        todo_list.append(item)
+        index_todo(item)
         save_todos(todo_list)
     return redirect('/todo')
 
@@ -1202,20 +4631,20 @@ def todo_toggle(item_id):
 def todo_delete(item_id):
     global todo_list
     todo_list = [item for item in todo_list if item['id'] != item_id]
+    search_index.remove(('todo', item_id))
     save_todos(todo_list)
     return redirect('/todo')
 
 # ============================================
-# TIMERS PAGE (unchanged)
+# TIMERS PAGE
 # ============================================
 @app.route('/timers')
 def timers_page():
-    html = f"""
-    <!DOCTYPE html>
-    <html>
-    <head>
-        <title>Timers</title>
-        {get_base_styles()}
+    head, body = cached_fragment('timers', data_versions['timers'], render_timers)
+    return render_page('Timers', body, head_extra=head)
+
+def render_timers():
+    head = f"""
         <script>
             function formatTime(seconds) {{
                 const hours = Math.floor(seconds / 3600);
@@ -1234,8 +4663,7 @@ def timers_page():
                 timers.forEach((timer, index) => {{
                     if (!timer.running) return;
 
-                    const elapsed = now - timer.start_time;
-                    const remaining = Math.max(0, timer.duration - elapsed);
+                    const remaining = Math.max(0, timer.deadline - now);
 
                     const elem = document.getElementById('timer-' + index);
                     if (elem) {{
@@ -1252,15 +4680,13 @@ def timers_page():
 
             setInterval(updateTimers, 1000);
             setTimeout(updateTimers, 100);
+            document.addEventListener('homepod-timer', (e) => {{
+                if (e.detail.type === 'expired') setTimeout(() => location.reload(), 4000);
+            }});
         </script>
-    </head>
-    <body>
-        <div class="header">
-            <a href="/" class="back-btn">←</a>
-            <div class="page-title">⏱️ Timers</div>
-            <div style="width: 60px;"></div>
-        </div>
+    """
 
+    html = render_header('⏱️ Timers') + """
         <div class="detail-card">
             <form action="/timers/add" method="POST">
                 <div class="input-group">
@@ -1285,14 +4711,20 @@ def timers_page():
             name = timer['name']
             duration = timer['duration']
             running = timer.get('running', False)
+            remaining = int(math.ceil(timer_remaining(timer)))
 
-            status_class = 'timer-running' if running else ''
+            if running:
+                status_class = 'timer-running'
+            elif timer.get('finished'):
+                status_class = 'timer-finished'
+            else:
+                status_class = ''
 
             html += f"""
             <div class="timer-item">
                 <div class="timer-name">{name}</div>
                 <div class="timer-time {status_class}" id="timer-{index}">
-                    {duration // 60}:{duration % 60:02d}
+                    {remaining // 60}:{remaining % 60:02d}
                 </div>
                 <div class="timer-controls">
             """
@@ -1320,10 +4752,8 @@ def timers_page():
 
     html += """
         </div>
-    </body>
-    </html>
     """
-    return html
+    return head, html
 
 @app.route('/timers/add', methods=['POST'])
 def timers_add():
@@ -1333,61 +4763,111 @@ def timers_add():
 
     if name and (minutes > 0 or seconds > 0):
         duration = minutes * 60 + seconds
-        timers_list.append({
-            'id': str(uuid.uuid4()),
-            'name': name,
-            'duration': duration,
-            'running': False,
-            'start_time': 0
-        })
-        save_timers(timers_list)
+        with timers_lock:
+            timers_list.append({
+                'id': str(uuid.uuid4()),
+                'name': name,
+                'duration': duration,
+                'running': False,
+                'start_time': 0,
+                'remaining': duration,
+                'deadline': None,
+                'finished': False
+            })
+            save_timers(timers_list)
     return redirect('/timers')
 
 @app.route('/timers/start/<timer_id>', methods=['POST'])
 def timers_start(timer_id):
-    for timer in timers_list:
-        if timer['id'] == timer_id:
-            timer['running'] = True
-            timer['start_time'] = time.time()
-            break
-    save_timers(timers_list)
+    with timers_lock:
+        for timer in timers_list:
+            if timer['id'] == timer_id and not timer.get('running'):
+                remaining = timer_remaining(timer)
+                if timer.get('finished') or remaining <= 0:
+                    remaining = timer['duration']
+                now = time.time()
+                timer['running'] = True
+                timer['finished'] = False
+                timer['deadline'] = now + remaining
+                timer['start_time'] = timer['deadline'] - timer['duration']
+                arm_timer(timer)
+                event_hub.publish('timer', {'type': 'started', 'id': timer_id, 'deadline': timer['deadline']})
+                break
+        save_timers(timers_list)
     return redirect('/timers')
 
 @app.route('/timers/stop/<timer_id>', methods=['POST'])
 def timers_stop(timer_id):
-    for timer in timers_list:
-        if timer['id'] == timer_id:
-            timer['running'] = False
-            break
-    save_timers(timers_list)
+    with timers_lock:
+        for timer in timers_list:
+            if timer['id'] == timer_id and timer.get('running'):
+                timer['remaining'] = timer_remaining(timer)
+                timer['running'] = False
+                timer['deadline'] = None
+                timer_wheel.cancel(timer_id)
+                event_hub.publish('timer', {'type': 'stopped', 'id': timer_id, 'remaining': timer['remaining']})
+                break
+        save_timers(timers_list)
     return redirect('/timers')
 
 @app.route('/timers/delete/<timer_id>', methods=['POST'])
 def timers_delete(timer_id):
     global timers_list
-    timers_list = [t for t in timers_list if t['id'] != timer_id]
-    save_timers(timers_list)
+    with timers_lock:
+        timer_wheel.cancel(timer_id)
+        timers_list = [t for t in timers_list if t['id'] != timer_id]
+        save_timers(timers_list)
     return redirect('/timers')
 
+@app.route('/api/timers', methods=['GET'])
+def api_timers():
+    now = time.time()
+    with timers_lock:
+        timers = [dict(t, remaining=timer_remaining(t, now)) for t in timers_list]
+    return jsonify(timers), 200
+
+@app.route('/api/waterfall/<device_name>')
+def api_waterfall(device_name):
+    if device_name not in device_registry.devices:
+        return jsonify({'status': 'error', 'message': 'Unknown device'}), 404
+    hub = waterfall_hubs.setdefault(device_name, EventHub())
+
+    def stream():
+        q = hub.subscribe()
+        try:
+            yield WATERFALL_KEEPALIVE
+            while True:
+                try:
+                    yield q.get(timeout=EVENT_KEEPALIVE)
+                except queue.Empty:
+                    yield WATERFALL_KEEPALIVE
+        finally:
+            hub.unsubscribe(q)
+    return Response(stream(), mimetype='application/octet-stream',
+                    headers={'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'})
+
+@app.route('/api/events')
+def api_events():
+    def stream():
+        q = event_hub.subscribe()
+        try:
+            yield b"retry: 3000\n\n"
+            while True:
+                try:
+                    yield q.get(timeout=EVENT_KEEPALIVE)
+                except queue.Empty:
+                    yield b": keepalive\n\n"
+        finally:
+            event_hub.unsubscribe(q)
+    return Response(stream(), mimetype='text/event-stream',
+                    headers={'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'})
+
 # ============================================
-# NOTES PAGE (unchanged)
+# NOTES PAGE
 # ============================================
 @app.route('/notes')
 def notes_page():
-    html = f"""
-    <!DOCTYPE html>
-    <html>
-    <head>
-        <title>Notes</title>
-        {get_base_styles()}
-    </head>
-    <body>
-        <div class="header">
-            <a href="/" class="back-btn">←</a>
-            <div class="page-title">📝 Notes</div>
-            <div style="width: 60px;"></div>
-        </div>
-
+    body = render_header('📝 Notes') + render_search_form() + """
         <div class="detail-card">
             <form action="/notes/add" method="POST">
                 <input type="text" name="title" class="input" placeholder="Note title..." required style="margin-bottom: 12px;">
@@ -1398,40 +4878,49 @@ def notes_page():
 
         <div class="item-list">
     """
+    page, pages = page_number(len(notes_list))
+    body += cached_fragment(f'notes:list:{page}', data_versions['notes'],
+                            lambda: render_note_items(page))
+    body += """
+        </div>
+    """ + render_pager('/notes', page, pages)
+    return render_page('Notes', body)
 
+def render_note_items(page=1):
     if not notes_list:
-        html += '<div class="no-data">📝 No notes yet. Create one above!</div>'
-    else:
-        for note in reversed(notes_list):
-            note_id = note['id']
-            title = note['title']
-            content = note['content']
-            timestamp = note.get('created', 'Unknown')
+        return '<div class="no-data">📝 No notes yet. Create one above!</div>'
+
+    # Newest first
+    end = len(notes_list) - (page - 1) * LIST_PAGE_SIZE
+    start = max(0, end - LIST_PAGE_SIZE)
+    html = ''
+    for note in reversed(notes_list[start:end]):
+        html += render_note_item(note)
+    return html
 
-            preview = content[:100] + '...' if len(content) > 100 else content
+def render_note_item(note):
+    note_id = note['id']
+    title = note['title']
+    content = note['content']
+    timestamp = note.get('created', 'Unknown')
 
-            html += f"""
-            <div class="item">
-                <div style="flex: 1;">
-                    <div style="font-size: 1.2rem; font-weight: 600; margin-bottom: 8px;">{title}</div>
-                    <div style="color: #888; margin-bottom: 8px; white-space: pre-wrap;">{preview}</div>
-                    <div style="font-size: 0.8rem; color: #666;">{timestamp}</div>
-                </div>
-                <div class="item-actions">
-                    <a href="/notes/view/{note_id}" class="btn btn-icon btn-secondary">👁️</a>
-                    <form action="/notes/delete/{note_id}" method="POST" style="display:inline;">
-                        <button type="submit" class="btn btn-icon btn-secondary">🗑️</button>
-                    </form>
-                </div>
-            </div>
-            """
+    preview = content[:100] + '...' if len(content) > 100 else content
 
-    html += """
+    return f"""
+        <div class="item">
+            <div style="flex: 1;">
+                <div style="font-size: 1.2rem; font-weight: 600; margin-bottom: 8px;">{title}</div>
+                <div style="color: #888; margin-bottom: 8px; white-space: pre-wrap;">{preview}</div>
+                <div style="font-size: 0.8rem; color: #666;">{timestamp}</div>
+            </div>
+            <div class="item-actions">
+                <a href="/notes/view/{note_id}" class="btn btn-icon btn-secondary">👁️</a>
+                <form action="/notes/delete/{note_id}" method="POST" style="display:inline;">
+                    <button type="submit" class="btn btn-icon btn-secondary">🗑️</button>
+                </form>
+            </div>
         </div>
-    </body>
-    </html>
-    """
-    return html
+        """
 
 @app.route('/notes/add', methods=['POST'])
 def notes_add():
@@ -1439,12 +4928,14 @@ def notes_add():
     content = request.form.get('content', '').strip()
 
     if title and content:
-        notes_list.append({
+        note = {
             'id': str(uuid.uuid4()),
             'title': title,
             'content': content,
             'created': datetime.now().strftime('%Y-%m-%d %I:%M %p')
-        })
+        }
+        notes_list.append(note)
+        index_note(note)
         save_notes(notes_list)
     return redirect('/notes')
 
@@ -1459,20 +4950,7 @@ def notes_view(note_id):
     if not note:
         return redirect('/notes')
 
-    html = f"""
-    <!DOCTYPE html>
-    <html>
-    <head>
-        <title>{note['title']}</title>
-        {get_base_styles()}
-    </head>
-    <body>
-        <div class="header">
-            <a href="/notes" class="back-btn">←</a>
-            <div class="page-title">📝 {note['title']}</div>
-            <div style="width: 60px;"></div>
-        </div>
-
+    body = render_header(f"📝 {note['title']}", back='/notes') + f"""
         <div class="detail-card">
             <div style="color: #666; font-size: 0.9rem; margin-bottom: 20px;">
                 Created: {note.get('created', 'Unknown')}
@@ -1487,23 +4965,53 @@ def notes_view(note_id):
                 <button type="submit" class="btn btn-secondary" style="width: 100%;">🗑️ Delete Note</button>
             </form>
         </div>
-    </body>
-    </html>
     """
-    return html
+    return render_page(note['title'], body)
 
 @app.route('/notes/delete/<note_id>', methods=['POST'])
 def notes_delete(note_id):
     global notes_list
     notes_list = [n for n in notes_list if n['id'] != note_id]
+    search_index.remove(('note', note_id))
     save_notes(notes_list)
     return redirect('/notes')
 
+# ============================================
+# SEARCH PAGE
+# ============================================
+@app.route('/search')
+def search_page():
+    query = request.args.get('q', '').strip()
+    body = render_header('🔍 Search') + render_search_form(query.replace('"', '&quot;'))
+    if query:
+        results = search_index.search(query)
+        body += '<div class="item-list">'
+        if not results:
+            body += '<div class="no-data">🔍 Nothing matches that search.</div>'
+        for kind, item in results:
+            body += render_todo_item(item) if kind == 'todo' else render_note_item(item)
+        body += '</div>'
+    return render_page('Search', body)
+
+@app.route('/api/search', methods=['GET'])
+def api_search():
+    query = request.args.get('q', '')
+    try:
+        limit = min(max(int(request.args.get('limit', SEARCH_RESULT_LIMIT)), 1), SEARCH_MAX_LIMIT)
+    except ValueError:
+        limit = SEARCH_RESULT_LIMIT
+    results = search_index.search(query, limit)
+    return jsonify([dict(item, type=kind) for kind, item in results]), 200
+
 # ============================================
 # MUSIC PLAYER PAGE
 # ============================================
 @app.route('/music')
 def music_page():
+    body = cached_fragment('music', data_versions['music'], render_music_body)
+    return render_page('Music Player', body)
+
+def render_music_body():
     current_track = None
     current_index = music_queue.get('current_index', 0)
     is_playing = music_queue.get('is_playing', False)
@@ -1511,20 +5019,7 @@ def music_page():
     if music_queue['queue'] and current_index < len(music_queue['queue']):
         current_track = music_queue['queue'][current_index]
 
-    html = f"""
-    <!DOCTYPE html>
-    <html>
-    <head>
-        <title>Music Player</title>
-        {get_base_styles()}
-    </head>
-    <body>
-        <div class="header">
-            <a href="/" class="back-btn">←</a>
-            <div class="page-title">🎵 Music Player</div>
-            <div style="width: 60px;"></div>
-        </div>
-
+    html = render_header('🎵 Music Player') + f"""
         <div class="now-playing">
             <div class="album-art">{'🎵' if current_track else '🎶'}</div>
             <div class="track-title">{current_track['title'] if current_track else 'No Track Playing'}</div>
@@ -1588,8 +5083,6 @@ def music_page():
 
     html += """
         </div>
-    </body>
-    </html>
     """
     return html
 
@@ -1654,26 +5147,18 @@ def music_remove(track_id):
 # ============================================
 @app.route('/system')
 def system_page():
+    # top/free/df take a noticeable time; sample them at most once per refresh period
+    body = cached_fragment('system', int(time.time() // SYSTEM_STATS_TTL), render_system_body)
+    return render_page('System Stats', body, refresh_ms=SYSTEM_STATS_TTL * 1000)
+
+def render_system_body():
     cpu_temp = get_cpu_temp()
     cpu_usage = get_cpu_usage()
     memory = get_memory_usage()
     disk = get_disk_usage()
     uptime = get_uptime()
 
-    html = f"""
-    <!DOCTYPE html>
-    <html>
-    <head>
-        <title>System Stats</title>
-        {get_base_styles()}
-    </head>
-    <body>
-        <div class="header">
-            <a href="/" class="back-btn">←</a>
-            <div class="page-title">📊 System Stats</div>
-            <div style="width: 60px;"></div>
-        </div>
-
+    html = render_header('📊 System Stats') + f"""
         <div class="detail-card">
             <div class="big-icon">💻</div>
             <div style="text-align: center; font-size: 1.3rem; color: #888; margin-bottom: 30px;">
@@ -1729,9 +5214,32 @@ def system_page():
     else:
         html += '<div class="no-data">Disk info unavailable</div>'
 
-    html += f"""
+    html += """
+        </div>
+    """
+
+    if replica_role:
+        repl = replication_summary()
+        if repl['role'] == 'primary':
+            state = ('Replica unreachable' if not repl['connected'] else
+                     'Lagging' if repl['lagging'] else 'In sync')
+            detail = (f"{repl['lag_s']} s / {repl['behind_bytes']} bytes behind, "
+                      f"{repl['bytes_per_s']} B/s to {REPLICA_ADDRESS}")
+        else:
+            state = 'Following' if repl['connected'] else 'Primary unreachable'
+            detail = (f"{repl['behind_bytes']} bytes behind {repl['peer'] or 'the primary'}, "
+                      f"{repl['bytes_per_s']} B/s")
+        html += f"""
+        <div class="detail-card">
+            <div class="section-title">Replication ({repl['role']})</div>
+            <div class="sensor-item">
+                <div class="sensor-value" style="font-size: 1.2rem;">{state}</div>
+                <div class="sensor-label">{detail}</div>
+            </div>
         </div>
+        """
 
+    html += f"""
         <div class="detail-card">
             <div class="sensor-grid" style="grid-template-columns: 1fr;">
                 <div class="sensor-item">
@@ -1740,32 +5248,211 @@ def system_page():
                 </div>
             </div>
         </div>
-
-        <script>
-            setTimeout(() => location.reload(), 5000);
-        </script>
-    </body>
-    </html>
     """
     return html
 
 # ============================================
-# SENSOR DATA API
+# DEVICES PAGE
 # ============================================
-@app.route('/sensor-data', methods=['POST'])
-def receive_sensor_data():
-    try:
-        data = request.get_json()
-        if not data:
-            return jsonify({'status': 'error', 'message': 'No data received'}), 400
+@app.route('/devices')
+def devices_page():
+    device_registry.refresh()
+    rooms = sorted(set(DEFAULT_ROOM_CONFIG) | set(device_registry.room_devices))
+    room_options = ''.join(f'<option value="{room}">' for room in rooms)
+
+    html = render_header('📡 Devices') + f"""
+        <datalist id="room-list">{room_options}</datalist>
+        <div class="item-list">
+    """
 
-        data['received_at'] = datetime.now().strftime('%Y-%m-%d %H:%M:%S')
-        device_name = data.get('device_name', 'Unknown Device')
-        latest_readings[device_name] = data
+    devices = device_registry.devices
+    if not devices:
+        html += '<div class="no-data">📡 No devices yet. Nodes appear here after their first report.</div>'
+    else:
+        # Unassigned devices first so new nodes are easy to spot
+        for device_name in sorted(devices, key=lambda d: (bool(devices[d].get('room')), d)):
+            room = devices[device_name].get('room') or ''
+            dev_id = latest_state.device_ids.get(device_name)
+            last_seen = format_timestamp(latest_state.received_at[dev_id]) if dev_id is not None else 'Not since restart'
+            inventory = devices[device_name].get('inventory')
+            info_lines = ''
+            if inventory:
+                parts = [f"{d.get('device', '?')} @ {d.get('address', '?')}" +
+                         (f" → {d['channel']}" if d.get('channel') else '')
+                         for d in inventory]
+                info_lines = f'<div style="font-size: 0.8rem; color: #666;">I2C: {", ".join(parts)}</div>'
+            uplink_us = latest_state.get(device_name, 'status.uplink_us')
+            if uplink_us:
+                mode = 'TLS-PSK' if latest_state.get(device_name, 'status.uplink_tls') else 'HTTP'
+                connects = latest_state.get(device_name, 'status.uplink_connects')
+                info_lines += (f'<div style="font-size: 0.8rem; color: #666;">Uplink: {mode}, '
+                               f'{uplink_us / 1000:.0f} ms last report, {connects} connections since boot</div>')
+            failovers = latest_state.get(device_name, 'status.failovers')
+            if failovers:
+                where = 'the replica' if latest_state.get(device_name, 'status.on_replica') else 'the primary'
+                info_lines += (f'<div style="font-size: 0.8rem; color: #666;">Failover: '
+                               f'{failovers} server switches since boot, now on {where}</div>')
+            warnings = memory_warnings(device_name)
+            if warnings:
+                info_lines += f'<div style="font-size: 0.8rem; color: #ff4444;">⚠️ Memory: {", ".join(warnings)}</div>'
+            last_reset = devices[device_name].get('last_reset')
+            if last_reset:
+                in_task = f" during {last_reset['task']}" if last_reset.get('task') else ''
+                info_lines += (f'<div style="font-size: 0.8rem; color: #666;">Last reset: '
+                               f'{last_reset["reason"]}{in_task} ({last_reset["at"]}, '
+                               f'<a href="/api/flight/{device_name}" style="color: #00d9ff;">'
+                               f'{last_reset["events"]} events</a>)</div>')
+            boot = devices[device_name].get('boot')
+            if boot and boot.get('us'):
+                stages = boot_stages(boot['us'])
+                slowest = max(stages, key=stages.get)
+                first_report = boot['us'].get('first_report')
+                boot_total = f"{first_report / 1e6:.1f} s to first report" if first_report else 'no report yet'
+                info_lines += (f'<div style="font-size: 0.8rem; color: #666;">Boot: {boot_total}, '
+                             f'slowest stage {slowest} ({stages[slowest] / 1000:.1f} s)</div>')
+
+            html += f"""
+            <div class="item">
+                <div style="flex: 1;">
+                    <div style="font-size: 1.2rem; font-weight: 600; margin-bottom: 8px;">{device_name}</div>
+                    <div style="font-size: 0.8rem; color: #666;">Last seen: {last_seen}</div>
+                    {info_lines}
+                </div>
+                <form action="/devices/assign/{device_name}" method="POST" class="item-actions">
+                    <input type="text" name="room" class="input" list="room-list" placeholder="Unassigned" value="{room}">
+                    <button type="submit" class="btn btn-primary">Save</button>
+                </form>
+                <form action="/devices/delete/{device_name}" method="POST" style="display:inline;">
+                    <button type="submit" class="btn btn-icon btn-secondary">🗑️</button>
+                </form>
+            </div>
+            """
 
-        with open(DATA_LOG_FILE, 'a') as f:
-            f.write(json.dumps(data) + '\n')
+    html += """
+        </div>
+    """
+    return render_page('Devices', html)
+
+@app.route('/devices/assign/<device_name>', methods=['POST'])
+def devices_assign(device_name):
+    device_registry.assign(device_name, request.form.get('room', ''))
+    return redirect('/devices')
+
+@app.route('/devices/delete/<device_name>', methods=['POST'])
+def devices_delete(device_name):
+    device_registry.remove(device_name)
+    return redirect('/devices')
+
+@app.route('/api/devices', methods=['GET'])
+def api_devices():
+    device_registry.refresh()
+    return jsonify(device_registry.devices), 200
+
+@app.route('/api/boot', methods=['GET'])
+def api_boot():
+    with ingest_lock:
+        firmware = {fw: boot_summary(fw) for fw in boot_profiles}
+    devices = {name: info['boot'] for name, info in device_registry.devices.items() if info.get('boot')}
+    return jsonify({'firmware': firmware, 'devices': devices}), 200
+
+@app.route('/api/flight/<device_name>', methods=['POST'])
+def api_flight_upload(device_name):
+    payload = request.get_data()
+    usable = len(payload) - len(payload) % FLIGHT_RECORD.size
+    events = [decode_flight_record(*FLIGHT_RECORD.unpack_from(payload, offset))
+              for offset in range(0, usable, FLIGHT_RECORD.size)]
+    reason = RESET_REASONS.get(request.args.get('reset_reason', 0, type=int), 'unknown')
+    task = FLIGHT_TASKS.get(request.args.get('task', 0, type=int))
+    report = {
+        'device_name': device_name,
+        'boot_id': request.args.get('boot_id', type=int),
+        'prev_boot_id': request.args.get('prev_boot_id', type=int),
+        'reset_reason': reason,
+        'crash': reason in CRASH_RESETS,
+        # Step loop() was in when the previous boot ended, and since when
+        'task': task,
+        'task_since_ms': request.args.get('task_since', type=int) if task else None,
+        'events': events,
+        'received_at': format_timestamp(time.time()),
+    }
+    with ingest_lock:
+        add_flight_report(report)
+        with open(local_log(FLIGHT_LOG_FILE), 'a') as f:
+            f.write(json.dumps(report) + '\n')
+    device_registry.register(device_name)
+    device_registry.update_info(device_name, last_reset={
+        'reason': reason, 'task': task, 'events': len(events), 'at': report['received_at']})
+    if report['crash']:
+        print(f"{device_name} restarted after {reason}" + (f" in {task}" if task else ''))
+    return jsonify({'status': 'success', 'events': len(events)}), 200
+
+@app.route('/api/flight/<device_name>', methods=['GET'])
+def api_flight(device_name):
+    uploads = flight_reports.get(device_name)
+    if not uploads:
+        return jsonify({'status': 'error', 'message': 'No flight recorder uploads for device'}), 404
+    return jsonify(uploads[::-1]), 200
+
+@app.route('/api/devices/<device_name>', methods=['POST'])
+def api_device_assign(device_name):
+    data = request.get_json() or {}
+    if not device_registry.assign(device_name, data.get('room')):
+        return jsonify({'status': 'error', 'message': 'Unknown device'}), 404
+    return jsonify({'status': 'success', 'device_name': device_name,
+                    'room': device_registry.device_room.get(device_name)}), 200
 
+# ============================================
+# SENSOR DATA API
+# ============================================
+def ingest_report(data, remote_addr, age=0.0):
+    """Store one node report; returns (reply, status code) for HTTP or the control link.
+    age is how many seconds ago the node took it (resent after a reconnect)."""
+    device_name = data.get('device_name', 'Unknown Device')
+
+    with ingest_lock:
+        retry_after = admit_report(device_name)
+        if retry_after:
+            return slow_down_reply(device_name, retry_after), 429
+
+        if is_duplicate_report(device_name, data):
+            # Already stored; ack so the node stops retrying
+            ingest_stats['duplicates'] += 1
+            return {'status': 'duplicate', 'device_name': device_name,
+                    'seq': data.get('seq')}, 200
+        ingest_stats['accepted'] += 1
+
+        device_registry.register(device_name)
+        if isinstance(data.get('inventory'), list):
+            # I2C scan result, sent in the first report after each boot
+            device_registry.update_info(device_name, inventory=data.pop('inventory'))
+        if isinstance(data.get('boot'), dict):
+            record_boot(device_name, data.get('boot_id'), data.pop('boot'))
+        received_at = time.time() - age
+        data['received_at'] = format_timestamp(received_at)
+        dev_id = latest_state.device_ids.get(device_name)
+        last_seen = latest_state.received_at[dev_id] if dev_id is not None else 0
+        record_uplink(device_name, data.get('status') or {})
+        if age:
+            # Resent after a reconnect: merged like a backfill, so the data log
+            # stays time-ordered and newer live values are not overwritten
+            merge_logged_report(data, received_at)
+            with open(local_log(BACKFILL_LOG_FILE), 'a') as f:
+                f.write(json.dumps(dict(data, resent=True)) + '\n')
+        else:
+            if last_seen and received_at - last_seen > BACKFILL_MIN_GAP:
+                start_backfill(device_name, remote_addr, last_seen, received_at)
+            latest_state.update(device_name, data, received_at)
+            outdoor = outdoor_temperature()
+            if outdoor is not None:
+                # Logged so a replay trains the thermal models on the same input
+                data['outdoor_c'] = outdoor
+            room_fusion.on_report(device_name, device_registry.device_room.get(device_name),
+                                  data.get('sensors') or {}, received_at, outdoor)
+            with open(local_log(DATA_LOG_FILE), 'a') as f:
+                f.write(json.dumps(data) + '\n')
+        replica_wakeup.set()
+
+    if not should_shed('banner'):
         print(f"\n{'='*50}")
         print(f"Received data from: {device_name}")
         print(f"Time: {data['received_at']}")
@@ -1777,14 +5464,159 @@ def receive_sensor_data():
             print(f"Audio Level: {sensors.get('audio_level', 'N/A')}")
         print(f"{'='*50}\n")
 
-        return jsonify({'status': 'success', 'device_name': device_name}), 200
+    reply = {'status': 'success', 'device_name': device_name, 'seq': data.get('seq'),
+             'time': int(time.time())}
+    with control_lock:
+        commands = pending_commands.pop(device_name, None)
+    if commands:
+        reply['commands'] = commands
+    if waterfall_viewers(device_name) or sound_capture_active(device_name):
+        reply['waterfall_ms'] = WATERFALL_LEASE_MS
+    return reply, 200
+
+@app.route('/sensor-data', methods=['POST'])
+def receive_sensor_data():
+    try:
+        data = request.get_json()
+        if not data:
+            return jsonify({'status': 'error', 'message': 'No data received'}), 400
+
+        reply, code = ingest_report(data, request.remote_addr)
+        resp = jsonify(reply)
+        if code == 429:
+            resp.headers['Retry-After'] = str(max(1, (reply['retry_after_ms'] + 999) // 1000))
+        return resp, code
     except Exception as e:
         print(f"Error: {e}")
         return jsonify({'status': 'error', 'message': str(e)}), 500
 
 @app.route('/latest', methods=['GET'])
 def get_latest():
-    return jsonify(latest_readings), 200
+    state = latest_state
+    return jsonify({name: state.to_dict(dev_id) for name, dev_id in state.device_ids.items()}), 200
+
+@app.route('/api/ingest/stats', methods=['GET'])
+def api_ingest_stats():
+    return jsonify(dict(ingest_stats, waterfall=waterfall_stats, backfill=backfill_stats)), 200
+
+@app.route('/api/noise/events', methods=['GET'])
+def api_noise_events():
+    limit = request.args.get('limit', 20, type=int)
+    events = list(noise_events)[-limit:] if limit > 0 else []
+    return jsonify({'events': events[::-1], 'stats': noise_stats}), 200
+
+@app.route('/api/sound/capture', methods=['POST'])
+def api_sound_capture():
+    data = request.get_json() or {}
+    device_name = data.get('device_name')
+    label = data.get('label')
+    seconds = data.get('seconds', 60)
+    if not device_name or label not in SOUND_CLASSES:
+        return jsonify({'status': 'error', 'message': 'device_name and label (' + ', '.join(SOUND_CLASSES) + ') are required'}), 400
+    if not isinstance(seconds, (int, float)) or not 0 < seconds <= SOUND_CAPTURE_MAX_SECONDS:
+        return jsonify({'status': 'error', 'message': f'seconds must be 1-{SOUND_CAPTURE_MAX_SECONDS}'}), 400
+    start_sound_capture(device_name, label, seconds)
+    return jsonify({'status': 'success', 'device_name': device_name, 'label': label, 'seconds': seconds}), 200
+
+@app.route('/api/sound/capture', methods=['GET'])
+def api_sound_captures():
+    counts = {}
+    captures = load_sound_captures(SOUND_CAPTURE_FILE) + load_sound_captures(failover_log(SOUND_CAPTURE_FILE))
+    for _, cls in captures:
+        counts[SOUND_CLASSES[cls]] = counts.get(SOUND_CLASSES[cls], 0) + 1
+    active = {name: {'label': c['label'], 'remaining': round(c['until'] - time.time())}
+              for name, c in list(sound_captures.items()) if c['until'] > time.time()}
+    return jsonify({'active': active, 'seconds_per_label': counts}), 200
+
+@app.route('/api/replication', methods=['GET'])
+def api_replication():
+    return jsonify(replication_summary()), 200
+
+@app.route('/api/control', methods=['GET'])
+def api_control():
+    return jsonify(control_summary()), 200
+
+@app.route('/api/nodes/<device_name>/command', methods=['POST'])
+def api_node_command(device_name):
+    body = request.get_json() or {}
+    command = body.get('command')
+    if not isinstance(command, str) or not command:
+        return jsonify({'status': 'error', 'message': 'command is required'}), 400
+    args = body.get('args') if isinstance(body.get('args'), dict) else {}
+    result = send_command(device_name, command, args, wait=CONTROL_COMMAND_TIMEOUT)
+    codes = {'ok': 200, 'error': 422, 'queued': 202, 'timeout': 504}
+    return jsonify(result), codes.get(result['status'], 200)
+
+@app.route('/api/history/<room_name>/<channel>', methods=['GET'])
+def api_history(room_name, channel):
+    range_name = request.args.get('range', '24h')
+    if range_name not in HISTORY_RANGES:
+        return jsonify({'status': 'error', 'message': 'range must be one of ' + ', '.join(HISTORY_RANGES)}), 400
+    return Response(get_chart_payload(room_name, channel, range_name),
+                    mimetype='application/octet-stream')
+
+@app.route('/api/uplink', methods=['GET'])
+def api_uplink():
+    devices = {}
+    modes = {}
+    with ingest_lock:
+        for (device_name, mode), totals in uplink_stats.items():
+            devices.setdefault(device_name, {})[mode] = uplink_summary(totals)
+            combined = modes.setdefault(mode, {'reports': 0, 'us': 0, 'bytes': 0})
+            for key in combined:
+                combined[key] += totals[key]
+    return jsonify({'modes': {mode: uplink_summary(t) for mode, t in modes.items()},
+                    'devices': devices}), 200
+
+@app.route('/api/profile/<room_name>', methods=['GET'])
+def api_profile(room_name):
+    profile = room_profiles.rooms.get(room_name)
+    if profile is None:
+        return jsonify({'status': 'error', 'message': 'No data for room'}), 404
+    return jsonify({
+        'room': room_name,
+        'first_hour': 'Monday 00:00',
+        'weeks': PROFILE_WEEKS,
+        'metrics': {m: profile.metric(m) for m, _, _ in PROFILE_METRICS}
+    }), 200
+
+@app.route('/api/forecast', methods=['GET'])
+def api_forecast():
+    room_name = request.args.get('room')
+    if room_name:
+        forecast = room_forecasts.get(room_name)
+        if forecast is None:
+            return jsonify({'status': 'error', 'message': 'No temperature data for room'}), 404
+        return jsonify(forecast), 200
+    return jsonify({room: room_forecasts.get(room) for room in room_forecasts.models}), 200
+
+@app.route('/api/export', methods=['GET'])
+def api_export():
+    fmt = request.args.get('format', 'csv')
+    if fmt not in EXPORT_FORMATS:
+        return jsonify({'status': 'error', 'message': 'format must be arrow, parquet or csv'}), 400
+    if fmt != 'csv' and pyarrow is None:
+        return jsonify({'status': 'error', 'message': f'{fmt} export needs pyarrow on the server'}), 501
+    try:
+        start = parse_time_arg(request.args.get('start'), '0000-00-00 00:00:00')
+        end = parse_time_arg(request.args.get('end'), format_timestamp(time.time()))
+    except ValueError:
+        return jsonify({'status': 'error', 'message': 'start/end must be epoch seconds or ISO time'}), 400
+    columns = [c for c in request.args.get('columns', '').split(',') if c] or EXPORT_DEFAULT_COLUMNS
+    devices = set(d for d in request.args.get('devices', '').split(',') if d)
+    filename = f"homepod_history.{'arrows' if fmt == 'arrow' else fmt}"
+    return Response(export_history(fmt, start, end, devices, columns),
+                    mimetype=EXPORT_FORMATS[fmt],
+                    headers={'Content-Disposition': f'attachment; filename={filename}'})
+
+@app.route('/api/compression/stats', methods=['GET'])
+def api_compression_stats():
+    with compress_lock:
+        stats = dict(compression_stats)
+    stats['ratio'] = round(stats['bytes_out'] / stats['bytes_in'], 3) if stats['bytes_in'] else None
+    stats['cpu_ms_per_page'] = round(stats['cpu_ms'] / stats['compressed'], 3) if stats['compressed'] else None
+    stats['cpu_ms'] = round(stats['cpu_ms'], 3)
+    return jsonify(stats), 200
 
 @app.route('/api/weather', methods=['GET'])
 def api_weather():
@@ -1798,6 +5630,24 @@ def api_weather():
 # MAIN
 # ============================================
 if __name__ == '__main__':
+    if sys.argv[1:2] == ['export']:
+        export_main(sys.argv[2:])
+        sys.exit(0)
+    if sys.argv[1:2] == ['train-sound']:
+        train_sound_main(sys.argv[2:])
+        sys.exit(0)
+    replica_args = None
+    if sys.argv[1:2] == ['replica']:
+        parser = argparse.ArgumentParser(prog='homepod_server_v3.py replica',
+                                         description='Run as a warm standby for another HomePOD server')
+        parser.add_argument('--listen', type=int, default=REPLICA_PORT, help='port the primary ships to')
+        parser.add_argument('--primary', help='only accept shipping from this address')
+        parser.add_argument('--port', type=int, default=5000,
+                            help='dashboard port; anything else also leaves the node listeners off '
+                                 '(for a test replica on the primary\'s machine)')
+        replica_args = parser.parse_args(sys.argv[2:])
+    http_port = replica_args.port if replica_args else 5000
+
     print("\n" + "="*60)
     print("   HomePOD Dashboard Server v3")
     print("   Enhanced 6-App Dashboard")
@@ -1810,13 +5660,35 @@ if __name__ == '__main__':
     print("  🎵 Music Player - Queue & playback control")
     print("  📊 System Stats - Raspberry Pi monitoring")
     print("\nServer Configuration:")
-    print(f"  - Port: 5000")
+    print(f"  - Port: {http_port}")
     print(f"  - Data log: {DATA_LOG_FILE}")
     print(f"  - Weather: {WEATHER_CITY}, {WEATHER_COUNTRY}")
     print("\nAccess:")
-    print("  - Local: http://localhost:5000")
-    print("  - Network: http://<raspberry-pi-ip>:5000")
+    print(f"  - Local: http://localhost:{http_port}")
+    print(f"  - Network: http://<raspberry-pi-ip>:{http_port}")
+    readings = replay_sensor_log()
+    backfilled = replay_backfill_log()
+    boots = replay_boot_log()
+    flights = replay_flight_log()
+    print(f"  - Replayed {readings} logged readings")
+    print(f"  - Merged {backfilled} backfilled points")
+    print(f"  - Loaded {boots} boot profiles")
+    print(f"  - Loaded {flights} flight recorder uploads")
+    start_timer_scheduler()
+    if http_port == 5000:
+        start_waterfall_listener()
+        start_control_listener()
+        print(f"  - Node control channel: ws://<raspberry-pi-ip>:{CONTROL_WS_PORT}{CONTROL_WS_PATH}")
+        uplink = start_tls_uplink()
+        if uplink:
+            print(f"  - Encrypted uplink: {uplink}")
+    if replica_args:
+        start_replica_listener(replica_args.listen, replica_args.primary)
+        print(f"  - Replica: standby on port {replica_args.listen}, at {sum(replica_offsets.values())} bytes of the primary's logs")
+    elif REPLICA_ADDRESS:
+        start_replica_shipper()
+        print(f"  - Replica: shipping to {REPLICA_ADDRESS}")
     print("\nPress Ctrl+C to stop")
     print("="*60 + "\n")
 
-    app.run(host='0.0.0.0', port=5000, debug=False)
+    app.run(host='0.0.0.0', port=http_port, debug=False)
@@ -1,6 +1,11 @@
 /**
  * DHT Temperature/Humidity Sensor Module
- * DHT22/DHT11 on GPIO4
+ * DHT22/DHT11 on any GPIO (default GPIO4), several sensors per node
+ *
+ * Each sensor owns one RMT receive channel (up to 8 on the ESP32). The RMT
+ * peripheral timestamps the DHT's pulse train in hardware, so all sensors in
+ * a group are triggered together and captured in one ~5 ms window, without
+ * the interrupts-off bit-banging of the Adafruit driver.
  */
 
 #ifndef DHT_SENSOR_H
@@ -8,8 +13,9 @@
 
 #include <Arduino.h>
 #include <DHT.h>
+#include <driver/rmt.h>
 
-// Pin configuration
+// Default pin configuration
 #define DHT_PIN 4
 
 // Sensor type (DHT22 is more accurate, change to DHT11 if using that)
@@ -21,6 +27,13 @@
 #define HUMIDITY_MIN 0.0f
 #define HUMIDITY_MAX 100.0f
 
+// RMT capture timing (1 us ticks)
+#define DHT_START_PULSE_US 1100  // Host start signal (DHT22 needs >= 1 ms)
+#define DHT11_START_PULSE_US 18000 // DHT11 needs >= 18 ms (DHT22 allows up to 20)
+#define DHT_IDLE_US 150          // No edge for this long ends the frame
+#define DHT_BIT_ONE_US 48        // High pulses longer than this are 1 bits
+#define DHT_FRAME_TIMEOUT_MS 10
+
 struct DHTReading {
     float temperature;  // Temperature in Celsius
     float humidity;     // Relative humidity in %
@@ -30,10 +43,14 @@ struct DHTReading {
 
 class DHTSensor {
 public:
-    DHTSensor();
+    /**
+     * @param pin GPIO the sensor's data line is on (needs a pull-up)
+     * @param type DHT22 or DHT11
+     */
+    explicit DHTSensor(uint8_t pin = DHT_PIN, uint8_t type = DHT_TYPE);
 
     /**
-     * Initialize the DHT sensor
+     * Initialize the DHT sensor and claim an RMT channel for it
      * @return true if initialization successful
      */
     bool begin();
@@ -44,6 +61,15 @@ public:
      */
     DHTReading read();
 
+    /**
+     * Trigger every sensor at once and capture all replies in parallel
+     * @param sensors Sensors to read (each already begun)
+     * @param count Number of sensors
+     * @param readings Output, one DHTReading per sensor
+     * @return Number of valid readings
+     */
+    static size_t readAll(DHTSensor* const* sensors, size_t count, DHTReading* readings);
+
     /**
      * Get temperature in Fahrenheit
      * @return Temperature in Fahrenheit
@@ -56,16 +82,41 @@ public:
      */
     bool isConnected();
 
+    uint8_t getPin() const { return _pin; }
+
 private:
-    DHT* _dht;
+    uint8_t _pin;
+    uint8_t _type;
+    DHT* _dht;              // Heat index, and reads when no RMT channel is free
+    rmt_channel_t _channel;
+    RingbufHandle_t _ringbuf;
+    bool _useRmt;
     float _lastTemp;
     float _lastHumidity;
     bool _initialized;
 
+    static int _nextChannel;
+
     /**
      * Validate sensor reading
      */
     bool validateReading(float temp, float humidity);
+
+    /**
+     * Claim the next free RMT channel and route the pin to it
+     */
+    bool setupRmt();
+
+    /**
+     * Decode the captured pulse train into temperature and humidity
+     * @return true if 40 bits were captured and the checksum matches
+     */
+    bool decode(const rmt_item32_t* items, size_t count, float& temp, float& humidity);
+
+    /**
+     * Turn raw values into a reading, falling back to the last valid one
+     */
+    DHTReading finish(float temp, float humidity);
 };
 
 #endif // DHT_SENSOR_H
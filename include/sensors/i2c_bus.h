@@ -0,0 +1,79 @@
+/**
+ * I2C Bus Module
+ * Boot-time scan of the sensor bus (GPIO21=SDA, GPIO22=SCL) with
+ * automatic driver binding for known devices
+ */
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "sensors/light_sensor.h"
+
+// Bus configuration
+#define I2C_BUS_CLOCK 400000      // Fast mode; BH1750 supports it
+#define I2C_SCAN_FIRST 0x08       // 0x00-0x07 and 0x78-0x7F are reserved
+#define I2C_SCAN_LAST 0x77
+#define I2C_MAX_DEVICES 16
+#define I2C_MAX_LIGHT_SENSORS 2   // BH1750 has two address options
+
+enum I2CDeviceType {
+    I2C_DEVICE_UNKNOWN,
+    I2C_DEVICE_BH1750
+};
+
+struct I2CDevice {
+    uint8_t address;
+    I2CDeviceType type;
+    const char* name;      // Chip name, "unknown" if not in the known table
+    const char* channel;   // Channel the bound driver reports, nullptr if unbound
+};
+
+class I2CBus {
+public:
+    I2CBus();
+
+    /**
+     * Start the bus, scan every address and bind drivers to known devices
+     * @return Number of devices that answered
+     */
+    size_t begin();
+
+    /**
+     * Read every bound light sensor back-to-back in one bus pass
+     * @param readings Output, one LightReading per light sensor
+     * @return Number of valid readings
+     */
+    size_t readLights(LightReading* readings);
+
+    /**
+     * Print the detected devices and their bindings
+     */
+    void printInventory();
+
+    size_t getDeviceCount() const { return _deviceCount; }
+    const I2CDevice& getDevice(size_t index) const { return _devices[index]; }
+    size_t getLightCount() const { return _lightCount; }
+    LightSensor* getLight(size_t index) { return _lights[index]; }
+    const char* getLightChannel(size_t index) const { return _lightChannels[index]; }
+
+private:
+    I2CDevice _devices[I2C_MAX_DEVICES];
+    size_t _deviceCount;
+    LightSensor* _lights[I2C_MAX_LIGHT_SENSORS];
+    const char* _lightChannels[I2C_MAX_LIGHT_SENSORS];
+    size_t _lightCount;
+
+    /**
+     * Address-only write; true if a device ACKs
+     */
+    bool probe(uint8_t address);
+
+    /**
+     * Instantiate the driver for a detected device
+     */
+    void bind(I2CDevice& device);
+};
+
+#endif // I2C_BUS_H
@@ -40,7 +40,10 @@ struct LightReading {
 
 class LightSensor {
 public:
-    LightSensor();
+    /**
+     * @param address I2C address (0x23 with ADDR low, 0x5C with ADDR high)
+     */
+    explicit LightSensor(uint8_t address = BH1750_ADDRESS);
 
     /**
      * Initialize the light sensor
@@ -86,7 +89,10 @@ public:
      */
     void setMode(BH1750::Mode mode);
 
+    uint8_t getAddress() const { return _address; }
+
 private:
+    uint8_t _address;
     BH1750* _sensor;
     bool _initialized;
     float _lastLux;
@@ -3,24 +3,62 @@
  *
  * Sensors:
  *   - Microphone: GPIO35 (ADC input)
- *   - DHT22 Temperature/Humidity: GPIO4
- *   - BH1750 Light Sensor: GPIO21 (SDA), GPIO22 (SCL)
+ *   - DHT22 Temperature/Humidity: GPIO4 (more pins can be added to DHT_PINS)
+ *   - BH1750 Light Sensor(s): GPIO21 (SDA), GPIO22 (SCL), 0x23 and/or 0x5C
+ *     (found by the boot-time I2C scan)
  */
 
 #include <Arduino.h>
 #include <Wire.h>
+#include <esp_timer.h>
 #include "sensors/microphone.h"
 #include "sensors/dht_sensor.h"
-#include "sensors/light_sensor.h"
+#include "sensors/i2c_bus.h"
 
 // Sensor reading interval (ms)
 #define SENSOR_READ_INTERVAL 2000
 #define AUDIO_SAMPLE_INTERVAL 100
 
+// DHT sensors are triggered together and captured in parallel (one RMT
+// channel each, up to 8), e.g. {4, 16} for floor and ceiling
+#define DHT_PINS {DHT_PIN}
+
 // Global sensor instances
 MicrophoneSensor micSensor;
-DHTSensor dhtSensor;
-LightSensor lightSensor;
+const uint8_t dhtPins[] = DHT_PINS;
+const size_t DHT_COUNT = sizeof(dhtPins) / sizeof(dhtPins[0]);
+DHTSensor* dhtSensors[DHT_COUNT];
+I2CBus i2cBus;
+
+// Boot stage timestamps (us since app start); this build has no uplink, so
+// the table is printed once setup() is done
+enum BootPhase {
+    BOOT_APP_START,
+    BOOT_SERIAL,
+    BOOT_MIC,
+    BOOT_DHT,
+    BOOT_I2C,
+    BOOT_SETUP_DONE,
+    BOOT_PHASES
+};
+const char* const BOOT_PHASE_NAMES[BOOT_PHASES] = {
+    "app_start", "serial", "mic", "dht", "i2c", "setup_done"
+};
+uint32_t bootMarks[BOOT_PHASES];
+
+void bootMark(BootPhase phase) {
+    bootMarks[phase] = (uint32_t)esp_timer_get_time();
+}
+
+void printBootProfile() {
+    Serial.println("Boot profile:");
+    uint32_t prev = 0;
+    for (int i = 0; i < BOOT_PHASES; i++) {
+        Serial.printf("  %-12s %8lu us  (+%lu us)\n", BOOT_PHASE_NAMES[i],
+                      (unsigned long)bootMarks[i], (unsigned long)(bootMarks[i] - prev));
+        prev = bootMarks[i];
+    }
+}
 
 // Timing variables
 unsigned long lastSensorRead = 0;
@@ -49,9 +87,12 @@ void printSensorData() {
 }
 
 void setup() {
+    bootMark(BOOT_APP_START);
+
     // Initialize serial communication
     Serial.begin(115200);
     delay(1000);
+    bootMark(BOOT_SERIAL);
 
     Serial.println();
     Serial.println("================================");
@@ -60,10 +101,6 @@ void setup() {
     Serial.println("================================");
     Serial.println();
 
-    // Initialize I2C for light sensor
-    Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
-    Serial.printf("I2C initialized on SDA=%d, SCL=%d\n", I2C_SDA_PIN, I2C_SCL_PIN);
-
     // Initialize sensors
     Serial.println("Initializing sensors...");
 
@@ -72,18 +109,28 @@ void setup() {
     } else {
         Serial.printf("  [FAIL] Microphone initialization failed\n");
     }
-
-    if (dhtSensor.begin()) {
-        Serial.printf("  [OK] DHT sensor on GPIO%d\n", DHT_PIN);
-    } else {
-        Serial.printf("  [FAIL] DHT sensor initialization failed\n");
+    bootMark(BOOT_MIC);
+
+    for (size_t i = 0; i < DHT_COUNT; i++) {
+        dhtSensors[i] = new DHTSensor(dhtPins[i]);
+        if (dhtSensors[i]->begin()) {
+            Serial.printf("  [OK] DHT sensor on GPIO%d\n", dhtPins[i]);
+        } else {
+            Serial.printf("  [FAIL] DHT sensor on GPIO%d initialization failed\n", dhtPins[i]);
+        }
     }
+    bootMark(BOOT_DHT);
 
-    if (lightSensor.begin()) {
-        Serial.printf("  [OK] Light sensor (BH1750) on I2C\n");
+    // Scan the I2C bus and bind drivers to whatever answers
+    i2cBus.begin();
+    Serial.printf("I2C initialized on SDA=%d, SCL=%d\n", I2C_SDA_PIN, I2C_SCL_PIN);
+    i2cBus.printInventory();
+    if (i2cBus.getLightCount() > 0) {
+        Serial.printf("  [OK] %d light sensor(s) (BH1750) on I2C\n", (int)i2cBus.getLightCount());
     } else {
-        Serial.printf("  [FAIL] Light sensor initialization failed\n");
+        Serial.printf("  [FAIL] No light sensor found on I2C\n");
     }
+    bootMark(BOOT_I2C);
 
     Serial.println();
     Serial.println("Sensor initialization complete!");
@@ -92,6 +139,9 @@ void setup() {
 
     // Initialize sensor data
     memset(&sensorData, 0, sizeof(sensorData));
+
+    bootMark(BOOT_SETUP_DONE);
+    printBootProfile();
 }
 
 void loop() {
@@ -110,17 +160,34 @@ void loop() {
     if (currentMillis - lastSensorRead >= SENSOR_READ_INTERVAL) {
         lastSensorRead = currentMillis;
 
-        // Read DHT sensor
-        DHTReading dhtReading = dhtSensor.read();
-        if (dhtReading.isValid) {
-            sensorData.temperature = dhtReading.temperature;
-            sensorData.humidity = dhtReading.humidity;
+        // Read all DHT sensors in one capture window; the first valid one
+        // is the node's temperature/humidity
+        DHTReading dhtReadings[DHT_COUNT];
+        DHTSensor::readAll(dhtSensors, DHT_COUNT, dhtReadings);
+        for (size_t i = 0; i < DHT_COUNT; i++) {
+            if (dhtReadings[i].isValid) {
+                sensorData.temperature = dhtReadings[i].temperature;
+                sensorData.humidity = dhtReadings[i].humidity;
+                break;
+            }
+        }
+        for (size_t i = 1; i < DHT_COUNT; i++) {
+            Serial.printf("DHT GPIO%d: %.1f°C %.1f%%%s\n", dhtPins[i],
+                          dhtReadings[i].temperature, dhtReadings[i].humidity,
+                          dhtReadings[i].isValid ? "" : " (stale)");
         }
 
-        // Read light sensor
-        LightReading lightReading = lightSensor.read();
-        if (lightReading.isValid) {
-            sensorData.lightLevel = lightReading.lux;
+        // Read all light sensors in one bus pass; the first is the node's
+        // light level
+        LightReading lightReadings[I2C_MAX_LIGHT_SENSORS];
+        i2cBus.readLights(lightReadings);
+        if (i2cBus.getLightCount() > 0 && lightReadings[0].isValid) {
+            sensorData.lightLevel = lightReadings[0].lux;
+        }
+        for (size_t i = 1; i < i2cBus.getLightCount(); i++) {
+            Serial.printf("Light %s (0x%02X): %.1f lux%s\n", i2cBus.getLightChannel(i),
+                          i2cBus.getLight(i)->getAddress(), lightReadings[i].lux,
+                          lightReadings[i].isValid ? "" : " (stale)");
         }
 
         // Reset audio peak after reporting
@@ -1,49 +1,83 @@
 /**
  * DHT Temperature/Humidity Sensor Implementation
- * DHT22/DHT11 on GPIO4
+ * DHT22/DHT11 on any GPIO, captured with the RMT peripheral
  */
 
 #include "sensors/dht_sensor.h"
+#include <driver/gpio.h>
 
-DHTSensor::DHTSensor()
-    : _dht(nullptr)
+int DHTSensor::_nextChannel = RMT_CHANNEL_0;
+
+DHTSensor::DHTSensor(uint8_t pin, uint8_t type)
+    : _pin(pin)
+    , _type(type)
+    , _dht(nullptr)
+    , _channel(RMT_CHANNEL_0)
+    , _ringbuf(nullptr)
+    , _useRmt(false)
     , _lastTemp(0.0f)
     , _lastHumidity(0.0f)
     , _initialized(false) {
 }
 
+bool DHTSensor::setupRmt() {
+    if (_nextChannel >= RMT_CHANNEL_MAX) {
+        return false;
+    }
+    _channel = (rmt_channel_t)_nextChannel;
+
+    rmt_config_t config = RMT_DEFAULT_CONFIG_RX((gpio_num_t)_pin, _channel);
+    config.clk_div = 80;  // 80 MHz APB -> 1 us ticks
+    config.rx_config.filter_en = true;
+    config.rx_config.filter_ticks_thresh = 100;  // Ignore glitches < 1.25 us
+    config.rx_config.idle_threshold = DHT_IDLE_US;
+
+    if (rmt_config(&config) != ESP_OK) {
+        return false;
+    }
+    if (rmt_driver_install(_channel, 1024, 0) != ESP_OK) {
+        return false;
+    }
+    rmt_get_ringbuf_handle(_channel, &_ringbuf);
+
+    // The RMT input stays routed while the pin is also driven open-drain
+    // for the start pulse; the pull-up releases the line
+    gpio_set_direction((gpio_num_t)_pin, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_pull_mode((gpio_num_t)_pin, GPIO_PULLUP_ONLY);
+    gpio_set_level((gpio_num_t)_pin, 1);
+
+    _nextChannel++;
+    return true;
+}
+
 bool DHTSensor::begin() {
     // Create DHT instance
-    _dht = new DHT(DHT_PIN, DHT_TYPE);
+    _dht = new DHT(_pin, _type);
 
     if (_dht == nullptr) {
         return false;
     }
 
-    // Initialize DHT sensor
-    _dht->begin();
+    _useRmt = setupRmt();
+    if (!_useRmt) {
+        // Out of RMT channels: fall back to the bit-banged driver
+        _dht->begin();
+    }
 
     // Wait for sensor to stabilize
     delay(2000);
 
     // Try to get a reading to verify sensor is working
-    float temp = _dht->readTemperature();
-    float humidity = _dht->readHumidity();
+    _initialized = true;
+    DHTReading reading = read();
 
-    if (isnan(temp) || isnan(humidity)) {
+    if (!reading.isValid) {
         // First reading often fails, try once more
         delay(2000);
-        temp = _dht->readTemperature();
-        humidity = _dht->readHumidity();
-    }
-
-    _initialized = !isnan(temp) && !isnan(humidity);
-
-    if (_initialized) {
-        _lastTemp = temp;
-        _lastHumidity = humidity;
+        reading = read();
     }
 
+    _initialized = reading.isValid;
     return _initialized;
 }
 
@@ -66,20 +100,44 @@ bool DHTSensor::validateReading(float temp, float humidity) {
     return true;
 }
 
-DHTReading DHTSensor::read() {
-    DHTReading reading;
-    reading.isValid = false;
+bool DHTSensor::decode(const rmt_item32_t* items, size_t count, float& temp, float& humidity) {
+    // The 40 data bits are the last 40 high pulses; anything before them
+    // (part of the start pulse, the 80 us response) is ignored
+    uint16_t highs[2 * 64];
+    size_t n = 0;
+    for (size_t i = 0; i < count && n + 2 <= sizeof(highs) / sizeof(highs[0]); i++) {
+        if (items[i].level0 == 1 && items[i].duration0 > 0) highs[n++] = items[i].duration0;
+        if (items[i].level1 == 1 && items[i].duration1 > 0) highs[n++] = items[i].duration1;
+    }
+    if (n < 40) {
+        return false;
+    }
 
-    if (!_initialized || _dht == nullptr) {
-        reading.temperature = 0.0f;
-        reading.humidity = 0.0f;
-        reading.heatIndex = 0.0f;
-        return reading;
+    uint8_t data[5] = {0, 0, 0, 0, 0};
+    for (size_t bit = 0; bit < 40; bit++) {
+        data[bit / 8] <<= 1;
+        if (highs[n - 40 + bit] > DHT_BIT_ONE_US) {
+            data[bit / 8] |= 1;
+        }
+    }
+    if (((data[0] + data[1] + data[2] + data[3]) & 0xFF) != data[4]) {
+        return false;
+    }
+
+    if (_type == DHT11) {
+        humidity = data[0] + data[1] * 0.1f;
+        temp = (data[2] & 0x7F) + data[3] * 0.1f;
+        if (data[2] & 0x80) temp = -temp;
+    } else {
+        humidity = ((data[0] << 8) | data[1]) * 0.1f;
+        temp = (((data[2] & 0x7F) << 8) | data[3]) * 0.1f;
+        if (data[2] & 0x80) temp = -temp;
     }
+    return true;
+}
 
-    // Read temperature and humidity
-    float temp = _dht->readTemperature();
-    float humidity = _dht->readHumidity();
+DHTReading DHTSensor::finish(float temp, float humidity) {
+    DHTReading reading;
 
     // Validate reading
     if (validateReading(temp, humidity)) {
@@ -102,15 +160,84 @@ DHTReading DHTSensor::read() {
     return reading;
 }
 
+size_t DHTSensor::readAll(DHTSensor* const* sensors, size_t count, DHTReading* readings) {
+    size_t valid = 0;
+
+    // Start pulse on every RMT-backed sensor at once, held for the longest
+    // any of them needs: one DHT11 stretches the whole batch to 18 ms
+    uint32_t startUs = DHT_START_PULSE_US;
+    for (size_t i = 0; i < count; i++) {
+        DHTSensor* s = sensors[i];
+        if (!s->_initialized || !s->_useRmt) continue;
+        if (s->_type == DHT11) startUs = DHT11_START_PULSE_US;
+
+        // Drop anything left from a glitch since the last read
+        size_t len = 0;
+        void* stale;
+        while ((stale = xRingbufferReceive(s->_ringbuf, &len, 0)) != nullptr) {
+            vRingbufferReturnItem(s->_ringbuf, stale);
+        }
+        gpio_set_level((gpio_num_t)s->_pin, 0);
+    }
+    delayMicroseconds(startUs);
+    for (size_t i = 0; i < count; i++) {
+        DHTSensor* s = sensors[i];
+        if (s->_initialized && s->_useRmt) rmt_rx_start(s->_channel, true);
+    }
+    // Release all lines back-to-back; the sensors answer ~20-40 us later
+    for (size_t i = 0; i < count; i++) {
+        DHTSensor* s = sensors[i];
+        if (s->_initialized && s->_useRmt) gpio_set_level((gpio_num_t)s->_pin, 1);
+    }
+
+    // Collect the frames; they all finish within the same ~5 ms
+    for (size_t i = 0; i < count; i++) {
+        DHTSensor* s = sensors[i];
+        float temp = NAN;
+        float humidity = NAN;
+
+        if (!s->_initialized || s->_dht == nullptr) {
+            readings[i].temperature = 0.0f;
+            readings[i].humidity = 0.0f;
+            readings[i].heatIndex = 0.0f;
+            readings[i].isValid = false;
+            continue;
+        }
+
+        if (s->_useRmt) {
+            size_t len = 0;
+            rmt_item32_t* items = (rmt_item32_t*)xRingbufferReceive(
+                s->_ringbuf, &len, pdMS_TO_TICKS(DHT_FRAME_TIMEOUT_MS));
+            rmt_rx_stop(s->_channel);
+            if (items != nullptr) {
+                s->decode(items, len / sizeof(rmt_item32_t), temp, humidity);
+                vRingbufferReturnItem(s->_ringbuf, items);
+            }
+        } else {
+            temp = s->_dht->readTemperature();
+            humidity = s->_dht->readHumidity();
+        }
+
+        readings[i] = s->finish(temp, humidity);
+        if (readings[i].isValid) valid++;
+    }
+
+    return valid;
+}
+
+DHTReading DHTSensor::read() {
+    DHTSensor* self = this;
+    DHTReading reading;
+    readAll(&self, 1, &reading);
+    return reading;
+}
+
 float DHTSensor::getTemperatureF() {
     if (!_initialized || _dht == nullptr) {
         return 0.0f;
     }
 
-    float tempC = _dht->readTemperature();
-    if (isnan(tempC)) {
-        tempC = _lastTemp;
-    }
+    float tempC = read().temperature;
 
     // Convert to Fahrenheit
     return (tempC * 9.0f / 5.0f) + 32.0f;
@@ -122,6 +249,5 @@ bool DHTSensor::isConnected() {
     }
 
     // Try to read - if we get valid data, sensor is connected
-    float temp = _dht->readTemperature();
-    return !isnan(temp);
+    return read().isValid;
 }
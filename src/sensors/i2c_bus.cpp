@@ -0,0 +1,95 @@
+/**
+ * I2C Bus Implementation
+ * Boot-time scan with automatic driver binding
+ */
+
+#include "sensors/i2c_bus.h"
+
+// Devices this firmware has drivers for, and the channel each one reports
+static const struct {
+    uint8_t address;
+    I2CDeviceType type;
+    const char* name;
+    const char* channel;
+} KNOWN_DEVICES[] = {
+    {0x23, I2C_DEVICE_BH1750, "BH1750", "light"},    // ADDR pin low (room)
+    {0x5C, I2C_DEVICE_BH1750, "BH1750", "light_2"},  // ADDR pin high (window)
+};
+
+I2CBus::I2CBus()
+    : _deviceCount(0)
+    , _lightCount(0) {
+}
+
+bool I2CBus::probe(uint8_t address) {
+    Wire.beginTransmission(address);
+    return Wire.endTransmission() == 0;
+}
+
+void I2CBus::bind(I2CDevice& device) {
+    for (const auto& known : KNOWN_DEVICES) {
+        if (known.address != device.address) {
+            continue;
+        }
+        device.type = known.type;
+        device.name = known.name;
+
+        if (known.type == I2C_DEVICE_BH1750 && _lightCount < I2C_MAX_LIGHT_SENSORS) {
+            LightSensor* sensor = new LightSensor(device.address);
+            if (sensor != nullptr && sensor->begin()) {
+                _lights[_lightCount] = sensor;
+                _lightChannels[_lightCount] = known.channel;
+                _lightCount++;
+                device.channel = known.channel;
+            } else {
+                delete sensor;
+            }
+        }
+        return;
+    }
+}
+
+size_t I2CBus::begin() {
+    Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
+    Wire.setClock(I2C_BUS_CLOCK);
+
+    _deviceCount = 0;
+    for (uint8_t address = I2C_SCAN_FIRST; address <= I2C_SCAN_LAST; address++) {
+        if (_deviceCount >= I2C_MAX_DEVICES) {
+            break;
+        }
+        if (!probe(address)) {
+            continue;
+        }
+        I2CDevice& device = _devices[_deviceCount++];
+        device.address = address;
+        device.type = I2C_DEVICE_UNKNOWN;
+        device.name = "unknown";
+        device.channel = nullptr;
+        bind(device);
+    }
+
+    return _deviceCount;
+}
+
+size_t I2CBus::readLights(LightReading* readings) {
+    // Sensors run in continuous mode, so every conversion is already done:
+    // one 2-byte read per sensor with no waits in between
+    size_t valid = 0;
+    for (size_t i = 0; i < _lightCount; i++) {
+        readings[i] = _lights[i]->read();
+        if (readings[i].isValid) {
+            valid++;
+        }
+    }
+    return valid;
+}
+
+void I2CBus::printInventory() {
+    Serial.printf("I2C bus: %d device(s)\n", (int)_deviceCount);
+    for (size_t i = 0; i < _deviceCount; i++) {
+        const I2CDevice& device = _devices[i];
+        Serial.printf("  0x%02X %-8s %s\n", device.address, device.name,
+                      device.channel ? device.channel : "(no driver)");
+    }
+}
@@ -5,23 +5,26 @@
 
 #include "sensors/light_sensor.h"
 
-LightSensor::LightSensor()
-    : _sensor(nullptr)
+LightSensor::LightSensor(uint8_t address)
+    : _address(address)
+    , _sensor(nullptr)
     , _initialized(false)
     , _lastLux(0.0f) {
 }
 
 bool LightSensor::begin() {
     // Create BH1750 instance
-    _sensor = new BH1750(BH1750_ADDRESS);
+    _sensor = new BH1750(_address);
 
     if (_sensor == nullptr) {
         return false;
     }
 
     // Initialize the sensor
-    // Using continuous high-resolution mode for best accuracy
-    _initialized = _sensor->begin(BH1750::CONTINUOUS_HIGH_RES_MODE);
+    // Using continuous high-resolution mode for best accuracy. begin()'s
+    // address argument defaults to 0x23 and overrides the constructor's,
+    // so pass it again or a 0x5C sensor is never addressed.
+    _initialized = _sensor->begin(BH1750::CONTINUOUS_HIGH_RES_MODE, _address);
 
     if (_initialized) {
         // Wait for first measurement